@@ -8,6 +8,7 @@
 
 #include <Biribit/BiribitConfig.h>
 #include <Biribit/Packet.h>
+#include <Biribit/LocalLink.h>
 #include <Biribit/Client/BiribitTypes.h>
 #include <Biribit/Client/BiribitEvent.h>
 
@@ -22,6 +23,8 @@ public:
 	virtual ~Client();
 
 	void Connect(const char* addr = nullptr, unsigned short port = 0, const char* password = nullptr);
+	// To a server of this process, from its Server::ConnectLocal.
+	void Connect(std::shared_ptr<LocalLink> link);
 	void Disconnect(Connection::id_t id);
 	void Disconnect();
 
@@ -50,8 +53,31 @@ public:
 	Room::id_t GetJoinedRoomId(Connection::id_t id);
 	Room::slot_id_t GetJoinedRoomSlot(Connection::id_t id);
 
-	void SendBroadcast(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask = Packet::Unreliable);
-	void SendBroadcast(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask = Packet::Unreliable);
+	// Follows a room without taking a slot, Room::UNASSIGNED_ID stops. The
+	// server may send spectators to a relay, the room is then spectated
+	// from a new connection.
+	void SpectateRoom(Connection::id_t id, Room::id_t room_id);
+	bool IsSpectating(Connection::id_t id);
+
+	// Estimated server clock in milliseconds since the server started, zero
+	// until the first clock sample arrives.
+	milliseconds_t GetServerTime(Connection::id_t id);
+
+	void SendBroadcast(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask = Packet::Unreliable, Room::stream_id_t stream = 0);
+	void SendBroadcast(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask = Packet::Unreliable, Room::stream_id_t stream = 0);
+
+	void SendBroadcastToInterest(Connection::id_t id, Room::interest_t interest, const Packet& packet, Packet::ReliabilityBitmask mask = Packet::Unreliable, Room::stream_id_t stream = 0);
+	void SendBroadcastToInterest(Connection::id_t id, Room::interest_t interest, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask = Packet::Unreliable, Room::stream_id_t stream = 0);
+
+	void SendBroadcastToSlots(Connection::id_t id, const std::vector<Room::slot_id_t>& slots, const Packet& packet, Packet::ReliabilityBitmask mask = Packet::Unreliable, Room::stream_id_t stream = 0);
+	void SendBroadcastToSlots(Connection::id_t id, const std::vector<Room::slot_id_t>& slots, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask = Packet::Unreliable, Room::stream_id_t stream = 0);
+
+	void SendBroadcastToOthers(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask = Packet::Unreliable, Room::stream_id_t stream = 0);
+	void SendBroadcastToOthers(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask = Packet::Unreliable, Room::stream_id_t stream = 0);
+
+	void SetInterests(Connection::id_t id, const std::vector<Room::interest_t>& interests);
+	void AddInterest(Connection::id_t id, Room::interest_t interest);
+	void RemoveInterest(Connection::id_t id, Room::interest_t interest);
 
 	void SendEntry(Connection::id_t id, const Packet& packet);
 	void SendEntry(Connection::id_t id, const char* data, unsigned int lenght);
@@ -15,6 +15,11 @@ namespace Biribit
 		WARN_CANNOT_JOIN_TO_OTHER_APP_ROOM,
 		WARN_CANNOT_JOIN_TO_OCCUPIED_SLOT,
 		WARN_CANNOT_JOIN_TO_INVALID_SLOT,
-		WARN_CANNOT_JOIN_TO_FULL_ROOM
+		WARN_CANNOT_JOIN_TO_FULL_ROOM,
+		WARN_CANNOT_JOIN_TO_MIGRATING_ROOM,
+		WARN_CANNOT_CLAIM_WITH_INVALID_TOKEN,
+		WARN_CLIENT_THROTTLED,
+		WARN_ROOM_CONGESTED,
+		WARN_APP_QUOTA_EXCEEDED
 	};
 }
\ No newline at end of file
@@ -110,6 +110,7 @@ namespace Biribit
 		Connection::id_t connection;
 		Room::id_t room_id;
 		std::uint8_t slot_id;
+		bool spectator;
 
 		JoinedRoomEvent();
 		virtual ~JoinedRoomEvent();
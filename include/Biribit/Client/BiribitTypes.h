@@ -39,6 +39,11 @@ struct API_EXPORT Connection
 	std::string name;
 	std::uint32_t ping;
 
+	// Round trip in milliseconds behind the control (joins, room status)
+	// and data (journal, broadcasts) traffic, 0 until measured.
+	std::uint32_t control_latency;
+	std::uint32_t data_latency;
+
 	Connection();
 };
 
@@ -66,7 +71,9 @@ struct API_EXPORT ClientParameters
 struct API_EXPORT Room
 {
 	using id_t = Biribit::id_t;
-	using slot_id_t = std::uint8_t;
+	using slot_id_t = std::uint16_t;
+	using interest_t = std::uint32_t;
+	using stream_id_t = std::uint8_t;
 	enum { UNASSIGNED_ID = Biribit::UNASSIGNED_ID };
 
 	id_t id;
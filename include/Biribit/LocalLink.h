@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <cstddef>
+
+namespace Biribit
+{
+
+// Connection between a client and a server embedded in the same process,
+// handed out by Server::ConnectLocal and given to Client::Connect. Messages
+// cross it through two queues instead of sockets and the RakNet reliability
+// layer, each end polls its queue from its network thread. Nothing is ever
+// lost nor reordered, so every reliability is honored.
+class LocalLink
+{
+public:
+	enum End { SERVER_END = 0, CLIENT_END = 1 };
+
+	LocalLink() : m_closed(false) {}
+
+	void Push(End to, const char* data, std::size_t size)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_closed)
+			m_inbox[to].emplace_back(data, size);
+	}
+
+	// Takes every message waiting at the end, in the order they were pushed.
+	bool Pull(End end, std::deque<std::string>& messages)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		messages.clear();
+		messages.swap(m_inbox[end]);
+		return !messages.empty();
+	}
+
+	// Later pushes are dropped. Messages already waiting are still pulled.
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+	}
+
+	bool IsClosed()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_closed;
+	}
+
+private:
+	std::mutex m_mutex;
+	std::deque<std::string> m_inbox[2];
+	bool m_closed;
+
+	LocalLink(const LocalLink&);
+	LocalLink& operator=(const LocalLink&);
+};
+
+}
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <cstdint>
 
 #include <Biribit/BiribitConfig.h>
@@ -27,7 +28,26 @@ public :
 		Unreliable = 0,
 		Reliable = 1,
 		Ordered = 2,
-		ReliableOrdered = 3
+		ReliableOrdered = 3,
+		Sequenced = 4,
+		UnreliableSequenced = 4,
+		ReliableSequenced = 5
+	};
+
+	////////////////////////////////////////////////////////////
+	/// \brief Encodings of the << and >> operators
+	///
+	/// Fixed writes 16 and 32 bits integers big-endian at their
+	/// full width, with 32 bits string lengths. Compact writes
+	/// them as varints, zigzag encoded when signed, so small
+	/// values take one byte. Floats, doubles and 8 bits values
+	/// are the same in both. Both ends must agree.
+	///
+	////////////////////////////////////////////////////////////
+	enum Encoding
+	{
+		Fixed = 0,
+		Compact = 1
 	};
 
 	////////////////////////////////////////////////////////////
@@ -46,6 +66,15 @@ public :
 	////////////////////////////////////////////////////////////
 	Packet(Packet&& packet);
 
+	////////////////////////////////////////////////////////////
+	/// \brief Copy constructor
+	///
+	/// Cheap, both packets share the same data until one of
+	/// them appends to it.
+	///
+	////////////////////////////////////////////////////////////
+	Packet(const Packet& packet);
+
 	////////////////////////////////////////////////////////////
 	/// \brief Append constructor
 	///
@@ -68,6 +97,14 @@ public :
 	////////////////////////////////////////////////////////////
 	Packet& operator=(Packet&& packet);
 
+	////////////////////////////////////////////////////////////
+	/// \brief Copy operator
+	///
+	/// Shares the data, like the copy constructor.
+	///
+	////////////////////////////////////////////////////////////
+	Packet& operator=(const Packet& packet);
+
 	////////////////////////////////////////////////////////////
 	/// \brief Append data to the end of the packet
 	///
@@ -77,6 +114,44 @@ public :
 	////////////////////////////////////////////////////////////
 	void append(const void* data, std::size_t sizeInBytes);
 
+	////////////////////////////////////////////////////////////
+	/// \brief Get a packet with part of the data of this one
+	///
+	/// The slice shares the data instead of copying it, unless
+	/// it is small. Its reading position starts at its
+	/// beginning.
+	///
+	/// \param offset      Position of the first byte of the slice
+	/// \param sizeInBytes Number of bytes, cut to the data left
+	///
+	////////////////////////////////////////////////////////////
+	Packet slice(std::size_t offset, std::size_t sizeInBytes) const;
+
+	////////////////////////////////////////////////////////////
+	/// \brief Make room at the end of the packet
+	///
+	/// For data written in place, such as encoded schemas.
+	/// The bytes are uninitialized.
+	///
+	/// \param sizeInBytes Number of bytes to add
+	///
+	/// \return Pointer to the new bytes, valid until the packet
+	///         changes again
+	///
+	////////////////////////////////////////////////////////////
+	void* grow(std::size_t sizeInBytes);
+
+	////////////////////////////////////////////////////////////
+	/// \brief Get the next bytes to read and move past them
+	///
+	/// \param sizeInBytes Number of bytes to read
+	///
+	/// \return Pointer to the bytes, NULL if there aren't as
+	///         many left, the packet is then invalid
+	///
+	////////////////////////////////////////////////////////////
+	const void* consume(std::size_t sizeInBytes);
+
 	////////////////////////////////////////////////////////////
 	/// \brief Clear the packet
 	///
@@ -131,6 +206,16 @@ public :
 	////////////////////////////////////////////////////////////
 	std::size_t getReadPos() const;
 
+	////////////////////////////////////////////////////////////
+	/// \brief Select the encoding of the << and >> operators
+	///
+	/// Packets start with Fixed, the one of previous versions.
+	/// The encoding can change in the middle of a packet.
+	///
+	////////////////////////////////////////////////////////////
+	void setEncoding(Encoding encoding);
+	Encoding getEncoding() const;
+
 public:
 
 	////////////////////////////////////////////////////////////
@@ -208,6 +293,35 @@ public:
 	Packet& operator <<(const wchar_t*      data);
 	Packet& operator <<(const std::wstring& data);
 
+	////////////////////////////////////////////////////////////
+	/// Compact encodings, whatever the selected one
+	///
+	/// Varints take 7 bits per byte, zigzag maps signed values
+	/// to varints so small negative numbers stay small.
+	///
+	/// Bits are packed low first, consecutive calls share bytes.
+	/// Any other write or read starts at the next whole byte.
+	///
+	/// Quantized floats are clamped to [min, max] and stored in
+	/// the given number of bits, 1 to 32. The error is at most
+	/// half a step, (max - min) / (2^bits - 1) / 2.
+	///
+	/// Short strings have a varint length.
+	///
+	////////////////////////////////////////////////////////////
+	Packet& writeVarint(std::uint64_t data);
+	Packet& readVarint(std::uint64_t& data);
+	Packet& writeZigZag(std::int64_t data);
+	Packet& readZigZag(std::int64_t& data);
+	Packet& writeBits(std::uint32_t data, unsigned int count);
+	Packet& readBits(std::uint32_t& data, unsigned int count);
+	Packet& writeQuantized(float data, float min, float max, unsigned int bits);
+	Packet& readQuantized(float& data, float min, float max, unsigned int bits);
+	Packet& writeQuantized(const float* data, std::size_t count, float min, float max, unsigned int bits);
+	Packet& readQuantized(float* data, std::size_t count, float min, float max, unsigned int bits);
+	Packet& writeShortString(const std::string& data);
+	Packet& readShortString(std::string& data);
+
 protected:
 
 	friend class TcpSocket;
@@ -249,13 +363,6 @@ protected:
 	virtual void onReceive(const void* data, std::size_t size);
 
 private :
-	////////////////////////////////////////////////////////////
-	/// Disallow copy constructors and operators
-	///
-	////////////////////////////////////////////////////////////
-	Packet(const Packet& right);
-	Packet& operator=(const Packet& right);
-
 	////////////////////////////////////////////////////////////
 	/// Disallow comparisons between packets
 	///
@@ -275,12 +382,45 @@ private :
 	////////////////////////////////////////////////////////////
 	bool checkSize(std::size_t size);
 
+	////////////////////////////////////////////////////////////
+	/// \brief Read an integer of the Compact encoding
+	///
+	/// Invalidates the packet if the value is out of range.
+	///
+	////////////////////////////////////////////////////////////
+	bool readCompact(std::uint64_t& data, std::uint64_t max);
+	bool readCompact(std::int64_t& data, std::int64_t min, std::int64_t max);
+
+	////////////////////////////////////////////////////////////
+	/// \brief Get the first byte of the data, even if empty
+	///
+	////////////////////////////////////////////////////////////
+	const char* getBytes() const;
+
+	////////////////////////////////////////////////////////////
+	/// \brief Grow the data, copying it first if it is shared
+	///
+	/// \param sizeInBytes Number of bytes to add
+	///
+	/// \return Pointer to the bytes added, to be written
+	///
+	////////////////////////////////////////////////////////////
+	char* extend(std::size_t sizeInBytes);
+
+	enum { SMALL_BUFFER_SIZE = 32 };
+
 	////////////////////////////////////////////////////////////
 	// Member data
 	////////////////////////////////////////////////////////////
-	std::vector<char> m_data;    ///< Data stored in the packet
-	std::size_t       m_readPos; ///< Current reading position in the packet
-	bool              m_isValid; ///< Reading state of the packet
+	std::shared_ptr<std::vector<char>> m_buffer;  ///< Pooled data, shared by copies and slices. Null while the data fits in m_small
+	std::size_t       m_offset;                   ///< Position of the data in m_buffer
+	std::size_t       m_size;                     ///< Data size, in bytes
+	char              m_small[SMALL_BUFFER_SIZE]; ///< Data of small packets, never shared
+	std::size_t       m_readPos;                  ///< Current reading position in the packet
+	unsigned int      m_readBits;                 ///< Bits already read of the byte at m_readPos
+	unsigned int      m_writeBits;                ///< Bits already written of the last byte, 0 when whole
+	bool              m_isValid;                  ///< Reading state of the packet
+	Encoding          m_encoding;                 ///< Encoding of the << and >> operators
 };
 
 }
@@ -0,0 +1,388 @@
+#ifndef _SCHEMA_H
+#define _SCHEMA_H
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+#include <Biribit/Packet.h>
+
+////////////////////////////////////////////////////////////
+/// Serialization of user structs from a description of their
+/// fields, made once at compile time:
+///
+/// \code
+/// struct PlayerState { std::uint32_t id; float x, y; std::string name; };
+///
+/// namespace Biribit {
+/// template<> struct Schema<PlayerState> : Fields<
+///     BIRIBIT_FIELD(PlayerState, id),
+///     BIRIBIT_FIELD(PlayerState, x),
+///     BIRIBIT_FIELD(PlayerState, y),
+///     BIRIBIT_FIELD(PlayerState, name)> {};
+/// }
+///
+/// Biribit::Encode(packet, state);
+/// Biribit::EncodeDelta(packet, state, last_sent);
+/// \endcode
+///
+/// Fields are integers, bools, enums, floats, doubles, strings
+/// and structs with a schema of their own. Encoding computes
+/// the size first and writes everything in one go. The bytes
+/// are the ones of the Fixed encoding of Packet, so Encode
+/// matches a chain of << with the same fields.
+///
+/// Only this header is needed. Server plugins use the overloads
+/// on raw buffers, they don't link the client library.
+///
+////////////////////////////////////////////////////////////
+
+#define BIRIBIT_FIELD(type, name) ::Biribit::Field<type, decltype(type::name), &type::name>
+
+namespace Biribit
+{
+
+template<class T> struct Schema;
+
+template<class T, class V, V T::*member> struct Field
+{
+	typedef T object_type;
+	typedef V value_type;
+
+	static const V& get(const T& object) { return object.*member; }
+	static V& get(T& object) { return object.*member; }
+};
+
+////////////////////////////////////////////////////////////
+// Codecs of the field types. Read returns the position after
+// the value, or null if the input ends first.
+////////////////////////////////////////////////////////////
+
+// Structs with a schema.
+template<class V, class Enable = void> struct FieldCodec
+{
+	static const bool fixed = Schema<V>::fixed;
+	static const std::size_t fixed_size = Schema<V>::fixed_size;
+
+	static std::size_t size(const V& value) { return Schema<V>::size(value); }
+	static char* write(const V& value, char* out) { return Schema<V>::write(value, out); }
+	static const char* read(V& value, const char* in, const char* end) { return Schema<V>::read(value, in, end); }
+	static bool equal(const V& a, const V& b) { return Schema<V>::equal(a, b); }
+};
+
+// Integers, big-endian.
+template<class V> struct FieldCodec<V, typename std::enable_if<std::is_integral<V>::value && !std::is_same<V, bool>::value>::type>
+{
+	typedef typename std::make_unsigned<V>::type unsigned_type;
+
+	static const bool fixed = true;
+	static const std::size_t fixed_size = sizeof(V);
+
+	static std::size_t size(const V&) { return sizeof(V); }
+
+	static char* write(const V& value, char* out)
+	{
+		unsigned_type bits = static_cast<unsigned_type>(value);
+		for (std::size_t i = sizeof(V); i > 0; i--) {
+			out[i - 1] = static_cast<char>(bits & 0xFF);
+			bits = static_cast<unsigned_type>(bits >> 4 >> 4);
+		}
+
+		return out + sizeof(V);
+	}
+
+	static const char* read(V& value, const char* in, const char* end)
+	{
+		if (end - in < (std::ptrdiff_t) sizeof(V))
+			return nullptr;
+
+		unsigned_type bits = 0;
+		for (std::size_t i = 0; i < sizeof(V); i++)
+			bits = static_cast<unsigned_type>((bits << 4 << 4) | static_cast<std::uint8_t>(in[i]));
+
+		value = static_cast<V>(bits);
+		return in + sizeof(V);
+	}
+
+	static bool equal(const V& a, const V& b) { return a == b; }
+};
+
+template<> struct FieldCodec<bool>
+{
+	static const bool fixed = true;
+	static const std::size_t fixed_size = 1;
+
+	static std::size_t size(const bool&) { return 1; }
+
+	static char* write(const bool& value, char* out)
+	{
+		*out = value ? 1 : 0;
+		return out + 1;
+	}
+
+	static const char* read(bool& value, const char* in, const char* end)
+	{
+		if (in == end)
+			return nullptr;
+
+		value = (*in != 0);
+		return in + 1;
+	}
+
+	static bool equal(const bool& a, const bool& b) { return a == b; }
+};
+
+// Enums, as their underlying integer.
+template<class V> struct FieldCodec<V, typename std::enable_if<std::is_enum<V>::value>::type>
+{
+	typedef typename std::underlying_type<V>::type integer_type;
+	typedef FieldCodec<integer_type> Codec;
+
+	static const bool fixed = true;
+	static const std::size_t fixed_size = sizeof(integer_type);
+
+	static std::size_t size(const V&) { return sizeof(integer_type); }
+	static char* write(const V& value, char* out) { return Codec::write(static_cast<integer_type>(value), out); }
+
+	static const char* read(V& value, const char* in, const char* end)
+	{
+		integer_type integer;
+		const char* next = Codec::read(integer, in, end);
+		if (next != nullptr)
+			value = static_cast<V>(integer);
+
+		return next;
+	}
+
+	static bool equal(const V& a, const V& b) { return a == b; }
+};
+
+// Floats and doubles, in the byte order of the machine.
+template<class V> struct FieldCodec<V, typename std::enable_if<std::is_floating_point<V>::value>::type>
+{
+	static const bool fixed = true;
+	static const std::size_t fixed_size = sizeof(V);
+
+	static std::size_t size(const V&) { return sizeof(V); }
+
+	static char* write(const V& value, char* out)
+	{
+		std::memcpy(out, &value, sizeof(V));
+		return out + sizeof(V);
+	}
+
+	static const char* read(V& value, const char* in, const char* end)
+	{
+		if (end - in < (std::ptrdiff_t) sizeof(V))
+			return nullptr;
+
+		std::memcpy(&value, in, sizeof(V));
+		return in + sizeof(V);
+	}
+
+	static bool equal(const V& a, const V& b) { return a == b; }
+};
+
+// Strings, after their length in 32 bits.
+template<> struct FieldCodec<std::string>
+{
+	typedef FieldCodec<std::uint32_t> Length;
+
+	static const bool fixed = false;
+	static const std::size_t fixed_size = 0;
+
+	static std::size_t size(const std::string& value) { return sizeof(std::uint32_t) + value.size(); }
+
+	static char* write(const std::string& value, char* out)
+	{
+		out = Length::write(static_cast<std::uint32_t>(value.size()), out);
+		if (!value.empty())
+			std::memcpy(out, value.data(), value.size());
+
+		return out + value.size();
+	}
+
+	static const char* read(std::string& value, const char* in, const char* end)
+	{
+		std::uint32_t length;
+		in = Length::read(length, in, end);
+		if (in == nullptr || (std::size_t) (end - in) < length)
+			return nullptr;
+
+		value.assign(in, length);
+		return in + length;
+	}
+
+	static bool equal(const std::string& a, const std::string& b) { return a == b; }
+};
+
+////////////////////////////////////////////////////////////
+// The fields of a schema, unrolled at compile time. Deltas
+// flag changed fields in a mask, bit i for the field i.
+////////////////////////////////////////////////////////////
+template<class... F> struct Fields;
+
+template<> struct Fields<>
+{
+	static const std::size_t count = 0;
+	static const bool fixed = true;
+	static const std::size_t fixed_size = 0;
+
+	template<class T> static std::size_t size(const T&) { return 0; }
+	template<class T> static char* write(const T&, char* out) { return out; }
+	template<class T> static const char* read(T&, const char* in, const char*) { return in; }
+	template<class T> static bool equal(const T&, const T&) { return true; }
+
+	template<class T> static std::size_t deltaSize(const T&, const T&) { return 0; }
+	template<class T> static char* writeDelta(const T&, const T&, char* out, unsigned char*, std::size_t) { return out; }
+	template<class T> static const char* readDelta(T&, const char* in, const char*, const unsigned char*, std::size_t) { return in; }
+};
+
+template<class F, class... Rest> struct Fields<F, Rest...>
+{
+	typedef typename F::object_type object_type;
+	typedef FieldCodec<typename F::value_type> Codec;
+	typedef Fields<Rest...> Next;
+
+	static const std::size_t count = 1 + Next::count;
+	static const bool fixed = Codec::fixed && Next::fixed;
+	// The size of every object, when fixed.
+	static const std::size_t fixed_size = Codec::fixed_size + Next::fixed_size;
+
+	static std::size_t size(const object_type& object)
+	{
+		return fixed ? fixed_size : Codec::size(F::get(object)) + Next::size(object);
+	}
+
+	static char* write(const object_type& object, char* out)
+	{
+		return Next::write(object, Codec::write(F::get(object), out));
+	}
+
+	static const char* read(object_type& object, const char* in, const char* end)
+	{
+		in = Codec::read(F::get(object), in, end);
+		return (in != nullptr) ? Next::read(object, in, end) : nullptr;
+	}
+
+	static bool equal(const object_type& a, const object_type& b)
+	{
+		return Codec::equal(F::get(a), F::get(b)) && Next::equal(a, b);
+	}
+
+	static std::size_t deltaSize(const object_type& object, const object_type& base)
+	{
+		std::size_t size = Codec::equal(F::get(object), F::get(base)) ? 0 : Codec::size(F::get(object));
+		return size + Next::deltaSize(object, base);
+	}
+
+	static char* writeDelta(const object_type& object, const object_type& base, char* out, unsigned char* mask, std::size_t index)
+	{
+		if (!Codec::equal(F::get(object), F::get(base))) {
+			mask[index / 8] |= (unsigned char) (1 << (index % 8));
+			out = Codec::write(F::get(object), out);
+		}
+
+		return Next::writeDelta(object, base, out, mask, index + 1);
+	}
+
+	static const char* readDelta(object_type& object, const char* in, const char* end, const unsigned char* mask, std::size_t index)
+	{
+		if ((mask[index / 8] & (1 << (index % 8))) != 0)
+			in = Codec::read(F::get(object), in, end);
+
+		return (in != nullptr) ? Next::readDelta(object, in, end, mask, index + 1) : nullptr;
+	}
+};
+
+////////////////////////////////////////////////////////////
+// Raw buffers
+////////////////////////////////////////////////////////////
+template<class T> std::size_t EncodedSize(const T& object)
+{
+	return Schema<T>::size(object);
+}
+
+// Out has room for EncodedSize bytes. Returns the end of the encoding.
+template<class T> char* Encode(const T& object, char* out)
+{
+	return Schema<T>::write(object, out);
+}
+
+// Returns the bytes read, zero if the data ends first.
+template<class T> std::size_t Decode(const void* data, std::size_t size, T& object)
+{
+	const char* in = static_cast<const char*>(data);
+	const char* end = Schema<T>::read(object, in, in + size);
+	return (end != nullptr) ? (std::size_t) (end - in) : 0;
+}
+
+template<class T> std::size_t DeltaMaskSize()
+{
+	return (Schema<T>::count + 7) / 8;
+}
+
+template<class T> std::size_t EncodedDeltaSize(const T& object, const T& base)
+{
+	return DeltaMaskSize<T>() + Schema<T>::deltaSize(object, base);
+}
+
+// Only the fields changed from base, after the mask flagging them.
+template<class T> char* EncodeDelta(const T& object, const T& base, char* out)
+{
+	unsigned char* mask = reinterpret_cast<unsigned char*>(out);
+	std::memset(mask, 0, DeltaMaskSize<T>());
+	return Schema<T>::writeDelta(object, base, out + DeltaMaskSize<T>(), mask, 0);
+}
+
+// Object starts as base, the fields in the delta overwrite it.
+template<class T> std::size_t DecodeDelta(const void* data, std::size_t size, T& object, const T& base)
+{
+	const char* in = static_cast<const char*>(data);
+	if (size < DeltaMaskSize<T>())
+		return 0;
+
+	object = base;
+	const unsigned char* mask = reinterpret_cast<const unsigned char*>(in);
+	const char* end = Schema<T>::readDelta(object, in + DeltaMaskSize<T>(), in + size, mask, 0);
+	return (end != nullptr) ? (std::size_t) (end - in) : 0;
+}
+
+////////////////////////////////////////////////////////////
+// Packets, one allocation per encoding. Decoding reads from
+// the reading position and invalidates the packet on failure.
+////////////////////////////////////////////////////////////
+template<class T> Packet& Encode(Packet& packet, const T& object)
+{
+	Encode(object, static_cast<char*>(packet.grow(EncodedSize(object))));
+	return packet;
+}
+
+template<class T> Packet& EncodeDelta(Packet& packet, const T& object, const T& base)
+{
+	EncodeDelta(object, base, static_cast<char*>(packet.grow(EncodedDeltaSize(object, base))));
+	return packet;
+}
+
+template<class T> bool Decode(Packet& packet, T& object)
+{
+	const char* data = static_cast<const char*>(packet.consume(0));
+	std::size_t left = packet.getDataSize() - packet.getReadPos();
+	std::size_t read = (data != nullptr) ? Decode(data, left, object) : 0;
+	// Past the end on failure, like a short read.
+	return packet.consume(read > 0 ? read : left + 1) != nullptr;
+}
+
+template<class T> bool DecodeDelta(Packet& packet, T& object, const T& base)
+{
+	const char* data = static_cast<const char*>(packet.consume(0));
+	std::size_t left = packet.getDataSize() - packet.getReadPos();
+	std::size_t read = (data != nullptr) ? DecodeDelta(data, left, object, base) : 0;
+	return packet.consume(read > 0 ? read : left + 1) != nullptr;
+}
+
+}
+
+#endif //_SCHEMA_H
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <Biribit/BiribitConfig.h>
+#include <Biribit/Server/BiribitServer.h>
+#include <Biribit/Server/BiribitServerExports.h>
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Biribit/BiribitConfig.h>
+
+// Server side room logic. A plugin is a shared library exporting
+// brbt_plugin_load, loaded once per appid with --plugin appid=path. Every
+// hook runs on the server network thread, the one owning the rooms, so
+// plugins need no locking as long as they only touch the server through
+// the host functions, and only from inside a hook.
+
+enum brbt_PluginReliability
+{
+	BRBT_PLUGIN_UNRELIABLE = 0,
+	BRBT_PLUGIN_UNRELIABLE_SEQUENCED = 1,
+	BRBT_PLUGIN_RELIABLE = 2,
+	BRBT_PLUGIN_RELIABLE_ORDERED = 3,
+	BRBT_PLUGIN_RELIABLE_SEQUENCED = 4
+};
+
+enum brbt_PluginVerdict
+{
+	BRBT_PLUGIN_PASS = 0,	// Relay the broadcast as it came.
+	BRBT_PLUGIN_CONSUME,	// Drop it, the plugin handled it.
+	BRBT_PLUGIN_REPLACE		// Relay replace_data instead.
+};
+
+struct brbt_PluginBroadcast
+{
+	unsigned int room_id;
+	unsigned int from_slot;
+	unsigned int reliability;
+	unsigned char stream;
+
+	// Payload in the received packet, valid only during the hook.
+	const void* data;
+	unsigned int size;
+
+	// Set with BRBT_PLUGIN_REPLACE. Owned by the plugin, it must stay
+	// valid until the hook returns.
+	const void* replace_data;
+	unsigned int replace_size;
+};
+
+struct brbt_PluginHost
+{
+	void* server;
+
+	// Sends to every member of the room as a broadcast from from_slot.
+	void (*Broadcast)(void* server, unsigned int room_id, unsigned int from_slot, const void* data, unsigned int size, unsigned int reliability, unsigned char stream);
+	// Sends to the client in the slot only.
+	void (*SendTo)(void* server, unsigned int room_id, unsigned int slot, unsigned int from_slot, const void* data, unsigned int size, unsigned int reliability, unsigned char stream);
+	// Appends an entry to the room journal. Calls EntryAppended again.
+	void (*AppendEntry)(void* server, unsigned int room_id, unsigned int from_slot, const void* data, unsigned int size);
+	void (*Log)(void* server, const char* message);
+};
+
+struct brbt_Plugin
+{
+	void* user;
+
+	void (*RoomCreated)(void* user, unsigned int room_id, unsigned int slots_count);
+	void (*RoomClosed)(void* user, unsigned int room_id);
+	void (*ClientJoined)(void* user, unsigned int room_id, unsigned int slot, const char* name);
+	void (*ClientLeft)(void* user, unsigned int room_id, unsigned int slot);
+	brbt_PluginVerdict (*BroadcastReceived)(void* user, brbt_PluginBroadcast* broadcast);
+	void (*EntryAppended)(void* user, unsigned int room_id, unsigned int entry_id, unsigned int from_slot, const void* data, unsigned int size);
+	void (*RoomTick)(void* user, unsigned int room_id, unsigned int elapsed_ms);
+	void (*Unload)(void* user);
+};
+
+#define BRBT_PLUGIN_LOAD_SYMBOL "brbt_plugin_load"
+
+// Fills the hooks the plugin implements, the rest are left null. The host
+// outlives the plugin. Returns zero to refuse loading. Export it with
+// API_C_EXPORT.
+typedef int (*brbt_PluginLoad)(const brbt_PluginHost* host, const char* appid, brbt_Plugin* plugin);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <memory>
+
+#include <Biribit/BiribitConfig.h>
+#include <Biribit/LocalLink.h>
+#include <Biribit/Server/BiribitPlugin.h>
+
+class RakNetServer;
+
+namespace Biribit
+{
+
+struct API_EXPORT ServerStats
+{
+	std::uint32_t clients;
+	std::uint32_t local_clients;
+	std::uint32_t rooms;
+	std::uint32_t plugins;
+	std::uint32_t relayed_bytes_per_second;
+
+	ServerStats();
+};
+
+// The server the BiribitServer executable runs, for games hosting it in
+// their own process. Configure it before Run. Plugins registered here run
+// on the server network thread like the ones loaded from a library.
+class API_EXPORT Server
+{
+public:
+
+	Server();
+	virtual ~Server();
+
+	void AddNode(const char* host, unsigned short port = 0);
+	void SetMigrationThreshold(std::uint32_t relayed_bytes_per_second);
+	void SetStandby(const char* host, unsigned short port = 0);
+	void SetPrimary(const char* host, unsigned short port = 0);
+	void SetOrigin(const char* host, unsigned short port = 0);
+	void AddRelay(const char* host, unsigned short port = 0);
+	void SetHandoffFile(const std::string& path);
+	void SetCaptureFile(const std::string& path);
+
+	bool SetRateLimit(const std::string& appid, const std::string& traffic, float messages_per_second, float bytes_per_second);
+	void SetEgressBudget(const std::string& appid, float bytes_per_second, float weight = 1.0f);
+	void SetAppQuota(const std::string& appid, std::uint32_t max_rooms, std::uint32_t max_clients, std::size_t max_journal_bytes);
+	void SetJournalBudget(std::size_t room_bytes, std::size_t total_bytes, const std::string& spill_dir = std::string());
+	void SetSpectatorRate(float updates_per_second);
+
+	bool LoadPlugin(const std::string& appid, const std::string& path);
+	bool RegisterPlugin(const std::string& appid, const std::string& name, brbt_PluginLoad load);
+
+	bool Run(unsigned short port = 0, const char* name = nullptr, const char* password = nullptr, unsigned int max_clients = 0);
+	bool IsRunning();
+	bool Handoff();
+	bool Close();
+
+	// Waits for the network thread, don't call it from a plugin hook.
+	ServerStats GetStats();
+
+	// A connection for a client of this process, skipping the network.
+	// Null while the server isn't running.
+	std::shared_ptr<LocalLink> ConnectLocal();
+
+private:
+	RakNetServer* m_impl;
+
+	Server(const Server&);
+	Server& operator=(const Server&);
+};
+
+}
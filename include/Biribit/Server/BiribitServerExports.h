@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Biribit/BiribitConfig.h>
+#include <Biribit/Server/BiribitPlugin.h>
+
+typedef void* brbt_Server;
+
+struct brbt_ServerStats
+{
+	unsigned int clients;
+	unsigned int local_clients;
+	unsigned int rooms;
+	unsigned int plugins;
+	unsigned int relayed_bytes_per_second;
+};
+
+////////////////////////////////////////////////////////////
+// \fn	brbt_Server brbt_CreateServer();
+//
+// \brief	Creates a server to embed in the process, stopped.
+//
+////////////////////////////////////////////////////////////
+API_C_EXPORT brbt_Server brbt_CreateServer();
+API_C_EXPORT void brbt_DeleteServer(brbt_Server server);
+
+////////////////////////////////////////////////////////////
+// \fn	int brbt_RunServer(brbt_Server server, unsigned short port, const char* name, const char* password, unsigned int max_clients);
+//
+// \brief	Starts the server. Null or zero arguments take the defaults.
+//
+// \return	Returns 1 if the server is running, otherwise returns 0.
+//
+////////////////////////////////////////////////////////////
+API_C_EXPORT int brbt_RunServer(brbt_Server server, unsigned short port, const char* name, const char* password, unsigned int max_clients);
+API_C_EXPORT int brbt_IsServerRunning(brbt_Server server);
+API_C_EXPORT int brbt_CloseServer(brbt_Server server);
+
+////////////////////////////////////////////////////////////
+// \fn	void brbt_GetServerStats(brbt_Server server, brbt_ServerStats* stats);
+//
+// \brief	Fills the stats, waiting for the server network thread.
+//
+////////////////////////////////////////////////////////////
+API_C_EXPORT void brbt_GetServerStats(brbt_Server server, brbt_ServerStats* stats);
+
+// Configuration, before brbt_RunServer. An empty or null appid stands for
+// the whole server where the option has a server wide value.
+API_C_EXPORT void brbt_ServerAddNode(brbt_Server server, const char* host, unsigned short port);
+API_C_EXPORT void brbt_ServerSetMigrationThreshold(brbt_Server server, unsigned int relayed_bytes_per_second);
+API_C_EXPORT void brbt_ServerSetStandby(brbt_Server server, const char* host, unsigned short port);
+API_C_EXPORT void brbt_ServerSetPrimary(brbt_Server server, const char* host, unsigned short port);
+API_C_EXPORT void brbt_ServerSetOrigin(brbt_Server server, const char* host, unsigned short port);
+API_C_EXPORT void brbt_ServerAddRelay(brbt_Server server, const char* host, unsigned short port);
+API_C_EXPORT void brbt_ServerSetCaptureFile(brbt_Server server, const char* path);
+API_C_EXPORT int brbt_ServerSetRateLimit(brbt_Server server, const char* appid, const char* traffic, float messages_per_second, float bytes_per_second);
+API_C_EXPORT void brbt_ServerSetEgressBudget(brbt_Server server, const char* appid, float bytes_per_second, float weight);
+API_C_EXPORT void brbt_ServerSetAppQuota(brbt_Server server, const char* appid, unsigned int max_rooms, unsigned int max_clients, unsigned int max_journal_bytes);
+API_C_EXPORT void brbt_ServerSetJournalBudget(brbt_Server server, unsigned int room_bytes, unsigned int total_bytes, const char* spill_dir);
+API_C_EXPORT void brbt_ServerSetSpectatorRate(brbt_Server server, float updates_per_second);
+
+////////////////////////////////////////////////////////////
+// \fn	int brbt_ServerRegisterPlugin(brbt_Server server, const char* appid, const char* name, brbt_PluginLoad load);
+//
+// \brief	Adds room logic living in the process for the appid, the same
+//			hooks a plugin library fills. Name shows in the log.
+//
+// \return	Returns 0 if load refused, otherwise returns 1.
+//
+////////////////////////////////////////////////////////////
+API_C_EXPORT int brbt_ServerRegisterPlugin(brbt_Server server, const char* appid, const char* name, brbt_PluginLoad load);
+API_C_EXPORT int brbt_ServerLoadPlugin(brbt_Server server, const char* appid, const char* path);
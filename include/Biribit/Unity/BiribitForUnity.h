@@ -5,7 +5,9 @@
 typedef unsigned int brbt_time_t;
 typedef unsigned int brbt_id_t;
 typedef unsigned char brbt_bool;
-typedef unsigned char brbt_slot_id_t;
+typedef unsigned short brbt_slot_id_t;
+typedef unsigned int brbt_interest_t;
+typedef unsigned char brbt_stream_id_t;
 
 enum brbt_UNASSIGNED { BRBT_UNASSIGNED_ID = 0 };
 
@@ -20,7 +22,10 @@ enum brbt_ReliabilityBitmask
 	BRBT_UNRELIABLE = 0,
 	BRBT_RELIABLE = 1,
 	BRBT_ORDERED = 2,
-	BRBT_RELIABLEORDERED = 3
+	BRBT_RELIABLEORDERED = 3,
+	BRBT_SEQUENCED = 4,
+	BRBT_UNRELIABLESEQUENCED = 4,
+	BRBT_RELIABLESEQUENCED = 5
 };
 
 enum brbt_ErrorId
@@ -36,7 +41,12 @@ enum brbt_ErrorId
 	BRBT_WARN_CANNOT_JOIN_TO_OTHER_APP_ROOM,
 	BRBT_WARN_CANNOT_JOIN_TO_OCCUPIED_SLOT,
 	BRBT_WARN_CANNOT_JOIN_TO_INVALID_SLOT,
-	BRBT_WARN_CANNOT_JOIN_TO_FULL_ROOM
+	BRBT_WARN_CANNOT_JOIN_TO_FULL_ROOM,
+	BRBT_WARN_CANNOT_JOIN_TO_MIGRATING_ROOM,
+	BRBT_WARN_CANNOT_CLAIM_WITH_INVALID_TOKEN,
+	BRBT_WARN_CLIENT_THROTTLED,
+	BRBT_WARN_ROOM_CONGESTED,
+	BRBT_WARN_APP_QUOTA_EXCEEDED
 };
 
 enum brbt_ConnectionEventType
@@ -74,6 +84,8 @@ struct brbt_Connection
 	brbt_id_t id;
 	const char* name;
 	unsigned int ping;
+	unsigned int control_latency;
+	unsigned int data_latency;
 };
 
 struct brbt_Connection_array
@@ -164,6 +176,7 @@ struct brbt_JoinedRoomEvent
 	brbt_id_t connection;
 	brbt_id_t room_id;
 	brbt_slot_id_t slot_id;
+	brbt_bool spectator;
 };
 
 struct brbt_BroadcastEvent
@@ -244,10 +257,21 @@ API_C_EXPORT void brbt_JoinRoomAndSlot(brbt_Client client, brbt_id_t id_conn, br
 
 API_C_EXPORT brbt_id_t brbt_GetJoinedRoomId(brbt_Client client, brbt_id_t id_conn);
 API_C_EXPORT unsigned int brbt_GetJoinedRoomSlot(brbt_Client client, brbt_id_t id_conn);
+API_C_EXPORT brbt_time_t brbt_GetServerTime(brbt_Client client, brbt_id_t id_conn);
+API_C_EXPORT void brbt_SpectateRoom(brbt_Client client, brbt_id_t id_conn, brbt_id_t room_id);
+API_C_EXPORT brbt_bool brbt_IsSpectating(brbt_Client client, brbt_id_t id_conn);
 
 API_C_EXPORT void brbt_SendBroadcast(brbt_Client client, brbt_id_t id_con, const void* data, unsigned int size, brbt_ReliabilityBitmask mask);
+API_C_EXPORT void brbt_SendBroadcastOnStream(brbt_Client client, brbt_id_t id_con, const void* data, unsigned int size, brbt_ReliabilityBitmask mask, brbt_stream_id_t stream);
 API_C_EXPORT void brbt_SendEntry(brbt_Client client, brbt_id_t id_con, const void* data, unsigned int size);
 
+API_C_EXPORT void brbt_SendBroadcastToSlots(brbt_Client client, brbt_id_t id_con, const brbt_slot_id_t* slots, unsigned int count, const void* data, unsigned int size, brbt_ReliabilityBitmask mask, brbt_stream_id_t stream);
+API_C_EXPORT void brbt_SendBroadcastToOthers(brbt_Client client, brbt_id_t id_con, const void* data, unsigned int size, brbt_ReliabilityBitmask mask, brbt_stream_id_t stream);
+API_C_EXPORT void brbt_SendBroadcastToInterest(brbt_Client client, brbt_id_t id_con, brbt_interest_t interest, const void* data, unsigned int size, brbt_ReliabilityBitmask mask, brbt_stream_id_t stream);
+API_C_EXPORT void brbt_SetInterests(brbt_Client client, brbt_id_t id_con, const brbt_interest_t* interests, unsigned int count);
+API_C_EXPORT void brbt_AddInterest(brbt_Client client, brbt_id_t id_con, brbt_interest_t interest);
+API_C_EXPORT void brbt_RemoveInterest(brbt_Client client, brbt_id_t id_con, brbt_interest_t interest);
+
 API_C_EXPORT void brbt_PullEvents(brbt_Client client, const brbt_EventCallbackTable* table);
 
 API_C_EXPORT brbt_id_t brbt_GetEntriesCount(brbt_Client client, brbt_id_t id_con);
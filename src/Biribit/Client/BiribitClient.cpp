@@ -18,6 +18,11 @@ void Client::Connect(const char* addr, unsigned short port, const char* password
 	m_impl->Connect(addr, port, password);
 }
 
+void Client::Connect(std::shared_ptr<LocalLink> link)
+{
+	m_impl->Connect(link);
+}
+
 void Client::Disconnect(Connection::id_t id)
 {
 	m_impl->Disconnect(id);
@@ -113,14 +118,74 @@ Room::slot_id_t Client::GetJoinedRoomSlot(Connection::id_t id)
 	return m_impl->GetJoinedRoomSlot(id);
 }
 
-void Client::SendBroadcast(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask)
+void Client::SpectateRoom(Connection::id_t id, Room::id_t room_id)
+{
+	m_impl->SpectateRoom(id, room_id);
+}
+
+bool Client::IsSpectating(Connection::id_t id)
+{
+	return m_impl->IsSpectating(id);
+}
+
+milliseconds_t Client::GetServerTime(Connection::id_t id)
+{
+	return m_impl->GetServerTime(id);
+}
+
+void Client::SendBroadcast(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	m_impl->SendBroadcast(id, packet, mask, stream);
+}
+
+void Client::SendBroadcast(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	m_impl->SendBroadcast(id, data, lenght, mask, stream);
+}
+
+void Client::SendBroadcastToInterest(Connection::id_t id, Room::interest_t interest, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	m_impl->SendBroadcastToInterest(id, interest, packet, mask, stream);
+}
+
+void Client::SendBroadcastToInterest(Connection::id_t id, Room::interest_t interest, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	m_impl->SendBroadcastToInterest(id, interest, data, lenght, mask, stream);
+}
+
+void Client::SendBroadcastToSlots(Connection::id_t id, const std::vector<Room::slot_id_t>& slots, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	m_impl->SendBroadcastToSlots(id, slots, packet, mask, stream);
+}
+
+void Client::SendBroadcastToSlots(Connection::id_t id, const std::vector<Room::slot_id_t>& slots, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	m_impl->SendBroadcastToSlots(id, slots, data, lenght, mask, stream);
+}
+
+void Client::SendBroadcastToOthers(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	m_impl->SendBroadcastToOthers(id, packet, mask, stream);
+}
+
+void Client::SendBroadcastToOthers(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	m_impl->SendBroadcastToOthers(id, data, lenght, mask, stream);
+}
+
+void Client::SetInterests(Connection::id_t id, const std::vector<Room::interest_t>& interests)
+{
+	m_impl->SetInterests(id, interests);
+}
+
+void Client::AddInterest(Connection::id_t id, Room::interest_t interest)
 {
-	m_impl->SendBroadcast(id, packet, mask);
+	m_impl->AddInterest(id, interest);
 }
 
-void Client::SendBroadcast(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask)
+void Client::RemoveInterest(Connection::id_t id, Room::interest_t interest)
 {
-	m_impl->SendBroadcast(id, data, lenght, mask);
+	m_impl->RemoveInterest(id, interest);
 }
 
 void Client::SendEntry(Connection::id_t id, const Packet& packet)
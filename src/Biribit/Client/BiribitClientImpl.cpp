@@ -27,8 +27,11 @@ const char* ConnectionAttemptResultStr[] = {
 	"SECURITY_INITIALIZATION_FAILED"
 };
 
+const RakNet::Time PLANE_PROBE_PERIOD = 1000;
+
 ClientImpl::ClientImpl()
 	: m_peer(nullptr)
+	, m_localLinksCount(0)
 {
 	for (ConnectionImpl& c : m_connections)
 		c.parent = this;
@@ -64,6 +67,9 @@ ClientImpl::~ClientImpl()
 		printLog("Waiting for thread ends...");
 		m_pool.reset(nullptr);
 
+		while (!m_localLinks.empty())
+			CloseConnection(m_localLinks.begin()->first);
+
 		RakNet::RakPeerInterface::DestroyInstance(m_peer);
 		m_peer = nullptr;
 	}
@@ -84,6 +90,12 @@ void ClientImpl::RakNetUpdated()
 			HandlePacket(p);
 			m_peer->DeallocatePacket(p);
 		}
+
+		if (m_peer != nullptr) {
+			PollLocalLinks();
+			SyncClocks();
+			ProbePlanes();
+		}
 	});
 }
 
@@ -105,6 +117,19 @@ void ClientImpl::Connect(const char* addr, unsigned short port, const char* pass
 	});
 }
 
+void ClientImpl::Connect(shared<LocalLink> link)
+{
+	if (link == nullptr)
+		return;
+
+	m_pool->enqueue([this, link]()
+	{
+		// No remote system has this address, the port tells links apart.
+		RakNet::SystemAddress addr("0.0.0.0", ++m_localLinksCount);
+		m_localLinks[addr] = link;
+	});
+}
+
 void ClientImpl::Disconnect(Connection::id_t id)
 {
 	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
@@ -113,7 +138,7 @@ void ClientImpl::Disconnect(Connection::id_t id)
 	m_pool->enqueue([this, id]()
 	{
 		if (id < m_connections.size() && !m_connections[id].isNull())
-			m_peer->CloseConnection(m_connections[id].addr, true);
+			CloseConnection(m_connections[id].addr);
 	});
 }
 
@@ -124,7 +149,7 @@ void ClientImpl::Disconnect()
 		for (std::size_t i = 1; i < m_connections.size(); i++)
 		{
 			if (!m_connections[i].isNull())
-				m_peer->CloseConnection(m_connections[i].addr, true);
+				CloseConnection(m_connections[i].addr);
 		}
 	});
 }
@@ -249,7 +274,7 @@ void ClientImpl::SetLocalClientParameters(Connection::id_t id, const ClientParam
 
 		RakNet::BitStream bstream;
 		WriteMessage(bstream, ID_CLIENT_UPDATE_STATUS, proto_update);
-		m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE, 0, conn.addr, false);
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, conn.addr, false);
 	});
 }
 
@@ -279,8 +304,8 @@ void ClientImpl::CreateRoom(Connection::id_t id, Room::slot_id_t num_slots)
 		Proto::RoomCreate proto_create;
 		proto_create.set_client_slots(num_slots);
 		RakNet::BitStream bstream;
-		if (WriteMessage(bstream, ID_ROOM_CREATE_REQUEST, proto_create))
-			m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE, 0, conn.addr, false);
+		if (WriteMessage(bstream, ID_ROOM_CREATE_REQUEST, proto_create, conn.codec))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, conn.addr, false);
 	});
 }
 
@@ -299,8 +324,8 @@ void ClientImpl::CreateRoom(Connection::id_t id, Room::slot_id_t num_slots, Room
 		proto_create.set_client_slots(num_slots);
 		proto_create.set_slot_to_join(slot_to_join_id);
 		RakNet::BitStream bstream;
-		if (WriteMessage(bstream, ID_ROOM_CREATE_REQUEST, proto_create))
-			m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE, 0, conn.addr, false);
+		if (WriteMessage(bstream, ID_ROOM_CREATE_REQUEST, proto_create, conn.codec))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, conn.addr, false);
 	});
 }
 
@@ -318,8 +343,8 @@ void ClientImpl::JoinRandomOrCreateRoom(Connection::id_t id, Room::slot_id_t num
 		Proto::RoomCreate proto_create;
 		proto_create.set_client_slots(num_slots);
 		RakNet::BitStream bstream;
-		if (WriteMessage(bstream, ID_ROOM_JOIN_RANDOM_OR_CREATE_REQUEST, proto_create))
-			m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE, 0, conn.addr, false);
+		if (WriteMessage(bstream, ID_ROOM_JOIN_RANDOM_OR_CREATE_REQUEST, proto_create, conn.codec))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, conn.addr, false);
 	});
 }
 
@@ -337,8 +362,8 @@ void ClientImpl::JoinRoom(Connection::id_t id, Room::id_t room_id)
 		Proto::RoomJoin proto_join;
 		proto_join.set_id(room_id);
 		RakNet::BitStream bstream;
-		if (WriteMessage(bstream, ID_ROOM_JOIN_REQUEST, proto_join))
-			m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE, 0, conn.addr, false);
+		if (WriteMessage(bstream, ID_ROOM_JOIN_REQUEST, proto_join, conn.codec))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, conn.addr, false);
 	});
 }
 
@@ -357,8 +382,8 @@ void ClientImpl::JoinRoom(Connection::id_t id, Room::id_t room_id, Room::slot_id
 		proto_join.set_id(room_id);
 		proto_join.set_slot_to_join(slot_id);
 		RakNet::BitStream bstream;
-		if (WriteMessage(bstream, ID_ROOM_JOIN_REQUEST, proto_join))
-			m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE, 0, conn.addr, false);
+		if (WriteMessage(bstream, ID_ROOM_JOIN_REQUEST, proto_join, conn.codec))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, conn.addr, false);
 	});
 }
 
@@ -378,27 +403,137 @@ Room::slot_id_t ClientImpl::GetJoinedRoomSlot(Connection::id_t id)
 	return m_connections[id].joinedSlot;
 }
 
-void ClientImpl::SendBroadcast(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask)
+void ClientImpl::SpectateRoom(Connection::id_t id, Room::id_t room_id)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return;
+
+	m_pool->enqueue([this, id, room_id]()
+	{
+		ConnectionImpl& conn = m_connections[id];
+		if (conn.isNull())
+			return;
+
+		SendSpectate(conn.addr, room_id);
+	});
+}
+
+bool ClientImpl::IsSpectating(Connection::id_t id)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return false;
+
+	return m_connections[id].spectating;
+}
+
+milliseconds_t ClientImpl::GetServerTime(Connection::id_t id)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return 0;
+
+	ConnectionImpl& conn = m_connections[id];
+	if (!conn.clock.IsSynchronized())
+		return 0;
+
+	return conn.clock.ToServerTime(RakNet::GetTime());
+}
+
+void ClientImpl::SendBroadcast(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return;
+
+	// Shares the bytes of the packet, the user may still append to it.
+	shared<Packet> shared_packet(new Packet(packet));
+	SendBroadcast(id, shared_packet, mask, stream, ID_SEND_BROADCAST_TO_ROOM, nullptr);
+}
+
+void ClientImpl::SendBroadcast(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return;
+
+	shared<Packet> shared_packet(new Packet(data, lenght));
+	SendBroadcast(id, shared_packet, mask, stream, ID_SEND_BROADCAST_TO_ROOM, nullptr);
+}
+
+void ClientImpl::SendBroadcastToInterest(Connection::id_t id, Room::interest_t interest, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return;
+
+	shared<Packet> shared_packet(new Packet(packet));
+	shared<RakNet::BitStream> target(new RakNet::BitStream());
+	target->Write(interest);
+	SendBroadcast(id, shared_packet, mask, stream, ID_SEND_BROADCAST_TO_INTEREST, target);
+}
+
+void ClientImpl::SendBroadcastToInterest(Connection::id_t id, Room::interest_t interest, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
 {
 	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
 		return;
 
-	shared<Packet> shared_packet(new Packet());
-	shared_packet->append(packet.getData(), packet.getDataSize());
-	SendBroadcast(id, shared_packet, mask);
+	shared<Packet> shared_packet(new Packet(data, lenght));
+	shared<RakNet::BitStream> target(new RakNet::BitStream());
+	target->Write(interest);
+	SendBroadcast(id, shared_packet, mask, stream, ID_SEND_BROADCAST_TO_INTEREST, target);
 }
 
-void ClientImpl::SendBroadcast(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask)
+void ClientImpl::SendBroadcastToSlots(Connection::id_t id, const std::vector<Room::slot_id_t>& slots, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
 {
 	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
 		return;
 
-	shared<Packet> shared_packet(new Packet());
-	shared_packet->append(data, lenght);
-	SendBroadcast(id, shared_packet, mask);
+	shared<Packet> shared_packet(new Packet(packet));
+	SendBroadcast(id, shared_packet, mask, stream, ID_SEND_BROADCAST_TO_SLOTS, SlotMask(slots));
 }
 
-void ClientImpl::SendBroadcast(Connection::id_t id, shared<Packet> packet, Packet::ReliabilityBitmask mask = Packet::Unreliable)
+void ClientImpl::SendBroadcastToSlots(Connection::id_t id, const std::vector<Room::slot_id_t>& slots, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return;
+
+	shared<Packet> shared_packet(new Packet(data, lenght));
+	SendBroadcast(id, shared_packet, mask, stream, ID_SEND_BROADCAST_TO_SLOTS, SlotMask(slots));
+}
+
+void ClientImpl::SendBroadcastToOthers(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return;
+
+	shared<Packet> shared_packet(new Packet(packet));
+	SendBroadcast(id, shared_packet, mask, stream, ID_SEND_BROADCAST_TO_OTHERS, nullptr);
+}
+
+void ClientImpl::SendBroadcastToOthers(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return;
+
+	shared<Packet> shared_packet(new Packet(data, lenght));
+	SendBroadcast(id, shared_packet, mask, stream, ID_SEND_BROADCAST_TO_OTHERS, nullptr);
+}
+
+shared<RakNet::BitStream> ClientImpl::SlotMask(const std::vector<Room::slot_id_t>& slots)
+{
+	std::size_t size = 0;
+	for (auto it = slots.begin(); it != slots.end(); it++)
+		size = std::max<std::size_t>(size, *it + 1);
+
+	SlotSet mask(size);
+	for (auto it = slots.begin(); it != slots.end(); it++)
+		mask.set(*it);
+
+	shared<RakNet::BitStream> target(new RakNet::BitStream());
+	target->Write((std::uint16_t) mask.words_count());
+	for (std::size_t w = 0; w < mask.words_count(); w++)
+		target->Write(mask.words()[w]);
+
+	return target;
+}
+
+void ClientImpl::SendBroadcast(Connection::id_t id, shared<Packet> packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream, RakNet::MessageID msgId, shared<RakNet::BitStream> target)
 {
 	shared<Packet> shared_packet = packet;
 	PacketReliability reliability;
@@ -414,36 +549,115 @@ void ClientImpl::SendBroadcast(Connection::id_t id, shared<Packet> packet, Packe
 	case Packet::ReliableOrdered:
 		reliability = RELIABLE_ORDERED;
 		break;
+	case Packet::UnreliableSequenced:
+		reliability = UNRELIABLE_SEQUENCED;
+		break;
+	case Packet::ReliableSequenced:
+		reliability = RELIABLE_SEQUENCED;
+		break;
 	default:
 		reliability = UNRELIABLE;
 		break;
 	}
 
-	m_pool->enqueue([this, id, shared_packet, reliability]()
+	if (stream >= ROOM_MAX_STREAMS)
+		stream = 0;
+
+	m_pool->enqueue([this, id, shared_packet, reliability, stream, msgId, target]()
 	{
 		ConnectionImpl& conn = m_connections[id];
 		if (conn.isNull())
 			return;
 
 		RakNet::BitStream bstream;
-		bstream.Write((RakNet::MessageID) ID_TIMESTAMP);
-		bstream.Write(RakNet::GetTime());
-		bstream.Write((RakNet::MessageID) ID_SEND_BROADCAST_TO_ROOM);
+		WriteTimestamp(bstream, conn);
+		if (stream != 0) {
+			bstream.Write((RakNet::MessageID) ID_SEND_BROADCAST_ON_STREAM);
+			bstream.Write((std::uint8_t) stream);
+		}
+
+		bstream.Write(msgId);
 		bstream.Write((std::uint8_t) reliability);
+		if (target != nullptr)
+			bstream.Write((const char*) target->GetData(), target->GetNumberOfBytesUsed());
 
 		const char* data[2] = { (const char*)bstream.GetData(), (const char*)shared_packet->getData() };
 		int lengths[2] = { (int)bstream.GetNumberOfBytesUsed(), (int)shared_packet->getDataSize() };
-		m_peer->SendList(data, lengths, 2, HIGH_PRIORITY, reliability, id & 0xFF, conn.addr, false);
+		SendList(data, lengths, 2, STREAM_PRIORITY, reliability, CHANNEL_ROOM_STREAMS + stream, conn.addr, false);
 	});
 }
 
+void ClientImpl::SetInterests(Connection::id_t id, const std::vector<Room::interest_t>& interests)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return;
+
+	m_pool->enqueue([this, id, interests]()
+	{
+		ConnectionImpl& conn = m_connections[id];
+		if (conn.isNull())
+			return;
+
+		conn.interests.clear();
+		conn.interests.insert(interests.begin(), interests.end());
+		SendInterests(conn, true, interests, std::vector<Room::interest_t>());
+	});
+}
+
+void ClientImpl::AddInterest(Connection::id_t id, Room::interest_t interest)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return;
+
+	m_pool->enqueue([this, id, interest]()
+	{
+		ConnectionImpl& conn = m_connections[id];
+		if (conn.isNull() || !conn.interests.insert(interest).second)
+			return;
+
+		SendInterests(conn, false, std::vector<Room::interest_t>(1, interest), std::vector<Room::interest_t>());
+	});
+}
+
+void ClientImpl::RemoveInterest(Connection::id_t id, Room::interest_t interest)
+{
+	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
+		return;
+
+	m_pool->enqueue([this, id, interest]()
+	{
+		ConnectionImpl& conn = m_connections[id];
+		if (conn.isNull() || conn.interests.erase(interest) == 0)
+			return;
+
+		SendInterests(conn, false, std::vector<Room::interest_t>(), std::vector<Room::interest_t>(1, interest));
+	});
+}
+
+void ClientImpl::SendInterests(ConnectionImpl& conn, bool reset, const std::vector<Room::interest_t>& add, const std::vector<Room::interest_t>& remove)
+{
+	if (conn.joinedRoom == Room::UNASSIGNED_ID)
+		return;
+
+	Proto::RoomInterests proto_interests;
+	if (reset)
+		proto_interests.set_reset(true);
+	for (auto it = add.begin(); it != add.end(); it++)
+		proto_interests.add_add(*it);
+	for (auto it = remove.begin(); it != remove.end(); it++)
+		proto_interests.add_remove(*it);
+
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_ROOM_INTEREST_UPDATE, proto_interests, conn.codec))
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, conn.addr, false);
+}
+
 void ClientImpl::SendEntry(Connection::id_t id, const Packet& packet)
 {
 	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
 		return;
 
-	shared<Packet> shared_packet(new Packet());
-	shared_packet->append(packet.getData(), packet.getDataSize());
+	shared<Packet> shared_packet(new Packet(packet));
 	SendEntry(id, shared_packet);
 }
 
@@ -452,8 +666,7 @@ void ClientImpl::SendEntry(Connection::id_t id, const char* data, unsigned int l
 	if (id == Connection::UNASSIGNED_ID || id > CLIENT_MAX_CONNECTIONS)
 		return;
 
-	shared<Packet> shared_packet(new Packet());
-	shared_packet->append(data, lenght);
+	shared<Packet> shared_packet(new Packet(data, lenght));
 	SendEntry(id, shared_packet);
 }
 
@@ -467,13 +680,12 @@ void ClientImpl::SendEntry(Connection::id_t id, shared<Packet> packet)
 			return;
 
 		RakNet::BitStream bstream;
-		bstream.Write((RakNet::MessageID) ID_TIMESTAMP);
-		bstream.Write(RakNet::GetTime());
+		WriteTimestamp(bstream, conn);
 		bstream.Write((RakNet::MessageID) ID_SEND_ENTRY_TO_ROOM);
 
 		const char* data[2] = { (const char*)bstream.GetData(), (const char*)shared_packet->getData() };
 		int lengths[2] = { (int)bstream.GetNumberOfBytesUsed(), (int)shared_packet->getDataSize() };
-		m_peer->SendList(data, lengths, 2, MEDIUM_PRIORITY, RELIABLE, id & 0xFF, conn.addr, false);
+		SendList(data, lengths, 2, JOURNAL_PRIORITY, RELIABLE, CHANNEL_JOURNAL, conn.addr, false);
 	});
 }
 
@@ -504,10 +716,162 @@ const Entry& ClientImpl::GetEntry(Connection::id_t id, Entry::id_t entryId)
 	return m_connections[id].GetEntry(entryId);
 }
 
+void ClientImpl::SyncClocks()
+{
+	RakNet::Time now = RakNet::GetTime();
+	for (std::size_t i = 1; i < m_connections.size(); i++)
+	{
+		ConnectionImpl& conn = m_connections[i];
+		if (conn.isNull() || !conn.clock.SampleDue(now))
+			continue;
+
+		// Unreliable, a resent sample would only carry a longer round trip.
+		RakNet::BitStream bstream;
+		bstream.Write((RakNet::MessageID) ID_CLOCK_SYNC_REQUEST);
+		bstream.Write(now);
+		Send(&bstream, IMMEDIATE_PRIORITY, UNRELIABLE, CHANNEL_CONTROL, conn.addr, false);
+	}
+}
+
+void ClientImpl::ProbePlanes()
+{
+	RakNet::Time now = RakNet::GetTime();
+	for (std::size_t i = 1; i < m_connections.size(); i++)
+	{
+		ConnectionImpl& conn = m_connections[i];
+		if (conn.isNull() || now - conn.lastProbe < PLANE_PROBE_PERIOD)
+			continue;
+
+		// Each probe queues like the plane's own messages, its round trip
+		// is what a join response or a journal entry waits.
+		conn.lastProbe = now;
+		RakNet::BitStream bstream;
+		bstream.Write((RakNet::MessageID) ID_PLANE_PROBE);
+		bstream.Write((std::uint8_t) PLANE_CONTROL);
+		bstream.Write(now);
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, conn.addr, false);
+
+		bstream.Reset();
+		bstream.Write((RakNet::MessageID) ID_PLANE_PROBE);
+		bstream.Write((std::uint8_t) PLANE_DATA);
+		bstream.Write(now);
+		Send(&bstream, JOURNAL_PRIORITY, RELIABLE, CHANNEL_JOURNAL, conn.addr, false);
+	}
+}
+
+void ClientImpl::WriteTimestamp(RakNet::BitStream& bstream, ConnectionImpl& conn)
+{
+	// Old servers don't answer clock samples, they keep getting RakNet's.
+	RakNet::Time now = RakNet::GetTime();
+	if (conn.clock.IsSynchronized()) {
+		bstream.Write((RakNet::MessageID) ID_TIMESTAMP_COMPACT);
+		bstream.Write(conn.clock.ToServerTime(now));
+	}
+	else {
+		bstream.Write((RakNet::MessageID) ID_TIMESTAMP);
+		bstream.Write(now);
+	}
+}
+
 void ClientImpl::SendProtocolMessageID(RakNet::MessageID msg, const RakNet::AddressOrGUID systemIdentifier)
 {
 	Packet tosend; tosend << msg;
-	m_peer->Send((const char*)tosend.getData(), (int)tosend.getDataSize(), LOW_PRIORITY, RELIABLE, 0, systemIdentifier, false);
+	Send((const char*)tosend.getData(), (int)tosend.getDataSize(), LOBBY_PRIORITY, RELIABLE_ORDERED, CHANNEL_LOBBY, systemIdentifier, false);
+}
+
+void ClientImpl::SendCodecHello(RakNet::SystemAddress addr)
+{
+	RakNet::BitStream bstream;
+	bstream.Write((RakNet::MessageID) ID_CODEC_HELLO);
+	bstream.Write((std::uint8_t) CODEC_NEWEST);
+	Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+}
+
+void ClientImpl::Send(const RakNet::BitStream* bstream, PacketPriority priority, PacketReliability reliability, char channel, const RakNet::AddressOrGUID systemIdentifier, bool broadcast)
+{
+	Send((const char*) bstream->GetData(), (int) bstream->GetNumberOfBytesUsed(), priority, reliability, channel, systemIdentifier, broadcast);
+}
+
+void ClientImpl::Send(const char* data, int size, PacketPriority priority, PacketReliability reliability, char channel, const RakNet::AddressOrGUID systemIdentifier, bool broadcast)
+{
+	auto it = m_localLinks.find(systemIdentifier.systemAddress);
+	if (it != m_localLinks.end())
+		it->second->Push(LocalLink::SERVER_END, data, size);
+	else
+		m_peer->Send(data, size, priority, reliability, channel, systemIdentifier, broadcast);
+}
+
+void ClientImpl::SendList(const char** data, const int* lengths, int count, PacketPriority priority, PacketReliability reliability, char channel, const RakNet::AddressOrGUID systemIdentifier, bool broadcast)
+{
+	auto it = m_localLinks.find(systemIdentifier.systemAddress);
+	if (it == m_localLinks.end()) {
+		m_peer->SendList(data, lengths, count, priority, reliability, channel, systemIdentifier, broadcast);
+		return;
+	}
+
+	std::string message;
+	for (int i = 0; i < count; i++)
+		message.append(data[i], lengths[i]);
+
+	it->second->Push(LocalLink::SERVER_END, message.data(), message.size());
+}
+
+void ClientImpl::CloseConnection(RakNet::SystemAddress addr)
+{
+	auto it = m_localLinks.find(addr);
+	if (it == m_localLinks.end()) {
+		m_peer->CloseConnection(addr, true);
+		return;
+	}
+
+	const char notification = (char) ID_DISCONNECTION_NOTIFICATION;
+	it->second->Push(LocalLink::SERVER_END, &notification, 1);
+	it->second->Close();
+	m_localLinks.erase(it);
+}
+
+bool ClientImpl::IsConnected(RakNet::SystemAddress addr)
+{
+	if (m_localLinks.find(addr) != m_localLinks.end())
+		return true;
+
+	return m_peer->GetConnectionState(addr) == RakNet::IS_CONNECTED;
+}
+
+int ClientImpl::GetAveragePing(RakNet::SystemAddress addr)
+{
+	if (m_localLinks.find(addr) != m_localLinks.end())
+		return 0;
+
+	return m_peer->GetAveragePing(addr);
+}
+
+void ClientImpl::PollLocalLinks()
+{
+	// Handling a message may close links, so not iterating the map itself.
+	std::vector<std::pair<RakNet::SystemAddress, shared<LocalLink>>> links(m_localLinks.begin(), m_localLinks.end());
+	std::deque<std::string> messages;
+	for (auto it = links.begin(); it != links.end(); it++)
+	{
+		// Messages pushed before the link closed are all pulled below.
+		bool closed = it->second->IsClosed();
+		it->second->Pull(LocalLink::CLIENT_END, messages);
+		for (auto message = messages.begin(); message != messages.end(); message++)
+		{
+			if (message->empty())
+				continue;
+
+			RakNet::Packet packet = RakNet::Packet();
+			packet.systemAddress = it->first;
+			packet.length = (unsigned int) message->size();
+			packet.bitSize = BYTES_TO_BITS(packet.length);
+			packet.data = (unsigned char*) &(*message)[0];
+			HandlePacket(&packet);
+		}
+
+		if (closed)
+			m_localLinks.erase(it->first);
+	}
 }
 
 bool ClientImpl::WriteMessage(RakNet::BitStream& bstream, RakNet::MessageID msgId, const ::google::protobuf::MessageLite& msg)
@@ -524,6 +888,15 @@ bool ClientImpl::WriteMessage(RakNet::BitStream& bstream, RakNet::MessageID msgI
 	return false;
 }
 
+template<typename T> bool ClientImpl::WriteMessage(RakNet::BitStream& bstream, RakNet::MessageID msgId, const T& msg, std::uint8_t codec)
+{
+	if (codec < CODEC_COMPACT)
+		return WriteMessage(bstream, msgId, msg);
+
+	Compact::WriteMessage(bstream, msgId, msg);
+	return true;
+}
+
 template<typename T> bool ClientImpl::ReadMessage(T& msg, Packet& packet)
 {
 	std::size_t size = packet.getDataSize() - packet.getReadPos();
@@ -540,6 +913,11 @@ template<typename T> bool ClientImpl::ReadMessage(T& msg, RakNet::BitStream& bst
 	return msg.ParseFromArray(m_buffer.data, size);
 }
 
+template<typename T> bool ClientImpl::ReadMessage(T& msg, RakNet::BitStream& bstream, bool compact)
+{
+	return compact ? Compact::ReadMessage(msg, bstream) : ReadMessage(msg, bstream);
+}
+
 void ClientImpl::HandlePacket(RakNet::Packet* pPacket)
 {
 	RakNet::BitStream stream(pPacket->data, pPacket->length, false);
@@ -553,12 +931,27 @@ void ClientImpl::HandlePacket(RakNet::Packet* pPacket)
 		stream.Read(timeStamp);
 		stream.Read(packetIdentifier);
 	}
+	else if (packetIdentifier == ID_TIMESTAMP_COMPACT)
+	{
+		std::uint32_t serverTime;
+		stream.Read(serverTime);
+		stream.Read(packetIdentifier);
+
+		ServerInfoImpl& si = serverList[pPacket->systemAddress];
+		if (si.id != Connection::UNASSIGNED_ID && m_connections[si.id].clock.IsSynchronized())
+			timeStamp = m_connections[si.id].clock.ToLocalTime(serverTime, RakNet::GetTime());
+	}
+
+	bool compact = (packetIdentifier == ID_COMPACT_MESSAGE);
+	if (compact && (!stream.Read(packetIdentifier) || !Compact::Carries(packetIdentifier)))
+		return;
 
 	// Check if this is a network message packet
 	switch (packetIdentifier)
 	{
 	case ID_DISCONNECTION_NOTIFICATION:
-		DisconnectFrom(pPacket->systemAddress);
+		if (!FailOver(pPacket->systemAddress))
+			DisconnectFrom(pPacket->systemAddress);
 		break;
 	case ID_ALREADY_CONNECTED:
 		printLog("ALREADY CONNECTED");
@@ -616,6 +1009,7 @@ void ClientImpl::HandlePacket(RakNet::Packet* pPacket)
 		break;
 	case ID_CONNECTION_ATTEMPT_FAILED:
 		printLog("Connection attempt failed");
+		MigrationFailed(pPacket->systemAddress);
 		break;
 	case ID_NO_FREE_INCOMING_CONNECTIONS:
 		printLog("Server is full.");
@@ -625,11 +1019,52 @@ void ClientImpl::HandlePacket(RakNet::Packet* pPacket)
 		break;
 	case ID_CONNECTION_LOST:
 		printLog("Lost connection form server.");
-		DisconnectFrom(pPacket->systemAddress);
+		if (!FailOver(pPacket->systemAddress))
+			DisconnectFrom(pPacket->systemAddress);
 		break;
 	case ID_CONNECTION_REQUEST_ACCEPTED:
-		ConnectedAt(pPacket->systemAddress);
+	{
+		Connection::id_t id = GetMigratingConnection(pPacket->systemAddress);
+		if (id != Connection::UNASSIGNED_ID)
+			MigratedTo(id, pPacket->systemAddress);
+		else
+			ConnectedAt(pPacket->systemAddress);
 		break;
+	}
+	case ID_CLOCK_SYNC_REQUEST:
+		BIRIBIT_WARN("Nothing to do with ID_CLOCK_SYNC_REQUEST");
+		break;
+	case ID_CLOCK_SYNC_RESPONSE:
+	{
+		RakNet::Time received = RakNet::GetTime();
+		RakNet::Time sent;
+		std::uint32_t serverTime;
+		ServerInfoImpl& si = serverList[pPacket->systemAddress];
+		if (si.id != Connection::UNASSIGNED_ID && stream.Read(sent) && stream.Read(serverTime))
+			m_connections[si.id].clock.AddSample(sent, serverTime, received);
+		break;
+	}
+	case ID_CODEC_HELLO:
+	{
+		std::uint8_t codec;
+		ServerInfoImpl& si = serverList[pPacket->systemAddress];
+		if (si.id != Connection::UNASSIGNED_ID && stream.Read(codec))
+			m_connections[si.id].codec = std::min<std::uint8_t>(codec, CODEC_NEWEST);
+		break;
+	}
+	case ID_COMPACT_MESSAGE:
+		BIRIBIT_WARN("Nothing to do with ID_COMPACT_MESSAGE");
+		break;
+	case ID_PLANE_PROBE:
+	{
+		RakNet::Time received = RakNet::GetTime();
+		RakNet::Time sent;
+		std::uint8_t plane;
+		ServerInfoImpl& si = serverList[pPacket->systemAddress];
+		if (si.id != Connection::UNASSIGNED_ID && stream.Read(plane) && stream.Read(sent))
+			m_connections[si.id].AddPlaneSample(plane, sent, received);
+		break;
+	}
 	case ID_ERROR_CODE:
 	{
 		std::uint32_t errorCode;
@@ -730,12 +1165,23 @@ void ClientImpl::HandlePacket(RakNet::Packet* pPacket)
 					max = std::max(proto_list.rooms(i).id(), max);
 
 			sc.rooms.resize(max + 1);
+			std::vector<bool> listed(max + 1, false);
 			for (int i = 0; i < rooms_size; i++) {
 				const Proto::Room& proto_room = proto_list.rooms(i);
-				if (proto_room.has_id())
+				if (!proto_room.has_id())
+					continue;
+
+				listed[proto_room.id()] = true;
+				if (AcceptRoomVersion(sc, &proto_room))
 					PopulateRoom(sc.rooms[proto_room.id()], &proto_room);
 			}
 
+			// Closed rooms leave the list, a new room taking their id back
+			// starts over at version 0.
+			for (std::size_t id = 0; id < sc.roomVersions.size(); id++)
+				if (id >= listed.size() || !listed[id])
+					sc.roomVersions[id] = 0;
+
 			sc.PushRoomListEvent();
 		}
 		break;
@@ -750,22 +1196,34 @@ void ClientImpl::HandlePacket(RakNet::Packet* pPacket)
 			UpdateRoom(pPacket->systemAddress, &proto_room);
 		break;
 	}
+	case ID_ROOM_STATUS_DELTA:
+	{
+		Proto::RoomDelta proto_delta;
+		if (ReadMessage(proto_delta, stream, compact))
+			UpdateRoom(pPacket->systemAddress, &proto_delta);
+		break;
+	}
 	case ID_ROOM_JOIN_REQUEST:
 		BIRIBIT_WARN("Nothing to do with ID_ROOM_JOIN_REQUEST");
 		break;
+	case ID_ROOM_STATUS_REQUEST:
+		BIRIBIT_WARN("Nothing to do with ID_ROOM_STATUS_REQUEST");
+		break;
 	case ID_ROOM_JOIN_RESPONSE:
 	{
 		Proto::RoomJoin proto_join;
-		if (ReadMessage(proto_join, stream))
+		if (ReadMessage(proto_join, stream, compact))
 		{
 			ServerInfoImpl& si = serverList[pPacket->systemAddress];
 			BIRIBIT_ASSERT(si.id != Connection::UNASSIGNED_ID);
 			ConnectionImpl& sc = m_connections[si.id];
 			if (proto_join.has_id())
 			{
+				sc.spectating = false;
 				if (sc.joinedRoom != proto_join.id())
 				{
 					sc.joinedRoom = proto_join.id();
+					sc.interests.clear();
 					sc.ResetEntries();
 				}
 
@@ -785,9 +1243,14 @@ void ClientImpl::HandlePacket(RakNet::Packet* pPacket)
 		break;
 	}
 	case ID_SEND_BROADCAST_TO_ROOM:
+	case ID_SEND_BROADCAST_TO_INTEREST:
+	case ID_SEND_BROADCAST_TO_SLOTS:
+	case ID_SEND_BROADCAST_TO_OTHERS:
+	case ID_SEND_BROADCAST_ON_STREAM:
 		BIRIBIT_WARN("Nothing to do with ID_SEND_BROADCAST_TO_ROOM");
 		break;
 	case ID_BROADCAST_FROM_ROOM:
+	case ID_BROADCAST_FROM_LARGE_ROOM:
 	{
 		ServerInfoImpl& si = serverList[pPacket->systemAddress];
 		if (si.id != Connection::UNASSIGNED_ID)
@@ -797,15 +1260,23 @@ void ClientImpl::HandlePacket(RakNet::Packet* pPacket)
 
 			recv->connection = si.id;
 			recv->room_id = sc.joinedRoom;
-			stream.Read(recv->slot_id);
+			if (packetIdentifier == ID_BROADCAST_FROM_LARGE_ROOM) {
+				std::uint16_t slot_id;
+				stream.Read(slot_id);
+				recv->slot_id = slot_id;
+			}
+			else {
+				std::uint8_t slot_id;
+				stream.Read(slot_id);
+				recv->slot_id = slot_id;
+			}
 
 			if (timeStamp != 0)
 				recv->when = timeStamp;
 
+			// Straight from the received packet, the payload starts at a byte.
 			std::size_t size = BITS_TO_BYTES(stream.GetNumberOfUnreadBits());
-			m_buffer.Ensure(size);
-			stream.Read(m_buffer.data, size);
-			recv->data.append(m_buffer.data, size);
+			recv->data.append(stream.GetData() + BITS_TO_BYTES(stream.GetReadOffset()), size);
 
 			{
 				std::lock_guard<std::mutex> lock(m_eventMutex);
@@ -832,7 +1303,7 @@ void ClientImpl::HandlePacket(RakNet::Packet* pPacket)
 					Proto::RoomEntriesRequest* proto_entriesReqPtr = proto_entriesReq.release();
 					RakNet::BitStream bstream;
 					WriteMessage(bstream, ID_JOURNAL_ENTRIES_REQUEST, *proto_entriesReqPtr);
-					m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE, 0, sc.addr, false);
+					Send(&bstream, JOURNAL_PRIORITY, RELIABLE, CHANNEL_JOURNAL, sc.addr, false);
 					proto_entriesReq = unique<Proto::RoomEntriesRequest>(proto_entriesReqPtr);
 				}
 
@@ -851,6 +1322,74 @@ void ClientImpl::HandlePacket(RakNet::Packet* pPacket)
 	case ID_SEND_ENTRY_TO_ROOM:
 		BIRIBIT_WARN("Nothing to do with ID_JOURNAL_ENTRIES_REQUEST");
 		break;
+	case ID_ROOM_MIGRATED:
+	{
+		Proto::RoomMigrated proto_migrated;
+		if (ReadMessage(proto_migrated, stream))
+			MigrateTo(pPacket->systemAddress, &proto_migrated);
+		break;
+	}
+	case ID_ROOM_STANDBY:
+	{
+		ServerInfoImpl& si = serverList[pPacket->systemAddress];
+		if (si.id != Connection::UNASSIGNED_ID)
+			ReadMessage(m_connections[si.id].standby, stream);
+		break;
+	}
+	case ID_ROOM_RESUME:
+	{
+		ServerInfoImpl& si = serverList[pPacket->systemAddress];
+		if (si.id != Connection::UNASSIGNED_ID)
+			ReadMessage(m_connections[si.id].resume, stream);
+		break;
+	}
+	case ID_ROOM_MIGRATION_CLAIM:
+		BIRIBIT_WARN("Nothing to do with ID_ROOM_MIGRATION_CLAIM");
+		break;
+	case ID_ROOM_SPECTATE_REQUEST:
+		BIRIBIT_WARN("Nothing to do with ID_ROOM_SPECTATE_REQUEST");
+		break;
+	case ID_ROOM_SPECTATE_RESPONSE:
+	{
+		Proto::RoomSpectate proto_spectate;
+		ServerInfoImpl& si = serverList[pPacket->systemAddress];
+		if (si.id != Connection::UNASSIGNED_ID && ReadMessage(proto_spectate, stream))
+		{
+			ConnectionImpl& sc = m_connections[si.id];
+			Room::id_t room_id = proto_spectate.has_id() ? proto_spectate.id() : (Room::id_t) Room::UNASSIGNED_ID;
+			if (!sc.spectating && room_id == Room::UNASSIGNED_ID)
+				break;
+
+			sc.spectating = (room_id != Room::UNASSIGNED_ID);
+			sc.joinedRoom = room_id;
+			sc.joinedSlot = 0;
+			sc.interests.clear();
+			sc.ResetEntries();
+
+			std::unique_ptr<JoinedRoomEvent> entr(new JoinedRoomEvent());
+			entr->connection = si.id;
+			entr->room_id = sc.joinedRoom;
+			entr->slot_id = sc.joinedSlot;
+			entr->spectator = sc.spectating;
+			{
+				std::lock_guard<std::mutex> lock(m_eventMutex);
+				m_eventQueue.push(std::move(entr));
+			}
+		}
+		break;
+	}
+	case ID_ROOM_SPECTATE_REDIRECT:
+	{
+		Proto::RoomMigrated proto_redirect;
+		if (ReadMessage(proto_redirect, stream))
+			SpectateRedirect(pPacket->systemAddress, &proto_redirect);
+		break;
+	}
+	case ID_NODE_RELAY:
+	case ID_NODE_SPECTATE:
+	case ID_NODE_SPECTATE_DATA:
+		BIRIBIT_WARN("Nothing to do with ID_NODE_SPECTATE");
+		break;
 	default:
 		printLog("UNKNOWN PACKET IDENTIFIER");
 		break;
@@ -878,16 +1417,50 @@ void ClientImpl::ConnectedAt(RakNet::SystemAddress addr)
 	ServerInfoImpl& si = serverList[addr];
 	si.id = i;
 
+	SendCodecHello(addr);
 	SendProtocolMessageID(ID_SERVER_INFO_REQUEST, addr);
 	SendProtocolMessageID(ID_SERVER_STATUS_REQUEST, addr);
 
+	auto redirect = m_spectateRedirects.find(addr);
+	if (redirect != m_spectateRedirects.end()) {
+		SendSpectate(addr, redirect->second);
+		m_spectateRedirects.erase(redirect);
+	}
+
 	PushConnectionsEvent(si.id, ConnectionEvent::TYPE_NEW_CONNECTION);
 }
 
+void ClientImpl::SendSpectate(RakNet::SystemAddress addr, Room::id_t room_id)
+{
+	Proto::RoomSpectate proto_spectate;
+	proto_spectate.set_id(room_id);
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_ROOM_SPECTATE_REQUEST, proto_spectate))
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+}
+
+void ClientImpl::SpectateRedirect(RakNet::SystemAddress addr, const Proto::RoomMigrated* proto_redirect)
+{
+	RakNet::SystemAddress target;
+	if (!proto_redirect->has_address() || !target.FromStringExplicitPort(proto_redirect->address().c_str(), proto_redirect->port()))
+		return;
+
+	printLog("Spectating room %d from %s.", proto_redirect->room_id(), target.ToString());
+	ServerInfoImpl& target_si = serverList[target];
+	if (target_si.id != Connection::UNASSIGNED_ID) {
+		SendSpectate(target, proto_redirect->room_id());
+		return;
+	}
+
+	m_spectateRedirects[target] = proto_redirect->room_id();
+	m_peer->Connect(proto_redirect->address().c_str(), proto_redirect->port(), nullptr, 0);
+}
+
 void ClientImpl::DisconnectFrom(RakNet::SystemAddress addr)
 {
 	ServerInfoImpl& si = serverList[addr];
-	BIRIBIT_ASSERT(si.id != Connection::UNASSIGNED_ID);
+	if (si.id == Connection::UNASSIGNED_ID)
+		return;
 
 	Connection::id_t id = si.id;
 	ConnectionImpl& sc = m_connections[id];
@@ -899,6 +1472,174 @@ void ClientImpl::DisconnectFrom(RakNet::SystemAddress addr)
 	PushConnectionsEvent(id, ConnectionEvent::TYPE_DISCONNECTION);
 }
 
+void ClientImpl::MigrateTo(RakNet::SystemAddress addr, const Proto::RoomMigrated* proto_migrated)
+{
+	ServerInfoImpl& si = serverList[addr];
+	if (si.id == Connection::UNASSIGNED_ID || !proto_migrated->has_address() || !proto_migrated->has_token())
+		return;
+
+	ConnectionImpl& sc = m_connections[si.id];
+	RakNet::SystemAddress target;
+	if (!target.FromStringExplicitPort(proto_migrated->address().c_str(), proto_migrated->port()))
+		return;
+
+	sc.migratingTo = target;
+	sc.migrationRoom = proto_migrated->room_id();
+	sc.migrationToken = proto_migrated->token();
+	printLog("Room %d migrated to %s.", sc.joinedRoom.load(), target.ToString());
+
+	ServerInfoImpl& target_si = serverList[target];
+	if (target_si.id != Connection::UNASSIGNED_ID && target != addr)
+		MigratedTo(si.id, target);
+	else
+		m_peer->Connect(proto_migrated->address().c_str(), proto_migrated->port(), nullptr, 0);
+}
+
+void ClientImpl::MigratedTo(Connection::id_t id, RakNet::SystemAddress addr)
+{
+	ConnectionImpl& sc = m_connections[id];
+	RakNet::SystemAddress old_addr = sc.addr;
+	ServerInfoImpl& target_si = serverList[addr];
+
+	Proto::RoomMigrationClaim proto_claim;
+	proto_claim.set_token(sc.migrationToken);
+	proto_claim.set_last_entry_id(sc.GetEntriesCursor());
+	Room::id_t room_id = sc.migrationRoom;
+	sc.migratingTo = RakNet::UNASSIGNED_SYSTEM_ADDRESS;
+	sc.migrationRoom = Room::UNASSIGNED_ID;
+	sc.migrationToken = 0;
+
+	// Already connected to the target node, the claim moves the room there.
+	Connection::id_t target_id = id;
+	if (target_si.id != Connection::UNASSIGNED_ID && target_si.id != id)
+	{
+		target_id = target_si.id;
+		ConnectionImpl& target_sc = m_connections[target_id];
+		target_sc.joinedRoom = room_id;
+		{
+			std::lock_guard<std::mutex> lock_target(target_sc.entriesMutex);
+			std::lock_guard<std::mutex> lock(sc.entriesMutex);
+			std::swap(target_sc.joinedRoomEntries, sc.joinedRoomEntries);
+		}
+
+		sc.joinedRoom = Room::UNASSIGNED_ID;
+		sc.ResetEntries();
+	}
+	else
+	{
+		serverList[old_addr].id = Connection::UNASSIGNED_ID;
+		target_si.id = id;
+		sc.addr = addr;
+		sc.selfId = RemoteClient::UNASSIGNED_ID;
+		sc.joinedRoom = room_id;
+		sc.clients.clear();
+		sc.rooms.clear();
+		sc.roomVersions.clear();
+		sc.clock.Reset();
+		sc.codec = CODEC_PROTOBUF;
+
+		SendCodecHello(addr);
+		SendProtocolMessageID(ID_SERVER_INFO_REQUEST, addr);
+		SendProtocolMessageID(ID_SERVER_STATUS_REQUEST, addr);
+		if (old_addr != addr)
+			CloseConnection(old_addr);
+		PushConnectionsEvent(id, ConnectionEvent::TYPE_NAME_UPDATED);
+	}
+
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_ROOM_MIGRATION_CLAIM, proto_claim))
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+
+	// Interests are per slot, declare them again in the new room.
+	ConnectionImpl& target_sc = m_connections[target_id];
+	if (target_id != id) {
+		target_sc.interests = sc.interests;
+		sc.interests.clear();
+	}
+	if (!target_sc.interests.empty())
+		SendInterests(target_sc, true, std::vector<Room::interest_t>(target_sc.interests.begin(), target_sc.interests.end()), std::vector<Room::interest_t>());
+}
+
+void ClientImpl::MigrationFailed(RakNet::SystemAddress addr)
+{
+	Connection::id_t id = GetMigratingConnection(addr);
+	if (id == Connection::UNASSIGNED_ID)
+		return;
+
+	ConnectionImpl& sc = m_connections[id];
+	printLog("Migration to %s failed.", addr.ToString());
+	sc.migratingTo = RakNet::UNASSIGNED_SYSTEM_ADDRESS;
+	sc.migrationRoom = Room::UNASSIGNED_ID;
+	sc.migrationToken = 0;
+
+	// Resuming failed, the standby may still hold the room.
+	if (!IsConnected(sc.addr) && FailOver(sc.addr))
+		return;
+
+	sc.joinedRoom = Room::UNASSIGNED_ID;
+	sc.joinedSlot = 0;
+	sc.interests.clear();
+	sc.ResetEntries();
+
+	std::unique_ptr<JoinedRoomEvent> entr(new JoinedRoomEvent());
+	entr->connection = id;
+	entr->room_id = sc.joinedRoom;
+	entr->slot_id = sc.joinedSlot;
+	{
+		std::lock_guard<std::mutex> lock(m_eventMutex);
+		m_eventQueue.push(std::move(entr));
+	}
+
+	// Failing over, there is no server left to stay at.
+	if (!IsConnected(sc.addr))
+		DisconnectFrom(sc.addr);
+}
+
+bool ClientImpl::FailOver(RakNet::SystemAddress addr)
+{
+	ServerInfoImpl& si = serverList[addr];
+	if (si.id == Connection::UNASSIGNED_ID)
+		return false;
+
+	ConnectionImpl& sc = m_connections[si.id];
+	if (sc.joinedRoom == Room::UNASSIGNED_ID)
+		return false;
+
+	// Resuming at the same server goes first, it may just be a network
+	// hiccup or a restart. The standby is the last resort.
+	Proto::RoomMigrated proto_ticket;
+	if (sc.resume.has_token() && sc.resume.room_id() == sc.joinedRoom)
+	{
+		proto_ticket = sc.resume;
+		sc.resume.Clear();
+		proto_ticket.set_address(addr.ToString(false));
+		proto_ticket.set_port(addr.GetPort());
+		printLog("Lost connection to %s. Resuming session.", addr.ToString());
+	}
+	else if (sc.standby.has_token() && sc.standby.room_id() == sc.joinedRoom)
+	{
+		proto_ticket = sc.standby;
+		sc.standby.Clear();
+		printLog("Lost connection to %s. Failing over to standby.", addr.ToString());
+	}
+	else
+	{
+		return false;
+	}
+
+	MigrateTo(addr, &proto_ticket);
+	return sc.migratingTo != RakNet::UNASSIGNED_SYSTEM_ADDRESS;
+}
+
+Connection::id_t ClientImpl::GetMigratingConnection(RakNet::SystemAddress addr)
+{
+	for (std::size_t i = 1; i < m_connections.size(); i++)
+		if (!m_connections[i].isNull() && m_connections[i].migratingTo == addr)
+			return i;
+
+	return Connection::UNASSIGNED_ID;
+}
+
 void ClientImpl::UpdateRemoteClient(RakNet::SystemAddress addr, const Proto::Client* proto_client, TypeUpdateRemoteClient type)
 {
 	ServerInfoImpl& si = serverList[addr];
@@ -948,11 +1689,75 @@ void ClientImpl::UpdateRoom(RakNet::SystemAddress addr, const Proto::Room* proto
 		if (id >= sc.rooms.size())
 			sc.rooms.resize(id + 1);
 
+		// Sent in order with the deltas, it is always the latest.
+		if (proto_room->has_version())
+			sc.RoomVersion(id) = proto_room->version();
+
 		PopulateRoom(sc.rooms[id], proto_room);
 		sc.PushRoomListEvent();
 	}
 }
 
+bool ClientImpl::AcceptRoomVersion(ConnectionImpl& sc, const Proto::Room* proto_room)
+{
+	// Room lists travel on the lobby channel and may be older than the
+	// statuses and deltas already applied.
+	if (!proto_room->has_version())
+		return true;
+
+	std::uint32_t& known = sc.RoomVersion(proto_room->id());
+	if (proto_room->version() < known)
+		return false;
+
+	known = proto_room->version();
+	return true;
+}
+
+void ClientImpl::UpdateRoom(RakNet::SystemAddress addr, const Proto::RoomDelta* proto_delta)
+{
+	ServerInfoImpl& si = serverList[addr];
+	if (si.id == Connection::UNASSIGNED_ID)
+		return;
+
+	ConnectionImpl& sc = m_connections[si.id];
+	std::uint32_t id = proto_delta->id();
+	if (id >= sc.rooms.size())
+		sc.rooms.resize(id + 1);
+
+	if (proto_delta->has_version())
+	{
+		std::uint32_t& known = sc.RoomVersion(id);
+		if (proto_delta->version() <= known)
+			return;
+
+		// Applied anyway, the full status then fixes whatever was missed.
+		if (proto_delta->version() != known + 1)
+		{
+			Proto::RoomJoin proto_join;
+			proto_join.set_id(id);
+			RakNet::BitStream bstream;
+			if (WriteMessage(bstream, ID_ROOM_STATUS_REQUEST, proto_join, sc.codec))
+				Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+		}
+
+		known = proto_delta->version();
+	}
+
+	Room& room = sc.rooms[id];
+	room.id = id;
+	int slots_size = proto_delta->slots_size();
+	for (int i = 0; i < slots_size; i++)
+	{
+		const Proto::RoomSlot& proto_slot = proto_delta->slots(i);
+		if (proto_slot.slot() >= room.slots.size())
+			room.slots.resize(proto_slot.slot() + 1, RemoteClient::UNASSIGNED_ID);
+
+		room.slots[proto_slot.slot()] = proto_slot.id_client();
+	}
+
+	sc.PushRoomListEvent();
+}
+
 void ClientImpl::PopulateServerInfo(ServerInfoImpl& si, const Proto::ServerInfo* proto_info)
 {
 	if (proto_info->has_name()){
@@ -1016,7 +1821,9 @@ void ClientImpl::UpdateConnections(std::vector<Connection>& vect)
 	for (; it != m_connections.end(); it++)
 	{
 		if (!it->isNull()) {
-			it->data.ping = m_peer->GetAveragePing(it->addr);
+			it->data.ping = GetAveragePing(it->addr);
+			it->data.control_latency = it->planeLatency[PLANE_CONTROL];
+			it->data.data_latency = it->planeLatency[PLANE_DATA];
 			vect.push_back(it->data);
 		}
 	}
@@ -1031,7 +1838,9 @@ void ClientImpl::PushConnectionsEvent(Connection::id_t id, ConnectionEvent::Even
 {
 	auto ev = std::unique_ptr<ConnectionEvent>(new ConnectionEvent());
 	ConnectionImpl& sc = m_connections[id];
-	sc.data.ping = m_peer->GetAveragePing(sc.addr);
+	sc.data.ping = GetAveragePing(sc.addr);
+	sc.data.control_latency = sc.planeLatency[PLANE_CONTROL];
+	sc.data.data_latency = sc.planeLatency[PLANE_DATA];
 	ev->connection = sc.data;
 	ev->type = type;
 
@@ -1,12 +1,15 @@
 #pragma once
 
 #include <Biribit/Packet.h>
+#include <Biribit/LocalLink.h>
 #include <Biribit/Common/PrintLog.h>
 #include <Biribit/Common/BiribitMessageIdentifiers.h>
+#include <Biribit/Common/CompactCodec.h>
 #include <Biribit/Common/Debug.h>
 #include <Biribit/Common/TaskPool.h>
 #include <Biribit/Common/Types.h>
 #include <Biribit/Common/Generic.h>
+#include <Biribit/Common/SlotSet.h>
 
 #include <Biribit/Client/BiribitTypes.h>
 #include <Biribit/Client/BiribitEvent.h>
@@ -40,6 +43,7 @@ public:
 	~ClientImpl();
 
 	void Connect(const char* addr = nullptr, unsigned short port = 0, const char* password = nullptr);
+	void Connect(shared<LocalLink> link);
 	void Disconnect(Connection::id_t id);
 	void Disconnect();
 
@@ -67,9 +71,25 @@ public:
 
 	Room::id_t GetJoinedRoomId(Connection::id_t id);
 	Room::slot_id_t GetJoinedRoomSlot(Connection::id_t id);
+	void SpectateRoom(Connection::id_t id, Room::id_t room_id);
+	bool IsSpectating(Connection::id_t id);
+	milliseconds_t GetServerTime(Connection::id_t id);
 
-	void SendBroadcast(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask);
-	void SendBroadcast(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask);
+	void SendBroadcast(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream);
+	void SendBroadcast(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream);
+
+	void SendBroadcastToInterest(Connection::id_t id, Room::interest_t interest, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream);
+	void SendBroadcastToInterest(Connection::id_t id, Room::interest_t interest, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream);
+
+	void SendBroadcastToSlots(Connection::id_t id, const std::vector<Room::slot_id_t>& slots, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream);
+	void SendBroadcastToSlots(Connection::id_t id, const std::vector<Room::slot_id_t>& slots, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream);
+
+	void SendBroadcastToOthers(Connection::id_t id, const Packet& packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream);
+	void SendBroadcastToOthers(Connection::id_t id, const char* data, unsigned int lenght, Packet::ReliabilityBitmask mask, Room::stream_id_t stream);
+
+	void SetInterests(Connection::id_t id, const std::vector<Room::interest_t>& interests);
+	void AddInterest(Connection::id_t id, Room::interest_t interest);
+	void RemoveInterest(Connection::id_t id, Room::interest_t interest);
 
 	void SendEntry(Connection::id_t id, const Packet& packet);
 	void SendEntry(Connection::id_t id, const char* data, unsigned int lenght);
@@ -89,12 +109,37 @@ private:
 	RakNet::RakPeerInterface *m_peer;
 	unique<TaskPool> m_pool;
 
-	void SendBroadcast(Connection::id_t id, shared<Packet> packet, Packet::ReliabilityBitmask mask);
+	// Servers of this process. Each link has an address of its own, sends
+	// to it skip RakNet.
+	std::map<RakNet::SystemAddress, shared<LocalLink>> m_localLinks;
+	std::uint16_t m_localLinksCount;
+
+	void Send(const RakNet::BitStream* bstream, PacketPriority priority, PacketReliability reliability, char channel, const RakNet::AddressOrGUID systemIdentifier, bool broadcast);
+	void Send(const char* data, int size, PacketPriority priority, PacketReliability reliability, char channel, const RakNet::AddressOrGUID systemIdentifier, bool broadcast);
+	void SendList(const char** data, const int* lengths, int count, PacketPriority priority, PacketReliability reliability, char channel, const RakNet::AddressOrGUID systemIdentifier, bool broadcast);
+	void CloseConnection(RakNet::SystemAddress addr);
+	bool IsConnected(RakNet::SystemAddress addr);
+	int GetAveragePing(RakNet::SystemAddress addr);
+	void PollLocalLinks();
+
+	void SendBroadcast(Connection::id_t id, shared<Packet> packet, Packet::ReliabilityBitmask mask, Room::stream_id_t stream, RakNet::MessageID msgId, shared<RakNet::BitStream> target);
+	static shared<RakNet::BitStream> SlotMask(const std::vector<Room::slot_id_t>& slots);
+	void SendInterests(ConnectionImpl& conn, bool reset, const std::vector<Room::interest_t>& add, const std::vector<Room::interest_t>& remove);
 	void SendEntry(Connection::id_t id, shared<Packet> packet);
 
+	void SendSpectate(RakNet::SystemAddress addr, Room::id_t room_id);
+	void SpectateRedirect(RakNet::SystemAddress addr, const Proto::RoomMigrated* proto_redirect);
+
+	void SyncClocks();
+	void ProbePlanes();
+	static void WriteTimestamp(RakNet::BitStream& bstream, ConnectionImpl& conn);
+
 	void SendProtocolMessageID(RakNet::MessageID msg, const RakNet::AddressOrGUID systemIdentifier);
+	void SendCodecHello(RakNet::SystemAddress addr);
 	bool WriteMessage(RakNet::BitStream& bstream, RakNet::MessageID msgId, const ::google::protobuf::MessageLite& msg);
+	template<typename T> bool WriteMessage(RakNet::BitStream& bstream, RakNet::MessageID msgId, const T& msg, std::uint8_t codec);
 	template<typename T> bool ReadMessage(T& msg, RakNet::BitStream& bstream);
+	template<typename T> bool ReadMessage(T& msg, RakNet::BitStream& bstream, bool compact);
 	template<typename T> bool ReadMessage(T& msg, Packet& packet);
 
 	static void RaknetThreadUpdate(RakNet::RakPeerInterface *peer, void* data);
@@ -103,10 +148,17 @@ private:
 
 	void ConnectedAt(RakNet::SystemAddress);
 	void DisconnectFrom(RakNet::SystemAddress);
+	void MigrateTo(RakNet::SystemAddress addr, const Proto::RoomMigrated* proto_migrated);
+	void MigratedTo(Connection::id_t id, RakNet::SystemAddress addr);
+	void MigrationFailed(RakNet::SystemAddress addr);
+	Connection::id_t GetMigratingConnection(RakNet::SystemAddress addr);
+	bool FailOver(RakNet::SystemAddress addr);
 
 	enum TypeUpdateRemoteClient { UPDATE_CLIENT, UPDATE_DISCONNECTION };
 	void UpdateRemoteClient(RakNet::SystemAddress addr, const Proto::Client* proto_client, TypeUpdateRemoteClient type);
 	void UpdateRoom(RakNet::SystemAddress addr, const Proto::Room* proto_room);
+	void UpdateRoom(RakNet::SystemAddress addr, const Proto::RoomDelta* proto_delta);
+	bool AcceptRoomVersion(ConnectionImpl& sc, const Proto::Room* proto_room);
 
 	static void PopulateServerInfo(ServerInfoImpl&, const Proto::ServerInfo*);
 	static void PopulateRemoteClient(RemoteClient&, const Proto::Client*);
@@ -122,6 +174,9 @@ private:
 	std::map<RakNet::SystemAddress, ServerInfoImpl> serverList;
 	std::array<ConnectionImpl, CLIENT_MAX_CONNECTIONS + 1> m_connections;
 
+	// Rooms to spectate once connected to the relays they were sent to.
+	std::map<RakNet::SystemAddress, Room::id_t> m_spectateRedirects;
+
 	std::queue<std::unique_ptr<Event>> m_eventQueue;
 	std::mutex m_eventMutex;
 };
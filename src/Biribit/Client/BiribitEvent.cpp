@@ -25,7 +25,7 @@ RemoteClientEvent::~RemoteClientEvent() {}
 RoomListEvent::RoomListEvent() : Event(EVENT_ROOM_LIST_ID) {}
 RoomListEvent::~RoomListEvent() {}
 
-JoinedRoomEvent::JoinedRoomEvent() : Event(EVENT_JOINED_ROOM_ID) {}
+JoinedRoomEvent::JoinedRoomEvent() : Event(EVENT_JOINED_ROOM_ID), spectator(false) {}
 JoinedRoomEvent::~JoinedRoomEvent() {}
 
 BroadcastEvent::BroadcastEvent() : Event(EVENT_BROADCAST_ID) {}
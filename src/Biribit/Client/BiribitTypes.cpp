@@ -17,7 +17,10 @@ ServerInfo::ServerInfo()
 
 //---------------------------------------------------------------------------//
 
-Connection::Connection() : id(Connection::UNASSIGNED_ID)
+Connection::Connection()
+	: id(Connection::UNASSIGNED_ID)
+	, control_latency(0)
+	, data_latency(0)
 {
 }
 
@@ -0,0 +1,80 @@
+#include "ClockSync.h"
+
+namespace Biribit
+{
+
+const RakNet::Time CLOCK_BURST_PERIOD = 250;
+const RakNet::Time CLOCK_SAMPLE_PERIOD = 5000;
+const std::uint32_t CLOCK_MAX_RTT = 10000;
+
+ClockSync::ClockSync()
+{
+	Reset();
+}
+
+void ClockSync::Reset()
+{
+	m_samplesCount = 0;
+	m_nextSample = 0;
+	m_lastRequest = 0;
+	m_offset = 0;
+	m_rtt = 0;
+	m_synchronized = false;
+}
+
+bool ClockSync::SampleDue(RakNet::Time now)
+{
+	RakNet::Time period = (m_samplesCount < BURST_SAMPLES) ? CLOCK_BURST_PERIOD : CLOCK_SAMPLE_PERIOD;
+	if (m_lastRequest != 0 && now - m_lastRequest < period)
+		return false;
+
+	m_lastRequest = now;
+	return true;
+}
+
+void ClockSync::AddSample(RakNet::Time sent, std::uint32_t server_time, RakNet::Time received)
+{
+	if (received < sent || received - sent > CLOCK_MAX_RTT)
+		return;
+
+	// The server read its clock halfway through the round trip.
+	Sample& sample = m_samples[m_nextSample];
+	sample.rtt = (std::uint32_t) (received - sent);
+	sample.offset = (std::int64_t) server_time - (std::int64_t) (sent + sample.rtt / 2);
+	m_nextSample = (m_nextSample + 1) % SAMPLES_COUNT;
+	if (m_samplesCount < SAMPLES_COUNT)
+		m_samplesCount++;
+
+	const Sample* best = &m_samples[0];
+	for (std::size_t i = 1; i < m_samplesCount; i++)
+		if (m_samples[i].rtt < best->rtt)
+			best = &m_samples[i];
+
+	m_offset = best->offset;
+	m_rtt = best->rtt;
+	m_synchronized = true;
+}
+
+bool ClockSync::IsSynchronized() const
+{
+	return m_synchronized;
+}
+
+std::uint32_t ClockSync::GetRtt() const
+{
+	return m_rtt;
+}
+
+std::uint32_t ClockSync::ToServerTime(RakNet::Time local) const
+{
+	return (std::uint32_t) ((std::int64_t) local + m_offset);
+}
+
+RakNet::Time ClockSync::ToLocalTime(std::uint32_t server_time, RakNet::Time now) const
+{
+	// Relative to now, so wrapping server times still convert.
+	std::int32_t delta = (std::int32_t) (server_time - ToServerTime(now));
+	return (RakNet::Time) ((std::int64_t) now + delta);
+}
+
+} // namespace Biribit
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+#include <RakNetTypes.h>
+
+namespace Biribit
+{
+
+// NTP style estimate of a server clock. Each round trip gives an RTT and an
+// offset sample. Queueing only ever adds delay, so the offset of the fastest
+// recent round trip is the one trusted.
+class ClockSync
+{
+public:
+	ClockSync();
+
+	void Reset();
+
+	// True when a new sample should be requested, in a burst right after
+	// connecting and then periodically.
+	bool SampleDue(RakNet::Time now);
+	void AddSample(RakNet::Time sent, std::uint32_t server_time, RakNet::Time received);
+
+	bool IsSynchronized() const;
+	std::uint32_t GetRtt() const;
+
+	// Server time is milliseconds since the server started, wrapping.
+	std::uint32_t ToServerTime(RakNet::Time local) const;
+	RakNet::Time ToLocalTime(std::uint32_t server_time, RakNet::Time now) const;
+
+private:
+	struct Sample
+	{
+		std::uint32_t rtt;
+		std::int64_t offset;
+	};
+
+	enum { SAMPLES_COUNT = 8, BURST_SAMPLES = 4 };
+
+	Sample m_samples[SAMPLES_COUNT];
+	std::size_t m_samplesCount;
+	std::size_t m_nextSample;
+	RakNet::Time m_lastRequest;
+
+	// Read from the user thread through GetServerTime.
+	std::atomic<std::int64_t> m_offset;
+	std::atomic<std::uint32_t> m_rtt;
+	std::atomic<bool> m_synchronized;
+};
+
+} // namespace Biribit
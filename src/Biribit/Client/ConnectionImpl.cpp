@@ -1,6 +1,8 @@
 #include "ConnectionImpl.h"
 #include "BiribitClientImpl.h"
 
+#include <algorithm>
+
 namespace Biribit
 {
 
@@ -11,8 +13,16 @@ ConnectionImpl::ConnectionImpl()
 	, selfId(RemoteClient::UNASSIGNED_ID)
 	, joinedRoom(Room::UNASSIGNED_ID)
 	, joinedSlot(0)
+	, spectating(false)
 	, joinedRoomEntries(1)
+	, migratingTo(RakNet::UNASSIGNED_SYSTEM_ADDRESS)
+	, migrationRoom(Room::UNASSIGNED_ID)
+	, migrationToken(0)
+	, codec(CODEC_PROTOBUF)
+	, lastProbe(0)
 {
+	for (std::size_t i = 0; i < PLANES_COUNT; i++)
+		planeLatency[i] = 0;
 }
 
 void ConnectionImpl::Clear()
@@ -23,10 +33,25 @@ void ConnectionImpl::Clear()
 
 	joinedRoom = Room::UNASSIGNED_ID;
 	joinedSlot = 0;
+	spectating = false;
+	interests.clear();
 	ResetEntries();
 
 	clients.clear();
 	rooms.clear();
+	roomVersions.clear();
+
+	migratingTo = RakNet::UNASSIGNED_SYSTEM_ADDRESS;
+	migrationRoom = Room::UNASSIGNED_ID;
+	migrationToken = 0;
+	resume.Clear();
+	standby.Clear();
+	clock.Reset();
+	codec = CODEC_PROTOBUF;
+
+	lastProbe = 0;
+	for (std::size_t i = 0; i < PLANES_COUNT; i++)
+		planeLatency[i] = 0;
 }
 
 bool ConnectionImpl::isNull()
@@ -34,15 +59,41 @@ bool ConnectionImpl::isNull()
 	return addr == RakNet::UNASSIGNED_SYSTEM_ADDRESS;
 }
 
+void ConnectionImpl::AddPlaneSample(std::uint8_t plane, RakNet::Time sent, RakNet::Time received)
+{
+	if (plane >= PLANES_COUNT || received < sent)
+		return;
+
+	std::uint32_t sample = (std::uint32_t) (received - sent);
+	std::uint32_t latency = planeLatency[plane];
+	planeLatency[plane] = (latency == 0) ? sample : (latency * 7 + sample) / 8;
+}
+
+std::uint32_t& ConnectionImpl::RoomVersion(Room::id_t id)
+{
+	if (id >= roomVersions.size())
+		roomVersions.resize(id + 1, 0);
+
+	return roomVersions[id];
+}
+
 unique<Proto::RoomEntriesRequest> ConnectionImpl::UpdateEntries(Proto::RoomEntriesStatus* proto_entries)
 {
 	unique<Proto::RoomEntriesRequest> proto_entriesReq;
 	if (proto_entries->has_room_id() && joinedRoom == proto_entries->room_id())
 	{
-		if (proto_entries->has_journal_size())
+		// New entries come without the journal size, they extend it.
+		std::uint32_t journal_size = proto_entries->journal_size();
+		if (!proto_entries->has_journal_size())
+		{
+			journal_size = (std::uint32_t) joinedRoomEntries.size() - 1;
+			for (int i = 0; i < proto_entries->entries_size(); i++)
+				journal_size = std::max(journal_size, proto_entries->entries(i).id());
+		}
+
+		if (proto_entries->has_journal_size() || proto_entries->entries_size() > 0)
 		{
 			//resize journal
-			std::uint32_t journal_size = proto_entries->journal_size();
 			{
 				std::lock_guard<std::mutex> lock(entriesMutex);
 				joinedRoomEntries.resize(journal_size + 1);
@@ -96,6 +147,17 @@ Entry::id_t ConnectionImpl::GetEntriesCount()
 	return Entry::UNASSIGNED_ID;
 }
 
+Entry::id_t ConnectionImpl::GetEntriesCursor()
+{
+	// Last entry received with no gaps before it.
+	std::lock_guard<std::mutex> lock(entriesMutex);
+	std::size_t cursor = Entry::UNASSIGNED_ID;
+	while (cursor + 1 < joinedRoomEntries.size() && joinedRoomEntries[cursor + 1].hasEverSwapped())
+		cursor++;
+
+	return static_cast<Entry::id_t>(cursor);
+}
+
 const Entry& ConnectionImpl::GetEntry(Entry::id_t id)
 {
 	{
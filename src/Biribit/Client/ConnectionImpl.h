@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <set>
 #include <memory>
 #include <mutex>
 #include <atomic>
@@ -16,6 +17,8 @@
 
 #include <Biribit/Client/BiribitTypes.h>
 
+#include "ClockSync.h"
+
 #include <RakNetTypes.h>
 
 namespace Biribit
@@ -35,9 +38,13 @@ public:
 
 	std::vector<RemoteClient> clients;
 	std::vector<Room> rooms;
+	std::vector<std::uint32_t> roomVersions;
 
 	std::atomic<Room::id_t> joinedRoom;
 	std::atomic<Room::slot_id_t> joinedSlot;
+	// Spectators follow joinedRoom without a slot of their own.
+	std::atomic<bool> spectating;
+	std::set<Room::interest_t> interests;
 
 	//TODO: I would like to change this.
 	std::vector<RefSwap<Entry>> joinedRoomEntries;
@@ -45,12 +52,35 @@ public:
 
 	static Entry EntryDummy;
 
+	// Set when the server moves the joined room to another node.
+	RakNet::SystemAddress migratingTo;
+	Room::id_t migrationRoom;
+	std::uint64_t migrationToken;
+
+	// Tickets to claim the joined slot back after losing the connection, at
+	// this same server or at its standby.
+	Proto::RoomMigrated resume;
+	Proto::RoomMigrated standby;
+
+	ClockSync clock;
+
+	// Codec the server picked for the hot control messages, protobuf until
+	// it answers ID_CODEC_HELLO. Old servers never do.
+	std::uint8_t codec;
+
+	// Probes sent behind each plane's own traffic, smoothed round trips.
+	RakNet::Time lastProbe;
+	std::atomic<std::uint32_t> planeLatency[PLANES_COUNT];
+
 	ConnectionImpl();
 
 	void Clear();
 	bool isNull();
+	void AddPlaneSample(std::uint8_t plane, RakNet::Time sent, RakNet::Time received);
+	std::uint32_t& RoomVersion(Room::id_t id);
 	unique<Proto::RoomEntriesRequest> UpdateEntries(Proto::RoomEntriesStatus* proto_entries);
 	Entry::id_t GetEntriesCount();
+	Entry::id_t GetEntriesCursor();
 	const Entry& GetEntry(Entry::id_t id);
 	void ResetEntries();
 
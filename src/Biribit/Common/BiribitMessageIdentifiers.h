@@ -4,13 +4,48 @@
 #include <Client.pb.h>
 #include <Room.pb.h>
 #include <ServerStatus.pb.h>
+#include <Node.pb.h>
 
 //RakNet
 #include <MessageIdentifiers.h>
+#include <PacketPriority.h>
 
 const unsigned short SERVER_DEFAULT_PORT = 8287;
 const unsigned int   SERVER_DEFAULT_MAX_CONNECTIONS = 32;
 const unsigned int   CLIENT_MAX_CONNECTIONS = 8;
+const unsigned int   ROOM_MAX_SLOTS = 0xFF;
+const unsigned int   LARGE_ROOM_MAX_SLOTS = 4096;
+
+enum BiribitOrderingChannels
+{
+	CHANNEL_CONTROL = 0,
+	//control plane: requests, joins, room status, errors and node messages
+
+	CHANNEL_LOBBY = 1,
+	//control plane: client presence, room lists and server status
+
+	CHANNEL_JOURNAL = 2,
+	//data plane: room journal entries
+
+	CHANNEL_ROOM_STREAMS = 3
+	//data plane: room broadcast streams, one channel per stream up to channel 31
+};
+
+const unsigned int   ROOM_MAX_STREAMS = 32 - CHANNEL_ROOM_STREAMS;
+
+// Control messages overtake journal sync, presence bursts only take what
+// bandwidth is left.
+const PacketPriority CONTROL_PRIORITY = HIGH_PRIORITY;
+const PacketPriority LOBBY_PRIORITY = LOW_PRIORITY;
+const PacketPriority JOURNAL_PRIORITY = MEDIUM_PRIORITY;
+const PacketPriority STREAM_PRIORITY = HIGH_PRIORITY;
+
+enum BiribitPlanes
+{
+	PLANE_CONTROL = 0,
+	PLANE_DATA,
+	PLANES_COUNT
+};
 
 enum BiribitMessageIDTypes
 {
@@ -71,8 +106,109 @@ enum BiribitMessageIDTypes
 	ID_JOURNAL_ENTRIES_STATUS,
 	//sv -> cl: follows Proto::RoomEntriesStatus
 
-	ID_SEND_ENTRY_TO_ROOM
+	ID_SEND_ENTRY_TO_ROOM,
 	//cl -> sv: follows binary data
+
+	ID_ROOM_MIGRATED,
+	//sv -> cl: follows Proto::RoomMigrated
+
+	ID_ROOM_MIGRATION_CLAIM,
+	//cl -> sv: follows Proto::RoomMigrationClaim
+
+	ID_NODE_HELLO,
+	//sv -> sv: follows Proto::ServerLoad
+
+	ID_NODE_LOAD,
+	//sv -> sv: follows Proto::ServerLoad
+
+	ID_NODE_ROOM_MIGRATE,
+	//sv -> sv: follows Proto::RoomMigration
+
+	ID_NODE_ROOM_MIGRATED,
+	//sv -> sv: follows Proto::RoomMigration
+
+	ID_NODE_ROOM_APPEND,
+	//sv -> sv: follows Proto::RoomEntriesStatus
+
+	ID_ROOM_INTEREST_UPDATE,
+	//cl -> sv: follows Proto::RoomInterests
+
+	ID_SEND_BROADCAST_TO_INTEREST,
+	//cl -> sv: follows reliability(uin8_t) + interest(uint32_t) + binary data
+
+	ID_BROADCAST_FROM_LARGE_ROOM,
+	//sv -> cl: follows sender_slot(uin16_t) + binary data
+
+	ID_ROOM_STATUS_DELTA,
+	//sv -> cl: follows Proto::RoomDelta, one version after the previous status or delta
+
+	ID_SEND_BROADCAST_TO_SLOTS,
+	//cl -> sv: follows reliability(uin8_t) + mask_words(uint16_t) + slot mask(uint64_t * mask_words) + binary data
+
+	ID_SEND_BROADCAST_TO_OTHERS,
+	//cl -> sv: follows reliability(uin8_t) + binary data
+
+	ID_ROOM_STANDBY,
+	//sv -> cl: follows Proto::RoomMigrated
+
+	ID_NODE_REPLICA_LOG,
+	//sv -> sv: follows Proto::ReplicaLog
+
+	ID_ROOM_RESUME,
+	//sv -> cl: follows Proto::RoomMigrated, empty address for this same server
+
+	ID_CLOCK_SYNC_REQUEST,
+	//cl -> sv: follows client_time(RakNet::Time)
+
+	ID_CLOCK_SYNC_RESPONSE,
+	//sv -> cl: follows client_time(RakNet::Time) + server_time(uint32_t)
+
+	ID_TIMESTAMP_COMPACT,
+	//cl <-> sv: follows server_time(uint32_t) + message, in place of ID_TIMESTAMP + RakNet::Time between synchronized peers
+
+	ID_ROOM_SPECTATE_REQUEST,
+	//cl -> sv: follows Proto::RoomSpectate, without id to stop spectating
+
+	ID_ROOM_SPECTATE_RESPONSE,
+	//sv -> cl: follows Proto::RoomSpectate, without id when spectating stopped
+
+	ID_ROOM_SPECTATE_REDIRECT,
+	//sv -> cl: follows Proto::RoomMigrated, relay to spectate the room from
+
+	ID_NODE_RELAY,
+	//sv -> sv: follows Proto::ServerLoad, from a relay to its origin
+
+	ID_NODE_SPECTATE,
+	//sv -> sv: follows Proto::RoomSpectate with the appid of its spectators, from a relay to its origin
+
+	ID_NODE_SPECTATE_DATA,
+	//sv -> sv: follows room_id(uint32_t) + reliability(uint8_t) + channel(uint8_t) + message for the room spectators
+
+	ID_PLANE_PROBE,
+	//cl <-> sv: follows plane(uint8_t) + client_time(RakNet::Time), echoed back on the same plane
+
+	ID_ROOM_STATUS_REQUEST,
+	//cl -> sv: follows Proto::RoomJoin, answered with the full ID_ROOM_STATUS
+
+	ID_CODEC_HELLO,
+	//cl <-> sv: follows codec(uint8_t), the newest the client reads, answered with the one the server picked
+
+	ID_COMPACT_MESSAGE,
+	//cl <-> sv: follows message id(MessageID) + message in the CompactCodec.h layout, once both agreed on CODEC_COMPACT
+
+	ID_SEND_BROADCAST_ON_STREAM
+	//cl -> sv: follows stream(uint8_t) + one of the ID_SEND_BROADCAST_TO_* messages, for streams other than 0
+};
+
+enum BiribitCodecs
+{
+	CODEC_PROTOBUF = 0,
+	//every message in protobuf, peers that never said hello
+
+	CODEC_COMPACT = 1,
+	//hot control messages in compact layouts
+
+	CODEC_NEWEST = CODEC_COMPACT
 };
 
 
@@ -0,0 +1,229 @@
+#include <Biribit/Common/Capture.h>
+
+#include <cstring>
+
+namespace
+{
+	const char CAPTURE_MAGIC[] = { 'B', 'R', 'B', 'T', 'C', 'A', 'P', 1 };
+	const std::size_t CAPTURE_BUFFER_SIZE = 64 * 1024;
+	const std::size_t CAPTURE_MAX_DATA = 16 * 1024 * 1024;
+}
+
+CaptureRecord::CaptureRecord()
+	: type(0)
+	, time(0)
+	, client_id(0)
+	, room_id(0)
+	, slot(0)
+{
+}
+
+CaptureWriter::CaptureWriter()
+	: m_file(nullptr)
+	, m_lastTime(0)
+	, m_records(0)
+{
+}
+
+CaptureWriter::~CaptureWriter()
+{
+	Close();
+}
+
+bool CaptureWriter::Open(const std::string& path)
+{
+	Close();
+	m_file = std::fopen(path.c_str(), "wb");
+	if (m_file == nullptr)
+		return false;
+
+	m_buffer.reserve(CAPTURE_BUFFER_SIZE);
+	m_buffer.assign(CAPTURE_MAGIC, CAPTURE_MAGIC + sizeof(CAPTURE_MAGIC));
+	m_lastTime = 0;
+	m_records = 0;
+	return true;
+}
+
+bool CaptureWriter::IsOpen() const
+{
+	return m_file != nullptr;
+}
+
+void CaptureWriter::Close()
+{
+	if (m_file == nullptr)
+		return;
+
+	Flush();
+	std::fclose(m_file);
+	m_file = nullptr;
+}
+
+void CaptureWriter::Write(std::uint8_t type, std::uint64_t time, std::uint32_t client_id, std::uint32_t room_id, std::uint32_t slot, const char* data, std::size_t size)
+{
+	if (m_file == nullptr)
+		return;
+
+	// Times only grow, deltas keep them one or two bytes long.
+	if (time < m_lastTime)
+		time = m_lastTime;
+
+	m_buffer.push_back((char) type);
+	WriteVarint(time - m_lastTime);
+	WriteVarint(client_id);
+	WriteVarint(room_id);
+	WriteVarint(slot);
+	WriteVarint(size);
+	m_buffer.insert(m_buffer.end(), data, data + size);
+	m_lastTime = time;
+	m_records++;
+
+	if (m_buffer.size() >= CAPTURE_BUFFER_SIZE)
+		Flush();
+}
+
+void CaptureWriter::Flush()
+{
+	if (m_file == nullptr || m_buffer.empty())
+		return;
+
+	std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+	std::fflush(m_file);
+	m_buffer.clear();
+}
+
+std::uint64_t CaptureWriter::RecordsCount() const
+{
+	return m_records;
+}
+
+void CaptureWriter::WriteVarint(std::uint64_t value)
+{
+	while (value >= 0x80) {
+		m_buffer.push_back((char) ((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+
+	m_buffer.push_back((char) value);
+}
+
+CaptureReader::CaptureReader()
+	: m_file(nullptr)
+	, m_begin(0)
+	, m_lastTime(0)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+	Close();
+}
+
+bool CaptureReader::Open(const std::string& path)
+{
+	Close();
+	m_file = std::fopen(path.c_str(), "rb");
+	if (m_file == nullptr)
+		return false;
+
+	m_buffer.clear();
+	m_begin = 0;
+	m_lastTime = 0;
+	if (!Fill(sizeof(CAPTURE_MAGIC)) || std::memcmp(&m_buffer[m_begin], CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) {
+		Close();
+		return false;
+	}
+
+	m_begin += sizeof(CAPTURE_MAGIC);
+	return true;
+}
+
+void CaptureReader::Close()
+{
+	if (m_file != nullptr) {
+		std::fclose(m_file);
+		m_file = nullptr;
+	}
+}
+
+bool CaptureReader::Read(CaptureRecord& record)
+{
+	if (m_file == nullptr || !Fill(1))
+		return false;
+
+	std::uint64_t time, client_id, room_id, slot, size;
+	record.type = (std::uint8_t) m_buffer[m_begin++];
+	if (!ReadVarint(time) || !ReadVarint(client_id) || !ReadVarint(room_id) || !ReadVarint(slot) || !ReadVarint(size))
+		return false;
+
+	if (size > CAPTURE_MAX_DATA || !Fill((std::size_t) size))
+		return false;
+
+	m_lastTime += time;
+	record.time = m_lastTime;
+	record.client_id = (std::uint32_t) client_id;
+	record.room_id = (std::uint32_t) room_id;
+	record.slot = (std::uint32_t) slot;
+	record.data.assign(m_buffer.data() + m_begin, (std::size_t) size);
+	m_begin += (std::size_t) size;
+	return true;
+}
+
+bool CaptureReader::Fill(std::size_t size)
+{
+	std::size_t available = m_buffer.size() - m_begin;
+	if (available >= size)
+		return true;
+
+	m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_begin);
+	m_begin = 0;
+
+	std::size_t wanted = (size > CAPTURE_BUFFER_SIZE) ? size : CAPTURE_BUFFER_SIZE;
+	m_buffer.resize(available + wanted);
+	std::size_t read = std::fread(&m_buffer[available], 1, wanted, m_file);
+	m_buffer.resize(available + read);
+	return m_buffer.size() >= size;
+}
+
+bool CaptureReader::ReadVarint(std::uint64_t& value)
+{
+	value = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7)
+	{
+		if (!Fill(1))
+			return false;
+
+		std::uint8_t byte = (std::uint8_t) m_buffer[m_begin++];
+		value |= (std::uint64_t) (byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+std::string CaptureVarint(std::uint64_t value)
+{
+	std::string data;
+	while (value >= 0x80) {
+		data.push_back((char) ((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+
+	data.push_back((char) value);
+	return data;
+}
+
+bool CaptureReadVarint(const std::string& data, std::uint64_t& value)
+{
+	value = 0;
+	for (std::size_t i = 0; i < data.size() && i < 10; i++)
+	{
+		std::uint8_t byte = (std::uint8_t) data[i];
+		value |= (std::uint64_t) (byte & 0x7F) << (7 * i);
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+
+	return false;
+}
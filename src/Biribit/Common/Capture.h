@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Room traffic as it reached a server, written by BiribitServer --capture
+// and read back by BiribitReplay. A file is a header followed by records,
+// every field a varint but the data bytes.
+struct CaptureRecord
+{
+	enum Type
+	{
+		CAPTURE_CLIENT = 1,		// data: name, '\0', appid.
+		CAPTURE_DISCONNECT,
+		CAPTURE_JOIN,			// data: room slots count, varint.
+		CAPTURE_LEAVE,
+		CAPTURE_BROADCAST,		// data: message as sent, from its id on.
+		CAPTURE_ENTRY,			// data: entry.
+		CAPTURE_INTERESTS		// data: RoomInterests message.
+	};
+
+	std::uint8_t type;
+	std::uint64_t time;		// Milliseconds since the capture started.
+	std::uint32_t client_id;
+	std::uint32_t room_id;
+	std::uint32_t slot;
+	std::string data;
+
+	CaptureRecord();
+};
+
+class CaptureWriter
+{
+public:
+	CaptureWriter();
+	~CaptureWriter();
+
+	bool Open(const std::string& path);
+	bool IsOpen() const;
+	void Close();
+
+	// Buffered, records reach the file once the buffer fills or on Flush.
+	void Write(std::uint8_t type, std::uint64_t time, std::uint32_t client_id, std::uint32_t room_id, std::uint32_t slot, const char* data, std::size_t size);
+	void Flush();
+
+	std::uint64_t RecordsCount() const;
+
+private:
+	void WriteVarint(std::uint64_t value);
+
+	std::FILE* m_file;
+	std::vector<char> m_buffer;
+	std::uint64_t m_lastTime;
+	std::uint64_t m_records;
+
+	CaptureWriter(const CaptureWriter&);
+	CaptureWriter& operator=(const CaptureWriter&);
+};
+
+class CaptureReader
+{
+public:
+	CaptureReader();
+	~CaptureReader();
+
+	bool Open(const std::string& path);
+	void Close();
+
+	// False at the end of the file or on a truncated record.
+	bool Read(CaptureRecord& record);
+
+private:
+	bool Fill(std::size_t size);
+	bool ReadVarint(std::uint64_t& value);
+
+	std::FILE* m_file;
+	std::vector<char> m_buffer;
+	std::size_t m_begin;
+	std::uint64_t m_lastTime;
+
+	CaptureReader(const CaptureReader&);
+	CaptureReader& operator=(const CaptureReader&);
+};
+
+// Helpers for the varints of CAPTURE_JOIN data.
+std::string CaptureVarint(std::uint64_t value);
+bool CaptureReadVarint(const std::string& data, std::uint64_t& value);
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <Biribit/Common/BiribitMessageIdentifiers.h>
+
+//RakNet
+#include <BitStream.h>
+
+// Codec of the hot control messages once both peers agree on CODEC_COMPACT.
+// Each layout is fixed at compile time, in the order of the .proto tags:
+// a byte flagging the optional fields present, then every field as a
+// varint, repeated fields after their count. No message is parsed, sized or
+// written through protobuf's virtual calls, and writing goes straight into
+// the stream without a temporary buffer.
+//
+// A layout change is a new codec number, never an edit of these ones.
+namespace Compact
+{
+
+inline std::size_t VarintSize(std::uint64_t value)
+{
+	std::size_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		size++;
+	}
+
+	return size;
+}
+
+struct Writer
+{
+	char* out;
+
+	explicit Writer(char* _out) : out(_out) {}
+
+	void Byte(std::uint8_t value)
+	{
+		*out++ = (char) value;
+	}
+
+	void Varint(std::uint64_t value)
+	{
+		while (value >= 0x80) {
+			*out++ = (char) ((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+
+		*out++ = (char) value;
+	}
+};
+
+struct Reader
+{
+	const char* in;
+	const char* end;
+	bool ok;
+
+	Reader(const char* _in, std::size_t size) : in(_in), end(_in + size), ok(true) {}
+
+	std::uint8_t Byte()
+	{
+		if (in == end) {
+			ok = false;
+			return 0;
+		}
+
+		return (std::uint8_t) *in++;
+	}
+
+	std::uint32_t Varint()
+	{
+		std::uint64_t value = 0;
+		for (unsigned int shift = 0; shift < 35; shift += 7) {
+			std::uint8_t byte = Byte();
+			value |= (std::uint64_t) (byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				return (value <= 0xFFFFFFFF) ? (std::uint32_t) value : Fail();
+		}
+
+		return Fail();
+	}
+
+	// Counts of repeated fields, each item takes a byte at least.
+	std::uint32_t Count()
+	{
+		std::uint32_t count = Varint();
+		return (count <= (std::size_t) (end - in)) ? count : Fail();
+	}
+
+	void Flags(std::uint8_t flags, std::uint8_t known)
+	{
+		if ((flags & ~known) != 0)
+			Fail();
+	}
+
+	std::uint32_t Fail()
+	{
+		ok = false;
+		in = end;
+		return 0;
+	}
+};
+
+// Messages without a layout stay on protobuf.
+template<class T> struct Layout
+{
+	static const bool defined = false;
+};
+
+// RoomJoin: flags(id, slot_to_join) [id] [slot_to_join]
+template<> struct Layout<Proto::RoomJoin>
+{
+	static const bool defined = true;
+	enum { HAS_ID = 1, HAS_SLOT_TO_JOIN = 2 };
+
+	static std::size_t Size(const Proto::RoomJoin& msg)
+	{
+		return 1
+			+ (msg.has_id() ? VarintSize(msg.id()) : 0)
+			+ (msg.has_slot_to_join() ? VarintSize(msg.slot_to_join()) : 0);
+	}
+
+	static void Write(const Proto::RoomJoin& msg, Writer& out)
+	{
+		out.Byte((msg.has_id() ? HAS_ID : 0) | (msg.has_slot_to_join() ? HAS_SLOT_TO_JOIN : 0));
+		if (msg.has_id())
+			out.Varint(msg.id());
+		if (msg.has_slot_to_join())
+			out.Varint(msg.slot_to_join());
+	}
+
+	static void Read(Proto::RoomJoin& msg, Reader& in)
+	{
+		std::uint8_t flags = in.Byte();
+		in.Flags(flags, HAS_ID | HAS_SLOT_TO_JOIN);
+		if (flags & HAS_ID)
+			msg.set_id(in.Varint());
+		if (flags & HAS_SLOT_TO_JOIN)
+			msg.set_slot_to_join(in.Varint());
+	}
+};
+
+// RoomCreate: flags(slot_to_join) client_slots [slot_to_join]
+template<> struct Layout<Proto::RoomCreate>
+{
+	static const bool defined = true;
+	enum { HAS_SLOT_TO_JOIN = 1 };
+
+	static std::size_t Size(const Proto::RoomCreate& msg)
+	{
+		return 1
+			+ VarintSize(msg.client_slots())
+			+ (msg.has_slot_to_join() ? VarintSize(msg.slot_to_join()) : 0);
+	}
+
+	static void Write(const Proto::RoomCreate& msg, Writer& out)
+	{
+		out.Byte(msg.has_slot_to_join() ? HAS_SLOT_TO_JOIN : 0);
+		out.Varint(msg.client_slots());
+		if (msg.has_slot_to_join())
+			out.Varint(msg.slot_to_join());
+	}
+
+	static void Read(Proto::RoomCreate& msg, Reader& in)
+	{
+		std::uint8_t flags = in.Byte();
+		in.Flags(flags, HAS_SLOT_TO_JOIN);
+		msg.set_client_slots(in.Varint());
+		if (flags & HAS_SLOT_TO_JOIN)
+			msg.set_slot_to_join(in.Varint());
+	}
+};
+
+// RoomDelta: flags(journal_entries_count, version) id count(slots) (slot id_client)* [journal_entries_count] [version]
+template<> struct Layout<Proto::RoomDelta>
+{
+	static const bool defined = true;
+	enum { HAS_JOURNAL_ENTRIES_COUNT = 1, HAS_VERSION = 2 };
+
+	static std::size_t Size(const Proto::RoomDelta& msg)
+	{
+		std::size_t size = 1 + VarintSize(msg.id()) + VarintSize(msg.slots_size());
+		for (int i = 0; i < msg.slots_size(); i++)
+			size += VarintSize(msg.slots(i).slot()) + VarintSize(msg.slots(i).id_client());
+
+		return size
+			+ (msg.has_journal_entries_count() ? VarintSize(msg.journal_entries_count()) : 0)
+			+ (msg.has_version() ? VarintSize(msg.version()) : 0);
+	}
+
+	static void Write(const Proto::RoomDelta& msg, Writer& out)
+	{
+		out.Byte((msg.has_journal_entries_count() ? HAS_JOURNAL_ENTRIES_COUNT : 0) | (msg.has_version() ? HAS_VERSION : 0));
+		out.Varint(msg.id());
+		out.Varint(msg.slots_size());
+		for (int i = 0; i < msg.slots_size(); i++) {
+			out.Varint(msg.slots(i).slot());
+			out.Varint(msg.slots(i).id_client());
+		}
+
+		if (msg.has_journal_entries_count())
+			out.Varint(msg.journal_entries_count());
+		if (msg.has_version())
+			out.Varint(msg.version());
+	}
+
+	static void Read(Proto::RoomDelta& msg, Reader& in)
+	{
+		std::uint8_t flags = in.Byte();
+		in.Flags(flags, HAS_JOURNAL_ENTRIES_COUNT | HAS_VERSION);
+		msg.set_id(in.Varint());
+		std::uint32_t count = in.Count();
+		msg.mutable_slots()->Reserve(count);
+		for (std::uint32_t i = 0; i < count && in.ok; i++) {
+			Proto::RoomSlot* slot = msg.add_slots();
+			slot->set_slot(in.Varint());
+			slot->set_id_client(in.Varint());
+		}
+
+		if (flags & HAS_JOURNAL_ENTRIES_COUNT)
+			msg.set_journal_entries_count(in.Varint());
+		if (flags & HAS_VERSION)
+			msg.set_version(in.Varint());
+	}
+};
+
+// RoomInterests: flags(reset present, reset) count(add) add* count(remove) remove*
+template<> struct Layout<Proto::RoomInterests>
+{
+	static const bool defined = true;
+	enum { HAS_RESET = 1, RESET = 2 };
+
+	static std::size_t Size(const Proto::RoomInterests& msg)
+	{
+		std::size_t size = 1 + VarintSize(msg.add_size()) + VarintSize(msg.remove_size());
+		for (int i = 0; i < msg.add_size(); i++)
+			size += VarintSize(msg.add(i));
+		for (int i = 0; i < msg.remove_size(); i++)
+			size += VarintSize(msg.remove(i));
+
+		return size;
+	}
+
+	static void Write(const Proto::RoomInterests& msg, Writer& out)
+	{
+		out.Byte(msg.has_reset() ? (HAS_RESET | (msg.reset() ? RESET : 0)) : 0);
+		out.Varint(msg.add_size());
+		for (int i = 0; i < msg.add_size(); i++)
+			out.Varint(msg.add(i));
+		out.Varint(msg.remove_size());
+		for (int i = 0; i < msg.remove_size(); i++)
+			out.Varint(msg.remove(i));
+	}
+
+	static void Read(Proto::RoomInterests& msg, Reader& in)
+	{
+		std::uint8_t flags = in.Byte();
+		in.Flags(flags, HAS_RESET | RESET);
+		if (flags & HAS_RESET)
+			msg.set_reset((flags & RESET) != 0);
+
+		std::uint32_t count = in.Count();
+		msg.mutable_add()->Reserve(count);
+		for (std::uint32_t i = 0; i < count && in.ok; i++)
+			msg.add_add(in.Varint());
+
+		count = in.Count();
+		msg.mutable_remove()->Reserve(count);
+		for (std::uint32_t i = 0; i < count && in.ok; i++)
+			msg.add_remove(in.Varint());
+	}
+};
+
+// The messages carried by ID_COMPACT_MESSAGE, anything else is dropped.
+inline bool Carries(RakNet::MessageID msgId)
+{
+	switch (msgId)
+	{
+	case ID_ROOM_CREATE_REQUEST:
+	case ID_ROOM_JOIN_RANDOM_OR_CREATE_REQUEST:
+	case ID_ROOM_JOIN_REQUEST:
+	case ID_ROOM_JOIN_RESPONSE:
+	case ID_ROOM_STATUS_REQUEST:
+	case ID_ROOM_STATUS_DELTA:
+	case ID_ROOM_INTEREST_UPDATE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+template<class T> void WriteMessage(RakNet::BitStream& bstream, RakNet::MessageID msgId, const T& msg)
+{
+	std::size_t size = Layout<T>::Size(msg);
+	bstream.Write((RakNet::MessageID) ID_COMPACT_MESSAGE);
+	bstream.Write(msgId);
+
+	auto offset = bstream.GetWriteOffset();
+	bstream.AddBitsAndReallocate(BYTES_TO_BITS(size));
+	Writer out((char*) bstream.GetData() + BITS_TO_BYTES(offset));
+	Layout<T>::Write(msg, out);
+	bstream.SetWriteOffset(offset + BYTES_TO_BITS(size));
+}
+
+// The rest of the stream is the message.
+template<class T> bool ReadMessage(T& msg, RakNet::BitStream& bstream)
+{
+	std::size_t size = BITS_TO_BYTES(bstream.GetNumberOfUnreadBits());
+	Reader in((const char*) bstream.GetData() + BITS_TO_BYTES(bstream.GetReadOffset()), size);
+	Layout<T>::Read(msg, in);
+	bstream.IgnoreBytes(size);
+	return in.ok && in.in == in.end;
+}
+
+} // namespace Compact
@@ -1,6 +1,10 @@
 #include <Biribit/Packet.h>
 #include <cstring>
 #include <cwchar>
+#include <mutex>
+#include <limits>
+#include <cmath>
+#include <algorithm>
 
 #if defined(SYSTEM_WINDOWS)
 #include <winsock2.h>
@@ -15,25 +19,117 @@
 #include <unistd.h>
 #endif
 
+namespace
+{
+	// Buffers of released packets wait here for the next ones. Only buffers
+	// of a usual size are kept, a burst of large packets doesn't pin memory.
+	const std::size_t POOLED_BUFFERS = 256;
+	const std::size_t POOLED_BUFFER_CAPACITY = 64 * 1024;
+
+	class BufferPool
+	{
+	public:
+		std::vector<char>* Acquire(std::size_t capacity)
+		{
+			std::vector<char>* buffer = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (!m_free.empty()) {
+					buffer = m_free.back();
+					m_free.pop_back();
+				}
+			}
+
+			if (buffer == nullptr)
+				buffer = new std::vector<char>();
+
+			buffer->reserve(capacity);
+			return buffer;
+		}
+
+		void Release(std::vector<char>* buffer)
+		{
+			if (buffer->capacity() <= POOLED_BUFFER_CAPACITY)
+			{
+				buffer->clear();
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_free.size() < POOLED_BUFFERS) {
+					m_free.push_back(buffer);
+					return;
+				}
+			}
+
+			delete buffer;
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::vector<std::vector<char>*> m_free;
+	};
+
+	// Never destroyed, static packets may be released after it.
+	BufferPool& GetBufferPool()
+	{
+		static BufferPool* pool = new BufferPool();
+		return *pool;
+	}
+
+	std::shared_ptr<std::vector<char>> AcquireBuffer(std::size_t capacity)
+	{
+		return std::shared_ptr<std::vector<char>>(GetBufferPool().Acquire(capacity), [](std::vector<char>* buffer) {
+			GetBufferPool().Release(buffer);
+		});
+	}
+}
+
 namespace Biribit
 {
 
 ////////////////////////////////////////////////////////////
 Packet::Packet() :
+m_offset(0),
+m_size(0),
 m_readPos(0),
-m_isValid(true)
+m_readBits(0),
+m_writeBits(0),
+m_isValid(true),
+m_encoding(Fixed)
+{
+}
+
+
+////////////////////////////////////////////////////////////
+Packet::Packet(const Packet& packet) :
+m_buffer(packet.m_buffer),
+m_offset(packet.m_offset),
+m_size(packet.m_size),
+m_readPos(packet.m_readPos),
+m_readBits(packet.m_readBits),
+m_writeBits(packet.m_writeBits),
+m_isValid(packet.m_isValid),
+m_encoding(packet.m_encoding)
 {
+	if (m_buffer == nullptr)
+		std::memcpy(m_small, packet.m_small, m_size);
 }
 
 
 ////////////////////////////////////////////////////////////
 Packet::Packet(Packet&& packet) :
+m_buffer(std::move(packet.m_buffer)),
+m_offset(packet.m_offset),
+m_size(packet.m_size),
 m_readPos(packet.m_readPos),
-m_isValid(packet.m_isValid)
+m_readBits(packet.m_readBits),
+m_writeBits(packet.m_writeBits),
+m_isValid(packet.m_isValid),
+m_encoding(packet.m_encoding)
 {
-	packet.m_readPos = 0;
-	packet.m_isValid = true;
-	m_data = std::move(packet.m_data);
+	if (m_buffer == nullptr)
+		std::memcpy(m_small, packet.m_small, m_size);
+
+	packet.clear();
+	packet.m_encoding = Fixed;
 }
 
 
@@ -45,23 +141,58 @@ Packet::~Packet()
 
 
 ////////////////////////////////////////////////////////////
-Packet& Packet::operator=(Packet&& packet)
+Packet& Packet::operator=(const Packet& packet)
 {
+	if (this == &packet)
+		return *this;
+
+	m_buffer = packet.m_buffer;
+	m_offset = packet.m_offset;
+	m_size = packet.m_size;
 	m_readPos = packet.m_readPos;
+	m_readBits = packet.m_readBits;
+	m_writeBits = packet.m_writeBits;
 	m_isValid = packet.m_isValid;
+	m_encoding = packet.m_encoding;
+	if (m_buffer == nullptr)
+		std::memcpy(m_small, packet.m_small, m_size);
+
+	return *this;
+}
+
 
-	packet.m_readPos = 0;
-	packet.m_isValid = true;
-	m_data = std::move(packet.m_data);
+////////////////////////////////////////////////////////////
+Packet& Packet::operator=(Packet&& packet)
+{
+	if (this == &packet)
+		return *this;
+
+	m_buffer = std::move(packet.m_buffer);
+	m_offset = packet.m_offset;
+	m_size = packet.m_size;
+	m_readPos = packet.m_readPos;
+	m_readBits = packet.m_readBits;
+	m_writeBits = packet.m_writeBits;
+	m_isValid = packet.m_isValid;
+	m_encoding = packet.m_encoding;
+	if (m_buffer == nullptr)
+		std::memcpy(m_small, packet.m_small, m_size);
 
+	packet.clear();
+	packet.m_encoding = Fixed;
 	return *this;
 }
 
 
 ////////////////////////////////////////////////////////////
 Packet::Packet(const void* data, std::size_t sizeInBytes) :
+m_offset(0),
+m_size(0),
 m_readPos(0),
-m_isValid(true)
+m_readBits(0),
+m_writeBits(0),
+m_isValid(true),
+m_encoding(Fixed)
 {
 	append(data, sizeInBytes);
 }
@@ -71,41 +202,97 @@ m_isValid(true)
 void Packet::append(const void* data, std::size_t sizeInBytes)
 {
 	if (data && (sizeInBytes > 0))
-	{
-		std::size_t start = m_data.size();
-		m_data.resize(start + sizeInBytes);
-		std::memcpy(&m_data[start], data, sizeInBytes);
+		std::memcpy(extend(sizeInBytes), data, sizeInBytes);
+}
+
+
+////////////////////////////////////////////////////////////
+Packet Packet::slice(std::size_t offset, std::size_t sizeInBytes) const
+{
+	Packet packet;
+	packet.m_encoding = m_encoding;
+	if (offset >= m_size)
+		return packet;
+
+	if (sizeInBytes > m_size - offset)
+		sizeInBytes = m_size - offset;
+
+	if (m_buffer == nullptr) {
+		packet.append(m_small + offset, sizeInBytes);
+		return packet;
 	}
+
+	packet.m_buffer = m_buffer;
+	packet.m_offset = m_offset + offset;
+	packet.m_size = sizeInBytes;
+	return packet;
+}
+
+
+////////////////////////////////////////////////////////////
+void* Packet::grow(std::size_t sizeInBytes)
+{
+	return extend(sizeInBytes);
+}
+
+
+////////////////////////////////////////////////////////////
+const void* Packet::consume(std::size_t sizeInBytes)
+{
+	if (!checkSize(sizeInBytes))
+		return NULL;
+
+	const char* data = getBytes() + m_readPos;
+	m_readPos += sizeInBytes;
+	return data;
 }
 
 
 ////////////////////////////////////////////////////////////
 void Packet::clear()
 {
-	m_data.clear();
+	m_buffer.reset();
+	m_offset = 0;
+	m_size = 0;
 	m_readPos = 0;
+	m_readBits = 0;
+	m_writeBits = 0;
 	m_isValid = true;
 }
 
 
+////////////////////////////////////////////////////////////
+void Packet::setEncoding(Encoding encoding)
+{
+	m_encoding = encoding;
+}
+
+
+////////////////////////////////////////////////////////////
+Packet::Encoding Packet::getEncoding() const
+{
+	return m_encoding;
+}
+
+
 ////////////////////////////////////////////////////////////
 const void* Packet::getData() const
 {
-	return !m_data.empty() ? &m_data[0] : NULL;
+	return (m_size > 0) ? getBytes() : NULL;
 }
 
 
 ////////////////////////////////////////////////////////////
 std::size_t Packet::getDataSize() const
 {
-	return m_data.size();
+	return m_size;
 }
 
 
 ////////////////////////////////////////////////////////////
 bool Packet::endOfPacket() const
 {
-	return m_readPos >= m_data.size();
+	return m_readPos >= m_size;
 }
 
 
@@ -139,7 +326,7 @@ Packet& Packet::operator >>(std::int8_t& data)
 {
 	if (checkSize(sizeof(data)))
 	{
-		data = *reinterpret_cast<const std::int8_t*>(&m_data[m_readPos]);
+		data = *reinterpret_cast<const std::int8_t*>(getBytes() + m_readPos);
 		m_readPos += sizeof(data);
 	}
 
@@ -152,7 +339,7 @@ Packet& Packet::operator >>(std::uint8_t& data)
 {
 	if (checkSize(sizeof(data)))
 	{
-		data = *reinterpret_cast<const std::uint8_t*>(&m_data[m_readPos]);
+		data = *reinterpret_cast<const std::uint8_t*>(getBytes() + m_readPos);
 		m_readPos += sizeof(data);
 	}
 
@@ -163,9 +350,18 @@ Packet& Packet::operator >>(std::uint8_t& data)
 ////////////////////////////////////////////////////////////
 Packet& Packet::operator >>(std::int16_t& data)
 {
+	if (m_encoding == Compact)
+	{
+		std::int64_t value;
+		if (readCompact(value, std::numeric_limits<std::int16_t>::min(), std::numeric_limits<std::int16_t>::max()))
+			data = static_cast<std::int16_t>(value);
+
+		return *this;
+	}
+
 	if (checkSize(sizeof(data)))
 	{
-		data = ntohs(*reinterpret_cast<const std::int16_t*>(&m_data[m_readPos]));
+		data = ntohs(*reinterpret_cast<const std::int16_t*>(getBytes() + m_readPos));
 		m_readPos += sizeof(data);
 	}
 
@@ -176,9 +372,18 @@ Packet& Packet::operator >>(std::int16_t& data)
 ////////////////////////////////////////////////////////////
 Packet& Packet::operator >>(std::uint16_t& data)
 {
+	if (m_encoding == Compact)
+	{
+		std::uint64_t value;
+		if (readCompact(value, std::numeric_limits<std::uint16_t>::max()))
+			data = static_cast<std::uint16_t>(value);
+
+		return *this;
+	}
+
 	if (checkSize(sizeof(data)))
 	{
-		data = ntohs(*reinterpret_cast<const std::uint16_t*>(&m_data[m_readPos]));
+		data = ntohs(*reinterpret_cast<const std::uint16_t*>(getBytes() + m_readPos));
 		m_readPos += sizeof(data);
 	}
 
@@ -189,9 +394,18 @@ Packet& Packet::operator >>(std::uint16_t& data)
 ////////////////////////////////////////////////////////////
 Packet& Packet::operator >>(std::int32_t& data)
 {
+	if (m_encoding == Compact)
+	{
+		std::int64_t value;
+		if (readCompact(value, std::numeric_limits<std::int32_t>::min(), std::numeric_limits<std::int32_t>::max()))
+			data = static_cast<std::int32_t>(value);
+
+		return *this;
+	}
+
 	if (checkSize(sizeof(data)))
 	{
-		data = ntohl(*reinterpret_cast<const std::int32_t*>(&m_data[m_readPos]));
+		data = ntohl(*reinterpret_cast<const std::int32_t*>(getBytes() + m_readPos));
 		m_readPos += sizeof(data);
 	}
 
@@ -202,9 +416,18 @@ Packet& Packet::operator >>(std::int32_t& data)
 ////////////////////////////////////////////////////////////
 Packet& Packet::operator >>(std::uint32_t& data)
 {
+	if (m_encoding == Compact)
+	{
+		std::uint64_t value;
+		if (readCompact(value, std::numeric_limits<std::uint32_t>::max()))
+			data = static_cast<std::uint32_t>(value);
+
+		return *this;
+	}
+
 	if (checkSize(sizeof(data)))
 	{
-		data = ntohl(*reinterpret_cast<const std::uint32_t*>(&m_data[m_readPos]));
+		data = ntohl(*reinterpret_cast<const std::uint32_t*>(getBytes() + m_readPos));
 		m_readPos += sizeof(data);
 	}
 
@@ -217,7 +440,7 @@ Packet& Packet::operator >>(float& data)
 {
 	if (checkSize(sizeof(data)))
 	{
-		data = *reinterpret_cast<const float*>(&m_data[m_readPos]);
+		data = *reinterpret_cast<const float*>(getBytes() + m_readPos);
 		m_readPos += sizeof(data);
 	}
 
@@ -230,7 +453,7 @@ Packet& Packet::operator >>(double& data)
 {
 	if (checkSize(sizeof(data)))
 	{
-		data = *reinterpret_cast<const double*>(&m_data[m_readPos]);
+		data = *reinterpret_cast<const double*>(getBytes() + m_readPos);
 		m_readPos += sizeof(data);
 	}
 
@@ -248,7 +471,7 @@ Packet& Packet::operator >>(char* data)
 	if ((length > 0) && checkSize(length))
 	{
 		// Then extract characters
-		std::memcpy(data, &m_data[m_readPos], length);
+		std::memcpy(data, getBytes() + m_readPos, length);
 		data[length] = '\0';
 
 		// Update reading position
@@ -270,7 +493,7 @@ Packet& Packet::operator >>(std::string& data)
 	if ((length > 0) && checkSize(length))
 	{
 		// Then extract characters
-		data.assign(&m_data[m_readPos], length);
+		data.assign(getBytes() + m_readPos, length);
 
 		// Update reading position
 		m_readPos += length;
@@ -287,7 +510,7 @@ Packet& Packet::operator >>(wchar_t* data)
 	std::uint32_t length = 0;
 	*this >> length;
 
-	if ((length > 0) && checkSize(length * sizeof(std::uint32_t)))
+	if ((length > 0) && checkSize(length * (m_encoding == Compact ? 1 : sizeof(std::uint32_t))))
 	{
 		// Then extract characters
 		for (std::uint32_t i = 0; i < length; ++i)
@@ -311,7 +534,7 @@ Packet& Packet::operator >>(std::wstring& data)
 	*this >> length;
 
 	data.clear();
-	if ((length > 0) && checkSize(length * sizeof(std::uint32_t)))
+	if ((length > 0) && checkSize(length * (m_encoding == Compact ? 1 : sizeof(std::uint32_t))))
 	{
 		// Then extract characters
 		for (std::uint32_t i = 0; i < length; ++i)
@@ -331,7 +554,7 @@ Packet& Packet::read(void* data, std::size_t sizeInBytes)
 	if ((sizeInBytes > 0) && checkSize(sizeInBytes))
 	{
 		// Then extract characters
-		std::memcpy(data, &m_data[m_readPos], sizeInBytes);
+		std::memcpy(data, getBytes() + m_readPos, sizeInBytes);
 
 		// Update reading position
 		m_readPos += sizeInBytes;
@@ -368,6 +591,9 @@ Packet& Packet::operator <<(std::uint8_t data)
 ////////////////////////////////////////////////////////////
 Packet& Packet::operator <<(std::int16_t data)
 {
+	if (m_encoding == Compact)
+		return writeZigZag(data);
+
 	std::int16_t toWrite = htons(data);
 	append(&toWrite, sizeof(toWrite));
 	return *this;
@@ -377,6 +603,9 @@ Packet& Packet::operator <<(std::int16_t data)
 ////////////////////////////////////////////////////////////
 Packet& Packet::operator <<(std::uint16_t data)
 {
+	if (m_encoding == Compact)
+		return writeVarint(data);
+
 	std::uint16_t toWrite = htons(data);
 	append(&toWrite, sizeof(toWrite));
 	return *this;
@@ -386,6 +615,9 @@ Packet& Packet::operator <<(std::uint16_t data)
 ////////////////////////////////////////////////////////////
 Packet& Packet::operator <<(std::int32_t data)
 {
+	if (m_encoding == Compact)
+		return writeZigZag(data);
+
 	std::int32_t toWrite = htonl(data);
 	append(&toWrite, sizeof(toWrite));
 	return *this;
@@ -395,6 +627,9 @@ Packet& Packet::operator <<(std::int32_t data)
 ////////////////////////////////////////////////////////////
 Packet& Packet::operator <<(std::uint32_t data)
 {
+	if (m_encoding == Compact)
+		return writeVarint(data);
+
 	std::uint32_t toWrite = htonl(data);
 	append(&toWrite, sizeof(toWrite));
 	return *this;
@@ -479,15 +714,276 @@ Packet& Packet::operator <<(const std::wstring& data)
 }
 
 
+////////////////////////////////////////////////////////////
+Packet& Packet::writeVarint(std::uint64_t data)
+{
+	char bytes[10];
+	std::size_t size = 0;
+	while (data >= 0x80)
+	{
+		bytes[size++] = static_cast<char>((data & 0x7F) | 0x80);
+		data >>= 7;
+	}
+
+	bytes[size++] = static_cast<char>(data);
+	append(bytes, size);
+	return *this;
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::readVarint(std::uint64_t& data)
+{
+	std::uint64_t value = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7)
+	{
+		if (!checkSize(1))
+			return *this;
+
+		std::uint8_t byte = static_cast<std::uint8_t>(getBytes()[m_readPos++]);
+		value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			data = value;
+			return *this;
+		}
+	}
+
+	// Longer than any 64 bits value.
+	m_isValid = false;
+	return *this;
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::writeZigZag(std::int64_t data)
+{
+	return writeVarint((static_cast<std::uint64_t>(data) << 1) ^ static_cast<std::uint64_t>(data >> 63));
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::readZigZag(std::int64_t& data)
+{
+	std::uint64_t value;
+	if (readVarint(value))
+		data = static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+
+	return *this;
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::writeBits(std::uint32_t data, unsigned int count)
+{
+	if (count > 32)
+		count = 32;
+
+	while (count > 0)
+	{
+		// Low bits first, into the free bits of the last byte.
+		unsigned int used = m_writeBits;
+		char* byte = (used == 0) ? extend(1) : extend(0) - 1;
+		if (used == 0)
+			*byte = 0;
+
+		unsigned int bits = std::min(8 - used, count);
+		*byte |= static_cast<char>((data & ((1u << bits) - 1)) << used);
+		data >>= bits;
+		count -= bits;
+		m_writeBits = (used + bits) % 8;
+	}
+
+	return *this;
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::readBits(std::uint32_t& data, unsigned int count)
+{
+	if (count > 32)
+		count = 32;
+
+	std::uint32_t value = 0;
+	unsigned int shift = 0;
+	while (count > 0)
+	{
+		m_isValid = m_isValid && (m_readPos < m_size);
+		if (!m_isValid)
+			return *this;
+
+		std::uint8_t byte = static_cast<std::uint8_t>(getBytes()[m_readPos]);
+		unsigned int bits = std::min(8 - m_readBits, count);
+		value |= static_cast<std::uint32_t>((byte >> m_readBits) & ((1u << bits) - 1)) << shift;
+		shift += bits;
+		count -= bits;
+		m_readBits += bits;
+		if (m_readBits == 8)
+		{
+			m_readBits = 0;
+			m_readPos++;
+		}
+	}
+
+	data = value;
+	return *this;
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::writeQuantized(float data, float min, float max, unsigned int bits)
+{
+	if (bits > 32)
+		bits = 32;
+
+	double steps = std::ldexp(1.0, bits) - 1.0;
+	double ratio = (max > min) ? (static_cast<double>(data) - min) / (static_cast<double>(max) - min) : 0.0;
+	ratio = std::max(0.0, std::min(1.0, ratio));
+	return writeBits(static_cast<std::uint32_t>(std::floor(ratio * steps + 0.5)), bits);
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::readQuantized(float& data, float min, float max, unsigned int bits)
+{
+	if (bits > 32)
+		bits = 32;
+
+	std::uint32_t value;
+	if (readBits(value, bits))
+	{
+		double steps = std::ldexp(1.0, bits) - 1.0;
+		data = static_cast<float>(min + (static_cast<double>(max) - min) * (steps > 0.0 ? value / steps : 0.0));
+	}
+
+	return *this;
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::writeQuantized(const float* data, std::size_t count, float min, float max, unsigned int bits)
+{
+	for (std::size_t i = 0; i < count; i++)
+		writeQuantized(data[i], min, max, bits);
+
+	return *this;
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::readQuantized(float* data, std::size_t count, float min, float max, unsigned int bits)
+{
+	for (std::size_t i = 0; i < count && m_isValid; i++)
+		readQuantized(data[i], min, max, bits);
+
+	return *this;
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::writeShortString(const std::string& data)
+{
+	writeVarint(data.size());
+	append(data.c_str(), data.size());
+	return *this;
+}
+
+
+////////////////////////////////////////////////////////////
+Packet& Packet::readShortString(std::string& data)
+{
+	std::uint64_t length = 0;
+	data.clear();
+	if (readVarint(length) && length > 0 && length <= m_size && checkSize(static_cast<std::size_t>(length)))
+	{
+		data.assign(getBytes() + m_readPos, static_cast<std::size_t>(length));
+		m_readPos += static_cast<std::size_t>(length);
+	}
+
+	return *this;
+}
+
+
 ////////////////////////////////////////////////////////////
 bool Packet::checkSize(std::size_t size)
 {
-	m_isValid = m_isValid && (m_readPos + size <= m_data.size());
+	// Bytes start after the bits read before them.
+	if (m_readBits > 0)
+	{
+		m_readBits = 0;
+		m_readPos++;
+	}
+
+	m_isValid = m_isValid && (m_readPos + size <= m_size);
 
 	return m_isValid;
 }
 
 
+////////////////////////////////////////////////////////////
+bool Packet::readCompact(std::uint64_t& data, std::uint64_t max)
+{
+	std::uint64_t value = 0;
+	if (readVarint(value) && value > max)
+		m_isValid = false;
+
+	if (m_isValid)
+		data = value;
+
+	return m_isValid;
+}
+
+
+////////////////////////////////////////////////////////////
+bool Packet::readCompact(std::int64_t& data, std::int64_t min, std::int64_t max)
+{
+	std::int64_t value = 0;
+	if (readZigZag(value) && (value < min || value > max))
+		m_isValid = false;
+
+	if (m_isValid)
+		data = value;
+
+	return m_isValid;
+}
+
+
+////////////////////////////////////////////////////////////
+const char* Packet::getBytes() const
+{
+	return (m_buffer != nullptr) ? m_buffer->data() + m_offset : m_small;
+}
+
+
+////////////////////////////////////////////////////////////
+char* Packet::extend(std::size_t sizeInBytes)
+{
+	m_writeBits = 0;
+	std::size_t start = m_size;
+	std::size_t size = m_size + sizeInBytes;
+	if (m_buffer == nullptr && size <= SMALL_BUFFER_SIZE)
+	{
+		m_size = size;
+		return m_small + start;
+	}
+
+	// Written in place only while no other packet sees the buffer and the
+	// data reaches its end, otherwise the data moves to a buffer of its own.
+	if (m_buffer == nullptr || m_buffer.use_count() > 1 || m_offset + m_size != m_buffer->size())
+	{
+		std::shared_ptr<std::vector<char>> buffer = AcquireBuffer(size);
+		const char* bytes = getBytes();
+		buffer->assign(bytes, bytes + m_size);
+		m_buffer = std::move(buffer);
+		m_offset = 0;
+	}
+
+	m_buffer->resize(m_offset + size);
+	m_size = size;
+	return m_buffer->data() + m_offset + start;
+}
+
+
 ////////////////////////////////////////////////////////////
 const void* Packet::onSend(std::size_t& size)
 {
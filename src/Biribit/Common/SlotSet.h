@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Fixed size set of room slots stored as 64 bit words. Word-wise operations
+// are plain loops over contiguous memory so the compiler can vectorize them.
+class SlotSet
+{
+public:
+	typedef std::uint64_t word_t;
+	enum { WORD_BITS = 64 };
+
+	SlotSet()
+		: m_size(0)
+	{
+	}
+
+	explicit SlotSet(std::size_t size)
+		: m_words((size + WORD_BITS - 1) / WORD_BITS, 0)
+		, m_size(size)
+	{
+	}
+
+	void resize(std::size_t size)
+	{
+		m_words.resize((size + WORD_BITS - 1) / WORD_BITS, 0);
+		m_size = size;
+		trim();
+	}
+
+	std::size_t size() const
+	{
+		return m_size;
+	}
+
+	void set(std::size_t i)
+	{
+		m_words[i / WORD_BITS] |= word_t(1) << (i % WORD_BITS);
+	}
+
+	void reset(std::size_t i)
+	{
+		m_words[i / WORD_BITS] &= ~(word_t(1) << (i % WORD_BITS));
+	}
+
+	void set_word(std::size_t w, word_t bits)
+	{
+		m_words[w] = bits;
+		if (w + 1 == m_words.size())
+			trim();
+	}
+
+	bool test(std::size_t i) const
+	{
+		return (m_words[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+	}
+
+	void clear()
+	{
+		for (std::size_t w = 0; w < m_words.size(); w++)
+			m_words[w] = 0;
+	}
+
+	bool none() const
+	{
+		word_t acc = 0;
+		for (std::size_t w = 0; w < m_words.size(); w++)
+			acc |= m_words[w];
+
+		return acc == 0;
+	}
+
+	std::size_t count() const
+	{
+		std::size_t n = 0;
+		for (std::size_t w = 0; w < m_words.size(); w++)
+			n += PopCount(m_words[w]);
+
+		return n;
+	}
+
+	SlotSet& operator|=(const SlotSet& other)
+	{
+		std::size_t n = Min(m_words.size(), other.m_words.size());
+		for (std::size_t w = 0; w < n; w++)
+			m_words[w] |= other.m_words[w];
+
+		trim();
+		return *this;
+	}
+
+	SlotSet& operator&=(const SlotSet& other)
+	{
+		std::size_t n = Min(m_words.size(), other.m_words.size());
+		for (std::size_t w = 0; w < n; w++)
+			m_words[w] &= other.m_words[w];
+
+		for (std::size_t w = n; w < m_words.size(); w++)
+			m_words[w] = 0;
+
+		return *this;
+	}
+
+	// Lowest slot not in the set, size() if the set is full.
+	std::size_t find_first_unset() const
+	{
+		for (std::size_t w = 0; w < m_words.size(); w++)
+		{
+			word_t free_bits = ~m_words[w];
+			if (free_bits != 0)
+			{
+				std::size_t i = w * WORD_BITS + CountTrailingZeros(free_bits);
+				return i < m_size ? i : m_size;
+			}
+		}
+
+		return m_size;
+	}
+
+	// Calls f(slot) for every slot in the set, in ascending order.
+	template<typename F> void forEach(F f) const
+	{
+		for (std::size_t w = 0; w < m_words.size(); w++)
+		{
+			word_t bits = m_words[w];
+			while (bits != 0)
+			{
+				f(w * WORD_BITS + CountTrailingZeros(bits));
+				bits &= bits - 1;
+			}
+		}
+	}
+
+	const word_t* words() const
+	{
+		return m_words.data();
+	}
+
+	std::size_t words_count() const
+	{
+		return m_words.size();
+	}
+
+private:
+	std::vector<word_t> m_words;
+	std::size_t m_size;
+
+	void trim()
+	{
+		if (m_size % WORD_BITS != 0)
+			m_words.back() &= (word_t(1) << (m_size % WORD_BITS)) - 1;
+	}
+
+	static std::size_t Min(std::size_t a, std::size_t b)
+	{
+		return a < b ? a : b;
+	}
+
+	static unsigned int CountTrailingZeros(word_t bits)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return (unsigned int) __builtin_ctzll(bits);
+#elif defined(_MSC_VER)
+		unsigned long index;
+		if (_BitScanForward(&index, (unsigned long) bits))
+			return (unsigned int) index;
+
+		_BitScanForward(&index, (unsigned long)(bits >> 32));
+		return (unsigned int) index + 32;
+#else
+		unsigned int n = 0;
+		while ((bits & 1) == 0) {
+			bits >>= 1;
+			n++;
+		}
+
+		return n;
+#endif
+	}
+
+	static unsigned int PopCount(word_t bits)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return (unsigned int) __builtin_popcountll(bits);
+#else
+		unsigned int n = 0;
+		for (; bits != 0; bits &= bits - 1)
+			n++;
+
+		return n;
+#endif
+	}
+};
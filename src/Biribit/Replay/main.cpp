@@ -0,0 +1,475 @@
+#include <Biribit/Client.h>
+#include <Biribit/Common/Capture.h>
+#include <Biribit/Common/SlotSet.h>
+#include <Biribit/Common/Types.h>
+#include <Biribit/Common/BiribitMessageIdentifiers.h>
+
+#include <PacketPriority.h>
+
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include <tclap/CmdLine.h>
+
+// Drives a server with the traffic of a capture. Every captured client gets
+// its own Biribit client, rooms are created again when their first member
+// joins and broadcasts, entries and interests are sent as captured.
+
+typedef std::chrono::steady_clock clock_type;
+
+const std::chrono::milliseconds REPLAY_WAIT_TIMEOUT(5000);
+
+struct ReplayClient
+{
+	unique<Biribit::Client> client;
+	Biribit::Connection::id_t connection;
+	Biribit::Room::id_t room;
+	bool waiting;
+
+	ReplayClient() : connection(Biribit::Connection::UNASSIGNED_ID), room(Biribit::Room::UNASSIGNED_ID), waiting(false) {}
+};
+
+struct ReplayStats
+{
+	std::uint64_t records;
+	std::uint64_t sent_messages;
+	std::uint64_t sent_bytes;
+	std::uint64_t received_broadcasts;
+	std::uint64_t received_bytes;
+	std::uint64_t failed_joins;
+	std::uint64_t joins;
+	clock_type::duration join_latency;
+	clock_type::duration max_join_latency;
+
+	ReplayStats()
+		: records(0), sent_messages(0), sent_bytes(0), received_broadcasts(0), received_bytes(0), failed_joins(0), joins(0)
+		, join_latency(clock_type::duration::zero()), max_join_latency(clock_type::duration::zero()) {}
+};
+
+class Replay
+{
+public:
+	Replay(const std::string& host, unsigned short port, const std::string& password)
+		: m_host(host), m_port(port), m_password(password)
+	{
+	}
+
+	void Play(const CaptureRecord& record);
+	void Pump();
+	void DisconnectAll();
+	const ReplayStats& Stats() const { return m_stats; }
+
+private:
+	ReplayClient* GetClient(std::uint32_t client_id);
+	bool Wait(ReplayClient& replay);
+	void Join(ReplayClient& replay, const CaptureRecord& record);
+	void Leave(ReplayClient& replay, const CaptureRecord& record);
+	void Broadcast(ReplayClient& replay, const std::string& message);
+	void Interests(ReplayClient& replay, const std::string& message);
+
+	std::string m_host;
+	unsigned short m_port;
+	std::string m_password;
+
+	std::map<std::uint32_t, ReplayClient> m_clients;
+	std::map<std::uint32_t, Biribit::Room::id_t> m_rooms;
+	std::map<std::uint32_t, std::uint32_t> m_members;
+	ReplayStats m_stats;
+};
+
+namespace
+{
+	Biribit::Packet::ReliabilityBitmask ReliabilityMask(std::uint8_t reliability)
+	{
+		switch (reliability)
+		{
+		case RELIABLE:
+			return Biribit::Packet::Reliable;
+		case RELIABLE_ORDERED:
+			return Biribit::Packet::ReliableOrdered;
+		case UNRELIABLE_SEQUENCED:
+			return Biribit::Packet::UnreliableSequenced;
+		case RELIABLE_SEQUENCED:
+			return Biribit::Packet::ReliableSequenced;
+		default:
+			return Biribit::Packet::Unreliable;
+		}
+	}
+
+	// Integers in RakNet bit streams are big endian.
+	template<typename T> bool ReadBigEndian(const std::string& data, std::size_t& offset, T& value)
+	{
+		if (offset + sizeof(T) > data.size())
+			return false;
+
+		value = 0;
+		for (std::size_t i = 0; i < sizeof(T); i++)
+			value = (T) ((value << 8) | (std::uint8_t) data[offset + i]);
+
+		offset += sizeof(T);
+		return true;
+	}
+}
+
+ReplayClient* Replay::GetClient(std::uint32_t client_id)
+{
+	ReplayClient& replay = m_clients[client_id];
+	if (replay.client != nullptr)
+		return (replay.connection != Biribit::Connection::UNASSIGNED_ID) ? &replay : nullptr;
+
+	replay.client = unique<Biribit::Client>(new Biribit::Client());
+	replay.client->Connect(m_host.c_str(), m_port, m_password.empty() ? nullptr : m_password.c_str());
+	replay.waiting = true;
+	if (!Wait(replay)) {
+		std::cerr << "warning: client " << client_id << " couldn't connect" << std::endl;
+		return nullptr;
+	}
+
+	return &replay;
+}
+
+bool Replay::Wait(ReplayClient& replay)
+{
+	clock_type::time_point deadline = clock_type::now() + REPLAY_WAIT_TIMEOUT;
+	while (replay.waiting && clock_type::now() < deadline) {
+		Pump();
+		if (replay.waiting)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	bool done = !replay.waiting;
+	replay.waiting = false;
+	return done;
+}
+
+void Replay::Pump()
+{
+	for (auto it = m_clients.begin(); it != m_clients.end(); it++)
+	{
+		ReplayClient& replay = it->second;
+		if (replay.client == nullptr)
+			continue;
+
+		std::unique_ptr<Biribit::Event> evnt;
+		while ((evnt = replay.client->PullEvent()) != nullptr)
+		{
+			switch (evnt->id)
+			{
+			case Biribit::EVENT_CONNECTION_ID:
+			{
+				Biribit::ConnectionEvent* connection = (Biribit::ConnectionEvent*) evnt.get();
+				if (connection->type == Biribit::ConnectionEvent::TYPE_NEW_CONNECTION) {
+					replay.connection = connection->connection.id;
+					replay.waiting = false;
+				}
+				else if (connection->type == Biribit::ConnectionEvent::TYPE_DISCONNECTION) {
+					replay.connection = Biribit::Connection::UNASSIGNED_ID;
+				}
+				break;
+			}
+			case Biribit::EVENT_JOINED_ROOM_ID:
+				replay.room = ((Biribit::JoinedRoomEvent*) evnt.get())->room_id;
+				replay.waiting = false;
+				break;
+			case Biribit::EVENT_BROADCAST_ID:
+				m_stats.received_broadcasts++;
+				m_stats.received_bytes += ((Biribit::BroadcastEvent*) evnt.get())->data.getDataSize();
+				break;
+			case Biribit::EVENT_ERROR_ID:
+			{
+				// Refused joins answer with an error only.
+				Biribit::ErrorId which = ((Biribit::ErrorEvent*) evnt.get())->which;
+				if (which >= Biribit::WARN_CANNOT_CREATE_ROOM_WITHOUT_APPID && which <= Biribit::WARN_CANNOT_JOIN_TO_MIGRATING_ROOM)
+					replay.waiting = false;
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+}
+
+void Replay::Play(const CaptureRecord& record)
+{
+	m_stats.records++;
+	if (record.type == CaptureRecord::CAPTURE_DISCONNECT)
+	{
+		auto it = m_clients.find(record.client_id);
+		if (it != m_clients.end()) {
+			if (it->second.client != nullptr)
+				it->second.client->Disconnect();
+			m_clients.erase(it);
+		}
+		return;
+	}
+
+	ReplayClient* replay = GetClient(record.client_id);
+	if (replay == nullptr)
+		return;
+
+	switch (record.type)
+	{
+	case CaptureRecord::CAPTURE_CLIENT:
+	{
+		std::size_t separator = record.data.find('\0');
+		std::string name = record.data.substr(0, separator);
+		std::string appid = (separator != std::string::npos) ? record.data.substr(separator + 1) : "";
+		replay->client->SetLocalClientParameters(replay->connection, Biribit::ClientParameters(name, appid));
+		break;
+	}
+	case CaptureRecord::CAPTURE_JOIN:
+		Join(*replay, record);
+		break;
+	case CaptureRecord::CAPTURE_LEAVE:
+		Leave(*replay, record);
+		break;
+	case CaptureRecord::CAPTURE_BROADCAST:
+		Broadcast(*replay, record.data);
+		break;
+	case CaptureRecord::CAPTURE_ENTRY:
+		replay->client->SendEntry(replay->connection, record.data.data(), (unsigned int) record.data.size());
+		m_stats.sent_messages++;
+		m_stats.sent_bytes += record.data.size();
+		break;
+	case CaptureRecord::CAPTURE_INTERESTS:
+		Interests(*replay, record.data);
+		break;
+	default:
+		break;
+	}
+}
+
+void Replay::Join(ReplayClient& replay, const CaptureRecord& record)
+{
+	std::uint64_t slots_count = 0;
+	CaptureReadVarint(record.data, slots_count);
+
+	clock_type::time_point started = clock_type::now();
+	auto it = m_rooms.find(record.room_id);
+	replay.room = Biribit::Room::UNASSIGNED_ID;
+	replay.waiting = true;
+	if (it != m_rooms.end())
+		replay.client->JoinRoom(replay.connection, it->second, record.slot);
+	else
+		replay.client->CreateRoom(replay.connection, (Biribit::Room::slot_id_t) slots_count, record.slot);
+
+	if (!Wait(replay) || replay.room == Biribit::Room::UNASSIGNED_ID) {
+		m_stats.failed_joins++;
+		return;
+	}
+
+	clock_type::duration latency = clock_type::now() - started;
+	m_stats.joins++;
+	m_stats.join_latency += latency;
+	m_stats.max_join_latency = std::max(m_stats.max_join_latency, latency);
+	m_rooms[record.room_id] = replay.room;
+	m_members[record.room_id]++;
+}
+
+void Replay::Leave(ReplayClient& replay, const CaptureRecord& record)
+{
+	if (replay.room == Biribit::Room::UNASSIGNED_ID)
+		return;
+
+	replay.waiting = true;
+	replay.client->JoinRoom(replay.connection, Biribit::Room::UNASSIGNED_ID);
+	Wait(replay);
+	replay.room = Biribit::Room::UNASSIGNED_ID;
+
+	// The server closes empty rooms, the next join creates it again.
+	auto it = m_members.find(record.room_id);
+	if (it != m_members.end() && --it->second == 0) {
+		m_members.erase(it);
+		m_rooms.erase(record.room_id);
+	}
+}
+
+void Replay::Broadcast(ReplayClient& replay, const std::string& message)
+{
+	std::size_t offset = 0;
+	std::uint8_t msgId, reliability, stream = 0;
+	if (!ReadBigEndian(message, offset, msgId))
+		return;
+
+	if (msgId == ID_SEND_BROADCAST_ON_STREAM && (!ReadBigEndian(message, offset, stream) || !ReadBigEndian(message, offset, msgId)))
+		return;
+
+	if (!ReadBigEndian(message, offset, reliability))
+		return;
+
+	Biribit::Packet::ReliabilityBitmask mask = ReliabilityMask(reliability);
+	switch (msgId)
+	{
+	case ID_SEND_BROADCAST_TO_ROOM:
+		replay.client->SendBroadcast(replay.connection, message.data() + offset, (unsigned int) (message.size() - offset), mask, stream);
+		break;
+	case ID_SEND_BROADCAST_TO_OTHERS:
+		replay.client->SendBroadcastToOthers(replay.connection, message.data() + offset, (unsigned int) (message.size() - offset), mask, stream);
+		break;
+	case ID_SEND_BROADCAST_TO_INTEREST:
+	{
+		std::uint32_t key;
+		if (!ReadBigEndian(message, offset, key))
+			return;
+
+		replay.client->SendBroadcastToInterest(replay.connection, key, message.data() + offset, (unsigned int) (message.size() - offset), mask, stream);
+		break;
+	}
+	case ID_SEND_BROADCAST_TO_SLOTS:
+	{
+		std::uint16_t mask_words;
+		if (!ReadBigEndian(message, offset, mask_words))
+			return;
+
+		std::vector<Biribit::Room::slot_id_t> slots;
+		for (std::uint16_t w = 0; w < mask_words; w++)
+		{
+			SlotSet::word_t bits;
+			if (!ReadBigEndian(message, offset, bits))
+				return;
+
+			for (unsigned int bit = 0; bit < SlotSet::WORD_BITS; bit++)
+				if ((bits >> bit) & 1)
+					slots.push_back((Biribit::Room::slot_id_t) (w * SlotSet::WORD_BITS + bit));
+		}
+
+		replay.client->SendBroadcastToSlots(replay.connection, slots, message.data() + offset, (unsigned int) (message.size() - offset), mask, stream);
+		break;
+	}
+	default:
+		return;
+	}
+
+	m_stats.sent_messages++;
+	m_stats.sent_bytes += message.size() - offset;
+}
+
+void Replay::Interests(ReplayClient& replay, const std::string& message)
+{
+	Proto::RoomInterests proto_interests;
+	if (!proto_interests.ParseFromString(message))
+		return;
+
+	if (proto_interests.has_reset() && proto_interests.reset()) {
+		replay.client->SetInterests(replay.connection, std::vector<Biribit::Room::interest_t>(proto_interests.add().begin(), proto_interests.add().end()));
+		return;
+	}
+
+	for (int i = 0; i < proto_interests.remove_size(); i++)
+		replay.client->RemoveInterest(replay.connection, proto_interests.remove(i));
+
+	for (int i = 0; i < proto_interests.add_size(); i++)
+		replay.client->AddInterest(replay.connection, proto_interests.add(i));
+}
+
+void Replay::DisconnectAll()
+{
+	for (auto it = m_clients.begin(); it != m_clients.end(); it++)
+		if (it->second.client != nullptr)
+			it->second.client->Disconnect();
+
+	m_clients.clear();
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		TCLAP::CmdLine cmd("Biribit capture replay", ' ', "0.1");
+
+		TCLAP::UnlabeledValueArg<std::string> captureArg("capture", "Capture file written by BiribitServer --capture", true, "", "file");
+		cmd.add(captureArg);
+
+		TCLAP::ValueArg<std::string> addrArg("a", "address", "Server address", false, "localhost", "address");
+		cmd.add(addrArg);
+
+		TCLAP::ValueArg<std::string> portArg("p", "port", "Server port", false, "", "port");
+		cmd.add(portArg);
+
+		TCLAP::ValueArg<std::string> passArg("w", "password", "Server password", false, "", "password");
+		cmd.add(passArg);
+
+		TCLAP::ValueArg<std::string> speedArg("s", "speed", "Replay speed, 1 plays at the captured pace and 0 as fast as the server takes it", false, "1", "factor");
+		cmd.add(speedArg);
+
+		cmd.parse(argc, argv);
+
+		int port = 0;
+		std::stringstream ssPort(portArg.getValue());
+		ssPort >> port;
+
+		float speed = 1.0f;
+		std::stringstream ssSpeed(speedArg.getValue());
+		if (!(ssSpeed >> speed) || speed < 0.0f) {
+			std::cerr << "error: invalid speed " << speedArg.getValue() << std::endl;
+			return 1;
+		}
+
+		CaptureReader reader;
+		if (!reader.Open(captureArg.getValue())) {
+			std::cerr << "error: " << captureArg.getValue() << " is not a capture file" << std::endl;
+			return 1;
+		}
+
+		Replay replay(addrArg.getValue(), (unsigned short) port, passArg.getValue());
+		CaptureRecord record;
+		clock_type::duration max_lag = clock_type::duration::zero();
+		std::uint64_t captured_ms = 0;
+		clock_type::time_point started = clock_type::now();
+		while (reader.Read(record))
+		{
+			if (speed > 0.0f)
+			{
+				clock_type::time_point due = started + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double, std::milli>(record.time / speed));
+				while (clock_type::now() < due) {
+					replay.Pump();
+					std::this_thread::sleep_for(std::min<clock_type::duration>(due - clock_type::now(), std::chrono::milliseconds(1)));
+				}
+			}
+
+			clock_type::duration lag = clock_type::now() - started - std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double, std::milli>(speed > 0.0f ? record.time / speed : 0.0));
+			replay.Play(record);
+			replay.Pump();
+			captured_ms = record.time;
+			if (speed > 0.0f)
+				max_lag = std::max(max_lag, lag);
+		}
+
+		// Let the last messages arrive before counting them.
+		clock_type::time_point finished = clock_type::now();
+		while (clock_type::now() - finished < std::chrono::seconds(1)) {
+			replay.Pump();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		replay.DisconnectAll();
+
+		const ReplayStats& played = replay.Stats();
+		double seconds = std::chrono::duration<double>(finished - started).count();
+		if (seconds <= 0.0)
+			seconds = 1e-3;
+
+		std::cout << "Records: " << played.records << " over " << captured_ms / 1000.0 << "s captured, replayed in " << seconds << "s" << std::endl;
+		std::cout << "Sent: " << played.sent_messages << " messages, " << played.sent_messages / seconds << " msg/s, " << played.sent_bytes / seconds << " bytes/s" << std::endl;
+		std::cout << "Received: " << played.received_broadcasts << " broadcasts, " << played.received_broadcasts / seconds << " msg/s, " << played.received_bytes / seconds << " bytes/s" << std::endl;
+		if (played.joins > 0)
+			std::cout << "Joins: " << played.joins << ", " << played.failed_joins << " failed, latency avg "
+				<< std::chrono::duration<double, std::milli>(played.join_latency).count() / played.joins << "ms max "
+				<< std::chrono::duration<double, std::milli>(played.max_join_latency).count() << "ms" << std::endl;
+		if (speed > 0.0f)
+			std::cout << "Max lag behind the capture: " << std::chrono::duration<double, std::milli>(max_lag).count() << "ms" << std::endl;
+	}
+	catch (TCLAP::ArgException &e)
+	{
+		std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include <Biribit/Server/BiribitServer.h>
+#include <Biribit/Server/RakNetServer.h>
+
+namespace Biribit
+{
+
+ServerStats::ServerStats()
+	: clients(0)
+	, local_clients(0)
+	, rooms(0)
+	, plugins(0)
+	, relayed_bytes_per_second(0)
+{
+}
+
+Server::Server() : m_impl(new RakNetServer())
+{
+}
+
+Server::~Server()
+{
+	m_impl->Close();
+	delete m_impl;
+}
+
+void Server::AddNode(const char* host, unsigned short port)
+{
+	m_impl->AddNode(host, port);
+}
+
+void Server::SetMigrationThreshold(std::uint32_t relayed_bytes_per_second)
+{
+	m_impl->SetMigrationThreshold(relayed_bytes_per_second);
+}
+
+void Server::SetStandby(const char* host, unsigned short port)
+{
+	m_impl->SetStandby(host, port);
+}
+
+void Server::SetPrimary(const char* host, unsigned short port)
+{
+	m_impl->SetPrimary(host, port);
+}
+
+void Server::SetOrigin(const char* host, unsigned short port)
+{
+	m_impl->SetOrigin(host, port);
+}
+
+void Server::AddRelay(const char* host, unsigned short port)
+{
+	m_impl->AddRelay(host, port);
+}
+
+void Server::SetHandoffFile(const std::string& path)
+{
+	m_impl->SetHandoffFile(path);
+}
+
+void Server::SetCaptureFile(const std::string& path)
+{
+	m_impl->SetCaptureFile(path);
+}
+
+bool Server::SetRateLimit(const std::string& appid, const std::string& traffic, float messages_per_second, float bytes_per_second)
+{
+	return m_impl->SetRateLimit(appid, traffic, messages_per_second, bytes_per_second);
+}
+
+void Server::SetEgressBudget(const std::string& appid, float bytes_per_second, float weight)
+{
+	m_impl->SetEgressBudget(appid, bytes_per_second, weight);
+}
+
+void Server::SetAppQuota(const std::string& appid, std::uint32_t max_rooms, std::uint32_t max_clients, std::size_t max_journal_bytes)
+{
+	m_impl->SetAppQuota(appid, max_rooms, max_clients, max_journal_bytes);
+}
+
+void Server::SetJournalBudget(std::size_t room_bytes, std::size_t total_bytes, const std::string& spill_dir)
+{
+	m_impl->SetJournalBudget(room_bytes, total_bytes, spill_dir);
+}
+
+void Server::SetSpectatorRate(float updates_per_second)
+{
+	m_impl->SetSpectatorRate(updates_per_second);
+}
+
+bool Server::LoadPlugin(const std::string& appid, const std::string& path)
+{
+	return m_impl->LoadPlugin(appid, path);
+}
+
+bool Server::RegisterPlugin(const std::string& appid, const std::string& name, brbt_PluginLoad load)
+{
+	return m_impl->RegisterPlugin(appid, name, load);
+}
+
+bool Server::Run(unsigned short port, const char* name, const char* password, unsigned int max_clients)
+{
+	return m_impl->Run(port, name, password, max_clients);
+}
+
+bool Server::IsRunning()
+{
+	return m_impl->isRunning();
+}
+
+bool Server::Handoff()
+{
+	return m_impl->Handoff();
+}
+
+bool Server::Close()
+{
+	return m_impl->Close();
+}
+
+ServerStats Server::GetStats()
+{
+	return m_impl->GetStats();
+}
+
+std::shared_ptr<LocalLink> Server::ConnectLocal()
+{
+	return m_impl->ConnectLocal();
+}
+
+}
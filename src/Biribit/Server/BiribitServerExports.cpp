@@ -0,0 +1,130 @@
+#include <Biribit/Server/BiribitServerExports.h>
+#include <Biribit/Server/BiribitServer.h>
+
+#include <string>
+
+namespace
+{
+	Biribit::Server* GetServer(brbt_Server server)
+	{
+		return (Biribit::Server*) server;
+	}
+
+	std::string ToString(const char* str)
+	{
+		return (str != nullptr) ? std::string(str) : std::string();
+	}
+}
+
+brbt_Server brbt_CreateServer()
+{
+	return (brbt_Server) new Biribit::Server();
+}
+
+void brbt_DeleteServer(brbt_Server server)
+{
+	delete GetServer(server);
+}
+
+//---------------------------------------------------------------------------//
+
+int brbt_RunServer(brbt_Server server, unsigned short port, const char* name, const char* password, unsigned int max_clients)
+{
+	return GetServer(server)->Run(port, name, password, max_clients) ? 1 : 0;
+}
+
+int brbt_IsServerRunning(brbt_Server server)
+{
+	return GetServer(server)->IsRunning() ? 1 : 0;
+}
+
+int brbt_CloseServer(brbt_Server server)
+{
+	return GetServer(server)->Close() ? 1 : 0;
+}
+
+//---------------------------------------------------------------------------//
+
+void brbt_GetServerStats(brbt_Server server, brbt_ServerStats* stats)
+{
+	Biribit::ServerStats server_stats = GetServer(server)->GetStats();
+	stats->clients = server_stats.clients;
+	stats->local_clients = server_stats.local_clients;
+	stats->rooms = server_stats.rooms;
+	stats->plugins = server_stats.plugins;
+	stats->relayed_bytes_per_second = server_stats.relayed_bytes_per_second;
+}
+
+//---------------------------------------------------------------------------//
+
+void brbt_ServerAddNode(brbt_Server server, const char* host, unsigned short port)
+{
+	GetServer(server)->AddNode(host, port);
+}
+
+void brbt_ServerSetMigrationThreshold(brbt_Server server, unsigned int relayed_bytes_per_second)
+{
+	GetServer(server)->SetMigrationThreshold(relayed_bytes_per_second);
+}
+
+void brbt_ServerSetStandby(brbt_Server server, const char* host, unsigned short port)
+{
+	GetServer(server)->SetStandby(host, port);
+}
+
+void brbt_ServerSetPrimary(brbt_Server server, const char* host, unsigned short port)
+{
+	GetServer(server)->SetPrimary(host, port);
+}
+
+void brbt_ServerSetOrigin(brbt_Server server, const char* host, unsigned short port)
+{
+	GetServer(server)->SetOrigin(host, port);
+}
+
+void brbt_ServerAddRelay(brbt_Server server, const char* host, unsigned short port)
+{
+	GetServer(server)->AddRelay(host, port);
+}
+
+void brbt_ServerSetCaptureFile(brbt_Server server, const char* path)
+{
+	GetServer(server)->SetCaptureFile(ToString(path));
+}
+
+int brbt_ServerSetRateLimit(brbt_Server server, const char* appid, const char* traffic, float messages_per_second, float bytes_per_second)
+{
+	return GetServer(server)->SetRateLimit(ToString(appid), ToString(traffic), messages_per_second, bytes_per_second) ? 1 : 0;
+}
+
+void brbt_ServerSetEgressBudget(brbt_Server server, const char* appid, float bytes_per_second, float weight)
+{
+	GetServer(server)->SetEgressBudget(ToString(appid), bytes_per_second, weight);
+}
+
+void brbt_ServerSetAppQuota(brbt_Server server, const char* appid, unsigned int max_rooms, unsigned int max_clients, unsigned int max_journal_bytes)
+{
+	GetServer(server)->SetAppQuota(ToString(appid), max_rooms, max_clients, max_journal_bytes);
+}
+
+void brbt_ServerSetJournalBudget(brbt_Server server, unsigned int room_bytes, unsigned int total_bytes, const char* spill_dir)
+{
+	GetServer(server)->SetJournalBudget(room_bytes, total_bytes, ToString(spill_dir));
+}
+
+void brbt_ServerSetSpectatorRate(brbt_Server server, float updates_per_second)
+{
+	GetServer(server)->SetSpectatorRate(updates_per_second);
+}
+
+//---------------------------------------------------------------------------//
+
+int brbt_ServerRegisterPlugin(brbt_Server server, const char* appid, const char* name, brbt_PluginLoad load)
+{
+	return GetServer(server)->RegisterPlugin(ToString(appid), ToString(name), load) ? 1 : 0;
+}
+
+int brbt_ServerLoadPlugin(brbt_Server server, const char* appid, const char* path)
+{
+	return GetServer(server)->LoadPlugin(ToString(appid), ToString(path)) ? 1 : 0;
+}
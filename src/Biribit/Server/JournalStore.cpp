@@ -0,0 +1,192 @@
+#include <Biribit/Server/JournalStore.h>
+#include <Biribit/BiribitConfig.h>
+#include <Biribit/Common/PrintLog.h>
+
+#include <sstream>
+
+#if !defined(SYSTEM_WINDOWS)
+#include <sys/mman.h>
+#endif
+
+std::string JournalStore::s_spillDirectory;
+unsigned int JournalStore::s_spillFiles = 0;
+
+// Spill files grow past 2 GiB, where a long offset falls short on Windows.
+static bool SeekFile(FILE* file, std::uint64_t offset)
+{
+#if defined(SYSTEM_WINDOWS)
+	return _fseeki64(file, (__int64) offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t) offset, SEEK_SET) == 0;
+#endif
+}
+
+JournalStore::Entry::Entry()
+	: from_slot(0)
+{
+}
+
+JournalStore::JournalStore()
+	: m_hot(1)
+	, m_hotBytes(0)
+	, m_file(nullptr)
+	, m_fileSize(0)
+	, m_map(nullptr)
+	, m_mapSize(0)
+{
+}
+
+JournalStore::~JournalStore()
+{
+	Unmap();
+	if (m_file != nullptr)
+	{
+		std::fclose(m_file);
+		if (!m_path.empty())
+			std::remove(m_path.c_str());
+	}
+}
+
+std::size_t JournalStore::Size() const
+{
+	return m_cold.size() + m_hot.size();
+}
+
+std::size_t JournalStore::HotBytes() const
+{
+	return m_hotBytes;
+}
+
+void JournalStore::Append(const Entry& entry)
+{
+	m_hot.push_back(entry);
+	m_hotBytes += entry.data.size();
+}
+
+bool JournalStore::Read(std::size_t id, Entry& entry)
+{
+	if (id >= Size())
+		return false;
+
+	if (id >= m_cold.size()) {
+		entry = m_hot[id - m_cold.size()];
+		return true;
+	}
+
+	const ColdEntry& cold = m_cold[id];
+	entry.from_slot = cold.from_slot;
+	if (cold.size == 0) {
+		entry.data.clear();
+		return true;
+	}
+
+	const char* map = Map(cold.offset + cold.size);
+	if (map != nullptr) {
+		entry.data.assign(map + cold.offset, cold.size);
+		return true;
+	}
+
+	// No mapping available, read it through the file.
+	entry.data.resize(cold.size);
+	return SeekFile(m_file, cold.offset)
+		&& std::fread(&entry.data[0], 1, cold.size, m_file) == cold.size;
+}
+
+std::size_t JournalStore::Spill(std::size_t max_hot_bytes)
+{
+	if (m_hotBytes <= max_hot_bytes || m_hot.size() <= 1 || !OpenFile())
+		return 0;
+
+	// Past m_fileSize there may be the leftover of a failed write.
+	std::size_t released = 0;
+	if (!SeekFile(m_file, m_fileSize))
+		return 0;
+
+	while (m_hotBytes > max_hot_bytes && m_hot.size() > 1)
+	{
+		Entry& entry = m_hot.front();
+		ColdEntry cold;
+		cold.offset = m_fileSize;
+		cold.from_slot = entry.from_slot;
+		cold.size = (std::uint32_t) entry.data.size();
+		if (cold.size > 0 && std::fwrite(entry.data.data(), 1, cold.size, m_file) != cold.size)
+			break;
+
+		m_fileSize += cold.size;
+		m_cold.push_back(cold);
+		m_hotBytes -= entry.data.size();
+		released += entry.data.size();
+		m_hot.pop_front();
+	}
+
+	std::fflush(m_file);
+	return released;
+}
+
+void JournalStore::SetSpillDirectory(const std::string& dir)
+{
+	s_spillDirectory = dir;
+}
+
+bool JournalStore::OpenFile()
+{
+	if (m_file != nullptr)
+		return true;
+
+	if (s_spillDirectory.empty())
+	{
+		m_file = std::tmpfile();
+	}
+	else
+	{
+		std::stringstream path;
+		path << s_spillDirectory << "/journal-" << s_spillFiles++ << ".spill";
+		m_path = path.str();
+		m_file = std::fopen(m_path.c_str(), "w+b");
+#if !defined(SYSTEM_WINDOWS)
+		// Unlinked right away, the file lives as long as it is open.
+		if (m_file != nullptr) {
+			std::remove(m_path.c_str());
+			m_path.clear();
+		}
+#endif
+	}
+
+	if (m_file == nullptr) {
+		printLog("Unable to open a journal spill file in \"%s\". Journal stays in memory.", s_spillDirectory.c_str());
+		m_path.clear();
+		return false;
+	}
+
+	return true;
+}
+
+const char* JournalStore::Map(std::uint64_t end)
+{
+#if defined(SYSTEM_WINDOWS)
+	return nullptr;
+#else
+	if (end <= m_mapSize)
+		return m_map;
+
+	Unmap();
+	void* map = mmap(nullptr, (std::size_t) m_fileSize, PROT_READ, MAP_SHARED, fileno(m_file), 0);
+	if (map == MAP_FAILED)
+		return nullptr;
+
+	m_map = static_cast<const char*>(map);
+	m_mapSize = m_fileSize;
+	return m_map;
+#endif
+}
+
+void JournalStore::Unmap()
+{
+#if !defined(SYSTEM_WINDOWS)
+	if (m_map != nullptr)
+		munmap(const_cast<char*>(m_map), (std::size_t) m_mapSize);
+#endif
+
+	m_map = nullptr;
+	m_mapSize = 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+
+// Room journal split in a cold prefix, spilled to a file and memory mapped
+// back only when read, and a hot tail kept in memory.
+class JournalStore
+{
+public:
+	struct Entry
+	{
+		typedef std::uint32_t id_t;
+		enum { UNASSIGNED_ID = 0 };
+
+		std::uint32_t from_slot;
+		std::string data;
+
+		Entry();
+	};
+
+	// Starts with the unassigned entry, like an empty room journal.
+	JournalStore();
+	~JournalStore();
+
+	std::size_t Size() const;
+	std::size_t HotBytes() const;
+
+	void Append(const Entry& entry);
+	bool Read(std::size_t id, Entry& entry);
+
+	// Moves the oldest hot entries to the spill file until at most
+	// max_hot_bytes remain in memory. The last entry always stays hot.
+	// Returns the bytes released.
+	std::size_t Spill(std::size_t max_hot_bytes);
+
+	// Directory for spill files, the system temporary file when empty.
+	static void SetSpillDirectory(const std::string& dir);
+
+private:
+	struct ColdEntry
+	{
+		std::uint64_t offset;
+		std::uint32_t from_slot;
+		std::uint32_t size;
+	};
+
+	std::vector<ColdEntry> m_cold;
+	std::deque<Entry> m_hot;
+	std::size_t m_hotBytes;
+
+	std::FILE* m_file;
+	std::string m_path;
+	std::uint64_t m_fileSize;
+
+	const char* m_map;
+	std::uint64_t m_mapSize;
+
+	bool OpenFile();
+	const char* Map(std::uint64_t end);
+	void Unmap();
+
+	JournalStore(const JournalStore&);
+	JournalStore& operator=(const JournalStore&);
+
+	static std::string s_spillDirectory;
+	static unsigned int s_spillFiles;
+};
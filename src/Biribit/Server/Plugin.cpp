@@ -0,0 +1,161 @@
+#include <Biribit/Server/Plugin.h>
+#include <Biribit/BiribitConfig.h>
+#include <Biribit/Common/PrintLog.h>
+
+#include <cstring>
+
+#if defined(SYSTEM_WINDOWS)
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace
+{
+	void* OpenLibrary(const std::string& path)
+	{
+#if defined(SYSTEM_WINDOWS)
+		return (void*) LoadLibraryA(path.c_str());
+#else
+		return dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+	}
+
+	void* FindSymbol(void* library, const char* name)
+	{
+#if defined(SYSTEM_WINDOWS)
+		return (void*) GetProcAddress((HMODULE) library, name);
+#else
+		return dlsym(library, name);
+#endif
+	}
+
+	void CloseLibrary(void* library)
+	{
+#if defined(SYSTEM_WINDOWS)
+		FreeLibrary((HMODULE) library);
+#else
+		dlclose(library);
+#endif
+	}
+
+	const char* LibraryError()
+	{
+#if defined(SYSTEM_WINDOWS)
+		return "LoadLibrary failed";
+#else
+		const char* error = dlerror();
+		return (error != nullptr) ? error : "unknown error";
+#endif
+	}
+}
+
+Plugin::Plugin()
+	: m_library(nullptr)
+{
+	std::memset(&m_plugin, 0, sizeof(m_plugin));
+}
+
+Plugin::~Plugin()
+{
+	if (m_plugin.Unload != nullptr)
+		m_plugin.Unload(m_plugin.user);
+
+	if (m_library != nullptr)
+		CloseLibrary(m_library);
+}
+
+unique<Plugin> Plugin::Load(const std::string& path, const std::string& appid, const brbt_PluginHost* host)
+{
+	void* library = OpenLibrary(path);
+	if (library == nullptr) {
+		printLog("Unable to load plugin \"%s\": %s.", path.c_str(), LibraryError());
+		return nullptr;
+	}
+
+	brbt_PluginLoad load = (brbt_PluginLoad) FindSymbol(library, BRBT_PLUGIN_LOAD_SYMBOL);
+	if (load == nullptr) {
+		printLog("Plugin \"%s\" doesn't export %s.", path.c_str(), BRBT_PLUGIN_LOAD_SYMBOL);
+		CloseLibrary(library);
+		return nullptr;
+	}
+
+	unique<Plugin> plugin = Create(load, path, appid, host);
+	if (plugin == nullptr) {
+		CloseLibrary(library);
+		return nullptr;
+	}
+
+	plugin->m_library = library;
+	return plugin;
+}
+
+unique<Plugin> Plugin::Create(brbt_PluginLoad load, const std::string& name, const std::string& appid, const brbt_PluginHost* host)
+{
+	unique<Plugin> plugin(new Plugin());
+	plugin->m_path = name;
+	if (load == nullptr || load(host, appid.c_str(), &plugin->m_plugin) == 0) {
+		printLog("Plugin \"%s\" refused to load for appid \"%s\".", name.c_str(), appid.c_str());
+		return nullptr;
+	}
+
+	return plugin;
+}
+
+const std::string& Plugin::Path() const
+{
+	return m_path;
+}
+
+void Plugin::RoomCreated(unsigned int room_id, unsigned int slots_count)
+{
+	if (m_plugin.RoomCreated != nullptr)
+		m_plugin.RoomCreated(m_plugin.user, room_id, slots_count);
+}
+
+void Plugin::RoomClosed(unsigned int room_id)
+{
+	if (m_plugin.RoomClosed != nullptr)
+		m_plugin.RoomClosed(m_plugin.user, room_id);
+}
+
+void Plugin::ClientJoined(unsigned int room_id, unsigned int slot, const std::string& name)
+{
+	if (m_plugin.ClientJoined != nullptr)
+		m_plugin.ClientJoined(m_plugin.user, room_id, slot, name.c_str());
+}
+
+void Plugin::ClientLeft(unsigned int room_id, unsigned int slot)
+{
+	if (m_plugin.ClientLeft != nullptr)
+		m_plugin.ClientLeft(m_plugin.user, room_id, slot);
+}
+
+brbt_PluginVerdict Plugin::BroadcastReceived(brbt_PluginBroadcast& broadcast)
+{
+	if (m_plugin.BroadcastReceived == nullptr)
+		return BRBT_PLUGIN_PASS;
+
+	brbt_PluginVerdict verdict = m_plugin.BroadcastReceived(m_plugin.user, &broadcast);
+	if (verdict == BRBT_PLUGIN_REPLACE && broadcast.replace_data == nullptr && broadcast.replace_size > 0)
+		return BRBT_PLUGIN_CONSUME;
+
+	return verdict;
+}
+
+void Plugin::EntryAppended(unsigned int room_id, unsigned int entry_id, unsigned int from_slot, const void* data, unsigned int size)
+{
+	if (m_plugin.EntryAppended != nullptr)
+		m_plugin.EntryAppended(m_plugin.user, room_id, entry_id, from_slot, data, size);
+}
+
+bool Plugin::HasRoomTick() const
+{
+	return m_plugin.RoomTick != nullptr;
+}
+
+void Plugin::RoomTick(unsigned int room_id, unsigned int elapsed_ms)
+{
+	if (m_plugin.RoomTick != nullptr)
+		m_plugin.RoomTick(m_plugin.user, room_id, elapsed_ms);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Biribit/Server/BiribitPlugin.h>
+#include <Biribit/Common/Types.h>
+
+#include <string>
+
+// Room logic loaded from a shared library, or registered by the process
+// embedding the server. Calls the hooks the plugin filled, the others do
+// nothing.
+class Plugin
+{
+public:
+	static unique<Plugin> Load(const std::string& path, const std::string& appid, const brbt_PluginHost* host);
+	static unique<Plugin> Create(brbt_PluginLoad load, const std::string& name, const std::string& appid, const brbt_PluginHost* host);
+	~Plugin();
+
+	const std::string& Path() const;
+
+	void RoomCreated(unsigned int room_id, unsigned int slots_count);
+	void RoomClosed(unsigned int room_id);
+	void ClientJoined(unsigned int room_id, unsigned int slot, const std::string& name);
+	void ClientLeft(unsigned int room_id, unsigned int slot);
+	brbt_PluginVerdict BroadcastReceived(brbt_PluginBroadcast& broadcast);
+	void EntryAppended(unsigned int room_id, unsigned int entry_id, unsigned int from_slot, const void* data, unsigned int size);
+	bool HasRoomTick() const;
+	void RoomTick(unsigned int room_id, unsigned int elapsed_ms);
+
+private:
+	Plugin();
+
+	std::string m_path;
+	void* m_library;
+	brbt_Plugin m_plugin;
+
+	Plugin(const Plugin&);
+	Plugin& operator=(const Plugin&);
+};
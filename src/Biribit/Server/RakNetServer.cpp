@@ -4,10 +4,13 @@
 #include <Biribit/Common/Debug.h>
 #include <Biribit/Common/Generic.h>
 #include <Biribit/Common/BiribitMessageIdentifiers.h>
+#include <Biribit/Common/CompactCodec.h>
 
 #include <Biribit/Client/BiribitError.h>
 
 #include <sstream>
+#include <algorithm>
+#include <fstream>
 #include <chrono>
 
 //RakNet
@@ -16,28 +19,134 @@
 #include <RakNetTypes.h>
 #include <BitStream.h>
 #include <RakSleep.h>
+#include <GetTime.h>
 #include <PacketLogger.h>
 
 RakNetServer::Client::Client()
 	: id(Client::UNASSIGNED_ID)
 	, name()
-	, appid()
+	, tenant(0)
 	, joined_room(Room::UNASSIGNED_ID)
 	, joined_slot(0)
 	, addr(RakNet::UNASSIGNED_SYSTEM_ADDRESS)
+	, throttled(0)
+	, queued_bytes(0)
+	, congested(false)
+	, resume_token(0)
+	, clock_sync(false)
+	, spectated_room(Room::UNASSIGNED_ID)
+	, codec(CODEC_PROTOBUF)
+{
+}
+
+RakNetServer::RateLimit::RateLimit()
+	: messages_per_second(0.0f)
+	, bytes_per_second(0.0f)
 {
 }
 
 RakNetServer::Room::Room()
 	: id(Room::UNASSIGNED_ID)
 	, joined_clients_count(0)
-	, journal(1)
+	, tenant(0)
+	, version(0)
+	, migrating(false)
+	, migrated_from(RakNet::UNASSIGNED_SYSTEM_ADDRESS)
+	, reserved_slots_count(0)
+	, relayed_bytes(0)
+	, load(0)
+	, spectated_entries(0)
+{
+}
+
+RakNetServer::EgressQueue::EgressQueue()
+	: tenant(0)
+	, queued_bytes(0)
+	, deficit(0.0f)
+{
+}
+
+RakNetServer::EgressBudget::EgressBudget()
+	: weight(1.0f)
+	, active_rooms(0)
+{
+}
+
+RakNetServer::Tenant::Tenant()
+	: clients_count(0)
+	, journal_hot_bytes(0)
+	, max_rooms(0)
+	, max_clients(0)
+	, max_journal_bytes(0)
+{
+}
+
+RakNetServer::Reservation::Reservation()
+	: token(0)
+	, room(Room::UNASSIGNED_ID)
+	, slot(0)
+{
+}
+
+RakNetServer::Node::Node()
+	: port(0)
+	, addr(RakNet::UNASSIGNED_SYSTEM_ADDRESS)
+	, linked(false)
+	, load(0)
+{
+}
+
+const std::chrono::seconds LOAD_PERIOD(5);
+const std::chrono::seconds MIGRATION_TIMEOUT(10);
+const std::chrono::seconds RESERVATION_TIMEOUT(30);
+const std::chrono::seconds RESUME_TIMEOUT(30);
+const int RESUME_MAX_ENTRIES = 64;
+const std::chrono::milliseconds EGRESS_PERIOD(100);
+const std::chrono::seconds EGRESS_MAX_CONGESTION(5);
+const std::uint32_t EGRESS_CONGESTED_BYTES = 64 * 1024;
+const std::uint32_t EGRESS_MAX_BYTES = 1024 * 1024;
+const float EGRESS_QUANTUM = 1500.0f;
+const std::chrono::milliseconds EGRESS_MAX_DELAY(200);
+const std::size_t EGRESS_MAX_QUEUE_BYTES = 256 * 1024;
+const std::chrono::milliseconds PLUGIN_TICK_PERIOD(50);
+const float SPECTATOR_DEFAULT_RATE = 10.0f;
+const int SPECTATOR_MAX_ENTRIES = 64;
+// Bounds of ids coming from other servers, room ids are reused from the
+// lowest free one and journals never get this long.
+const std::uint32_t ROOM_MAX_ID = 0xFFFF;
+const std::uint32_t JOURNAL_MAX_ENTRIES = 1 << 20;
+
+void WriteSpectateData(RakNet::BitStream& bstream, std::uint32_t room_id, PacketReliability reliability, char channel, const char* data, std::size_t size)
+{
+	bstream.Write((RakNet::MessageID) ID_NODE_SPECTATE_DATA);
+	bstream.Write(room_id);
+	bstream.Write((std::uint8_t) reliability);
+	bstream.Write((std::uint8_t) channel);
+	bstream.Write(data, size);
+}
+
+PacketReliability PluginReliability(unsigned int reliability)
 {
+	switch (reliability)
+	{
+	case BRBT_PLUGIN_UNRELIABLE_SEQUENCED: return UNRELIABLE_SEQUENCED;
+	case BRBT_PLUGIN_RELIABLE: return RELIABLE;
+	case BRBT_PLUGIN_RELIABLE_ORDERED: return RELIABLE_ORDERED;
+	case BRBT_PLUGIN_RELIABLE_SEQUENCED: return RELIABLE_SEQUENCED;
+	default: return UNRELIABLE;
+	}
 }
 
-RakNetServer::Room::Entry::Entry()
-	: from_slot(0)
+unsigned int PluginReliability(PacketReliability reliability)
 {
+	switch (reliability)
+	{
+	case UNRELIABLE_SEQUENCED: return BRBT_PLUGIN_UNRELIABLE_SEQUENCED;
+	case RELIABLE: return BRBT_PLUGIN_RELIABLE;
+	case RELIABLE_ORDERED: return BRBT_PLUGIN_RELIABLE_ORDERED;
+	case RELIABLE_SEQUENCED: return BRBT_PLUGIN_RELIABLE_SEQUENCED;
+	default: return BRBT_PLUGIN_UNRELIABLE;
+	}
 }
 
 const char* randomNames[] = {
@@ -66,13 +175,46 @@ RakNetServer::RakNetServer()
 	: m_peer(nullptr)
 	, m_clients(1)
 	, m_rooms(1)
+	, m_random(std::random_device()())
+	, m_migrationThreshold(0)
+	, m_replicaSequence(0)
+	, m_handedOff(false)
+	, m_relayedBytes(0)
+	, m_load(0)
+	, m_journalRoomBudget(0)
+	, m_journalBudget(0)
+	, m_journalHotBytes(0)
+	, m_egressDropped(0)
+	, m_clockEpoch(RakNet::GetTime())
+	, m_captureStart(0)
+	, m_localLinksCount(0)
+	, m_roomsCount(0)
+	, m_pluginsCount(0)
+	, m_spectatorRate(SPECTATOR_DEFAULT_RATE)
 {
+	m_pluginHost.server = this;
+	m_pluginHost.Broadcast = &RakNetServer::PluginBroadcast;
+	m_pluginHost.SendTo = &RakNetServer::PluginSendTo;
+	m_pluginHost.AppendEntry = &RakNetServer::PluginAppendEntry;
+	m_pluginHost.Log = &RakNetServer::PluginLog;
+
+	// Clients without an appid yet, they can't have rooms.
+	InternAppId("");
+
+	m_rateLimits[""].resize(TRAFFIC_CLASSES_COUNT);
+	for (std::size_t i = 0; i < TRAFFIC_CLASSES_COUNT; i++) {
+		m_throttledMessages[i] = 0;
+		m_throttledBytes[i] = 0;
+	}
 }
 
 unique<RakNetServer::Client>& RakNetServer::GetClient(RakNet::SystemAddress addr)
 {
+	// Unknown addresses get the null client at id 0, callers return early.
 	auto it = m_clientAddrMap.find(addr);
-	BIRIBIT_ASSERT(it != m_clientAddrMap.end());
+	if (it == m_clientAddrMap.end())
+		return m_clients[Client::UNASSIGNED_ID];
+
 	BIRIBIT_ASSERT(it->second < m_clients.size());
 	BIRIBIT_ASSERT(m_clients[it->second] != nullptr);
 	return m_clients[it->second];
@@ -91,9 +233,12 @@ RakNetServer::Client::id_t RakNetServer::NewClient(RakNet::SystemAddress addr)
 		m_clients.push_back(unique<Client>(new Client()));
 
 	m_clients[i]->id = i;
-	m_clients[i]->appid.clear();
+	m_clients[i]->tenant = Tenant::NONE_ID;
 	m_clients[i]->addr = addr;
 	m_clientAddrMap[addr] = i;
+	m_tenants[Tenant::NONE_ID]->clients_count++;
+	ClientsChanged();
+	ApplyRateLimits(m_clients[i]);
 
 	int perm_name = 1;
 	while (perm_name != 0)
@@ -127,10 +272,13 @@ void RakNetServer::RemoveClient(RakNet::SystemAddress addr)
 	BIRIBIT_ASSERT(it->second < m_clients.size());
 	BIRIBIT_ASSERT(m_clients[it->second] != nullptr);
 	unique<Client>& client = m_clients[it->second];
+	StopSpectating(client, false);
 
 	Proto::RoomJoin proto_join;
 	proto_join.set_id(0);
 	JoinRoom(addr, &proto_join);
+	Capture(CaptureRecord::CAPTURE_DISCONNECT, client);
+	m_tenants[client->tenant]->clients_count--;
 
 	Proto::Client proto_client;
 	PopulateProtoClient(client, &proto_client);
@@ -143,15 +291,19 @@ void RakNetServer::RemoveClient(RakNet::SystemAddress addr)
 	
 	m_clients[it->second] = nullptr;
 	m_clientAddrMap.erase(it);
+	ClientsChanged();
 
 	RakNet::BitStream bstream;
 	if (WriteMessage(bstream, ID_CLIENT_DISCONNECTED, proto_client))
-		m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, RakNet::UNASSIGNED_SYSTEM_ADDRESS, true);
+		Send(&bstream, LOBBY_PRIORITY, RELIABLE_ORDERED, CHANNEL_LOBBY, RakNet::UNASSIGNED_SYSTEM_ADDRESS, true);
 }
 
 void RakNetServer::UpdateClient(RakNet::SystemAddress addr, Proto::ClientUpdate* proto_update)
 {
 	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
+
 	bool updated = false;
 	if (proto_update->has_name())
 	{
@@ -193,21 +345,38 @@ void RakNetServer::UpdateClient(RakNet::SystemAddress addr, Proto::ClientUpdate*
 			SendErrorCode(Biribit::WARN_CLIENT_NAME_IN_USE, addr);
 	}
 
-	if (proto_update->has_appid() && client->appid != proto_update->appid())
+	if (proto_update->has_appid() && m_tenants[client->tenant]->appid != proto_update->appid())
 	{
-		client->appid = proto_update->appid();
-		printLog("Client(%d) \"%s\" changed appid to \"%s\".", client->id, client->name.c_str(), proto_update->appid().c_str());
-		updated = true;
+		Tenant::id_t tenant = InternAppId(proto_update->appid());
+		unique<Tenant>& quota = m_tenants[tenant];
+		if (quota->max_clients > 0 && quota->clients_count >= quota->max_clients)
+		{
+			SendErrorCode(Biribit::WARN_APP_QUOTA_EXCEEDED, addr);
+			printLog("WARN: Client(%d) \"%s\" can't use appid \"%s\", it has %d clients already.", client->id, client->name.c_str(), quota->appid.c_str(), quota->clients_count);
+		}
+		else
+		{
+			m_tenants[client->tenant]->clients_count--;
+			quota->clients_count++;
+			client->tenant = tenant;
+			printLog("Client(%d) \"%s\" changed appid to \"%s\".", client->id, client->name.c_str(), proto_update->appid().c_str());
+			updated = true;
+			ApplyRateLimits(client);
 
-		LeaveRoom(client);
+			LeaveRoom(client);
+		}
 	}
 
-	if (updated)
+	if (updated) {
+		std::string parameters = client->name + '\0' + m_tenants[client->tenant]->appid;
+		Capture(CaptureRecord::CAPTURE_CLIENT, client, parameters.data(), parameters.size());
 		SendClientStatusUpdated(client, addr);
+	}
 }
 
 void RakNetServer::SendClientStatusUpdated(unique<Client>& client, RakNet::SystemAddress addr)
 {
+	ClientsChanged();
 	Proto::Client proto_client;
 	PopulateProtoClient(client, &proto_client);
 	{
@@ -215,65 +384,150 @@ void RakNetServer::SendClientStatusUpdated(unique<Client>& client, RakNet::Syste
 		if (WriteMessage(bstream, ID_CLIENT_STATUS_UPDATED, proto_client))
 			for (auto it = m_clients.begin(); it != m_clients.end(); it++)
 				if ((*it) != nullptr && (*it)->addr != addr)
-					m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, (*it)->addr, false);
+					Send(&bstream, LOBBY_PRIORITY, RELIABLE_ORDERED, CHANNEL_LOBBY, (*it)->addr, false);
 	}
 
 	proto_client.set_self(true);
 	{
 		RakNet::BitStream bstream;
 		if (WriteMessage(bstream, ID_CLIENT_STATUS_UPDATED, proto_client))
-			m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, addr, false);
+			Send(&bstream, LOBBY_PRIORITY, RELIABLE_ORDERED, CHANNEL_LOBBY, addr, false);
 	}
 }
 
-void RakNetServer::ListRooms(RakNet::SystemAddress addr)
+void RakNetServer::ApplyRateLimits(unique<Client>& client)
 {
-	unique<Client>& client = GetClient(addr);
-	if (client->appid.empty()) {
-		SendErrorCode(Biribit::WARN_CANNOT_LIST_ROOMS_WITHOUT_APPID, addr);
-		printLog("WARN: Client (%d) \"%s\" can't list rooms without appid.", client->id, client->name.c_str());
-		return;
+	auto it = m_rateLimits.find(m_tenants[client->tenant]->appid);
+	if (it == m_rateLimits.end())
+		it = m_rateLimits.find("");
+
+	BIRIBIT_ASSERT(it != m_rateLimits.end());
+	for (std::size_t i = 0; i < TRAFFIC_CLASSES_COUNT; i++) {
+		client->messages_bucket[i].SetRate(it->second[i].messages_per_second);
+		client->bytes_bucket[i].SetRate(it->second[i].bytes_per_second);
 	}
+}
 
-	Proto::RoomList proto_list;
-	auto set_it = m_roomAppIdMap.find(client->appid);
-	if (set_it != m_roomAppIdMap.end())
+RakNetServer::TrafficClass RakNetServer::GetTrafficClass(RakNet::MessageID msgId)
+{
+	switch (msgId)
 	{
-		for (auto it = set_it->second.begin(); it != set_it->second.end(); it++) {
-			BIRIBIT_ASSERT(m_rooms[*it] != nullptr);
-			Proto::Room* room_to_add = proto_list.add_rooms();
-			PopulateProtoRoom(m_rooms[*it], room_to_add);
+	case ID_SEND_BROADCAST_TO_ROOM:
+	case ID_SEND_BROADCAST_TO_INTEREST:
+	case ID_SEND_BROADCAST_TO_SLOTS:
+	case ID_SEND_BROADCAST_TO_OTHERS:
+		return TRAFFIC_BROADCAST;
+	case ID_SEND_ENTRY_TO_ROOM:
+		return TRAFFIC_ENTRY;
+	default:
+		// RakNet's own messages are never limited.
+		return msgId >= ID_USER_PACKET_ENUM ? TRAFFIC_CONTROL : TRAFFIC_CLASSES_COUNT;
+	}
+}
+
+bool RakNetServer::AdmitPacket(RakNet::SystemAddress addr, RakNet::MessageID msgId, unsigned int length)
+{
+	TrafficClass traffic = GetTrafficClass(msgId);
+	if (traffic == TRAFFIC_CLASSES_COUNT)
+		return true;
+
+	// The primary looks like a client until its first log.
+	if (!m_primary.host.empty() && addr == m_primary.addr)
+		return true;
+
+	// Only linked peers are trusted, an unknown address is not one of them
+	// and has no buckets to charge, so its messages are dropped.
+	auto it = m_clientAddrMap.find(addr);
+	if (it == m_clientAddrMap.end())
+		return IsLinkedPeer(addr);
+
+	unique<Client>& client = m_clients[it->second];
+	TokenBucket::clock::time_point now = TokenBucket::clock::now();
+	if (client->messages_bucket[traffic].Consume(1.0f, now) && client->bytes_bucket[traffic].Consume((float) length, now))
+		return true;
+
+	m_throttledMessages[traffic]++;
+	m_throttledBytes[traffic] += length;
+	if (client->throttled++ == 0)
+		SendErrorCode(Biribit::WARN_CLIENT_THROTTLED, addr);
+
+	return false;
+}
+
+bool RakNetServer::IsLinkedPeer(RakNet::SystemAddress addr)
+{
+	if ((addr == m_standby.addr && m_standby.linked) || (addr == m_origin.addr && m_origin.linked))
+		return true;
+
+	Node* node = GetNode(addr);
+	if (node != nullptr && node->linked)
+		return true;
+
+	Node* relay = GetRelay(addr);
+	return relay != nullptr && relay->linked;
+}
+
+void RakNetServer::ReportThrottled()
+{
+	static const char* names[TRAFFIC_CLASSES_COUNT] = { "control", "broadcast", "entry" };
+	for (std::size_t i = 0; i < TRAFFIC_CLASSES_COUNT; i++) {
+		if (m_throttledMessages[i] > 0) {
+			printLog("Throttled %llu %s messages (%llu bytes).", (unsigned long long) m_throttledMessages[i], names[i], (unsigned long long) m_throttledBytes[i]);
+			m_throttledMessages[i] = 0;
+			m_throttledBytes[i] = 0;
 		}
 	}
 
-	RakNet::BitStream bstream;
-	if (WriteMessage(bstream, ID_ROOM_LIST_RESPONSE, proto_list)) {
-		m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, addr, false);
+	for (auto it = m_clients.begin(); it != m_clients.end(); it++) {
+		if (*it != nullptr && (*it)->throttled > 0) {
+			printLog("Client (%d) \"%s\" throttled %d times.", (*it)->id, (*it)->name.c_str(), (*it)->throttled);
+			(*it)->throttled = 0;
+		}
+	}
+
+	if (m_egressDropped > 0) {
+		printLog("Dropped %llu unreliable packets waiting for egress.", (unsigned long long) m_egressDropped);
+		m_egressDropped = 0;
+	}
+}
+
+void RakNetServer::ListRooms(RakNet::SystemAddress addr)
+{
+	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
+
+	if (client->tenant == Tenant::NONE_ID) {
+		SendErrorCode(Biribit::WARN_CANNOT_LIST_ROOMS_WITHOUT_APPID, addr);
+		printLog("WARN: Client (%d) \"%s\" can't list rooms without appid.", client->id, client->name.c_str());
+		return;
 	}
+
+	SendResponse(ID_ROOM_LIST_RESPONSE, client->tenant, LOBBY_PRIORITY, RELIABLE_ORDERED, CHANNEL_LOBBY, addr);
 }
 
 void RakNetServer::JoinRandomOrCreate(RakNet::SystemAddress addr, Proto::RoomCreate* proto_create)
 {
 	unique<Client>& client = GetClient(addr);
-	if (client->appid.empty()) {
+	if (client == nullptr)
+		return;
+
+	if (client->tenant == Tenant::NONE_ID) {
 		SendErrorCode(Biribit::WARN_CANNOT_LIST_ROOMS_WITHOUT_APPID, addr);
 		printLog("WARN: Client (%d) \"%s\" can't list rooms without appid.", client->id, client->name.c_str());
 		return;
 	}
 
-	auto set_it = m_roomAppIdMap.find(client->appid);
-	if (set_it != m_roomAppIdMap.end())
-	{
-		for (auto it = set_it->second.begin(); it != set_it->second.end(); it++) {
-			BIRIBIT_ASSERT(m_rooms[*it] != nullptr);
-			unique<Room>& room = m_rooms[*it];
-			if (room->joined_clients_count < room->slots.size())
-			{
-				Proto::RoomJoin proto_join;
-				proto_join.set_id(room->id);
-				JoinRoom(addr, &proto_join);
-				return;
-			}
+	std::set<Room::id_t>& rooms = m_tenants[client->tenant]->rooms;
+	for (auto it = rooms.begin(); it != rooms.end(); it++) {
+		BIRIBIT_ASSERT(m_rooms[*it] != nullptr);
+		unique<Room>& room = m_rooms[*it];
+		if (!room->migrating && room->joined_clients_count + room->reserved_slots_count < room->slots.size())
+		{
+			Proto::RoomJoin proto_join;
+			proto_join.set_id(room->id);
+			JoinRoom(addr, &proto_join);
+			return;
 		}
 	}
 
@@ -283,7 +537,10 @@ void RakNetServer::JoinRandomOrCreate(RakNet::SystemAddress addr, Proto::RoomCre
 void RakNetServer::CreateRoom(RakNet::SystemAddress addr, Proto::RoomCreate* proto_create)
 {
 	unique<Client>& client = GetClient(addr);
-	if (client->appid.empty()) {
+	if (client == nullptr)
+		return;
+
+	if (client->tenant == Tenant::NONE_ID) {
 		SendErrorCode(Biribit::WARN_CANNOT_CREATE_ROOM_WITHOUT_APPID, addr);
 		printLog("WARN: Client (%d) \"%s\" can't create a room without appid.", client->id, client->name.c_str());
 		return;
@@ -295,28 +552,21 @@ void RakNetServer::CreateRoom(RakNet::SystemAddress addr, Proto::RoomCreate* pro
 		return;
 	}
 
-	if (proto_create->client_slots() > 0xFF) {
+	if (proto_create->client_slots() > LARGE_ROOM_MAX_SLOTS) {
 		SendErrorCode(Biribit::WARN_CANNOT_CREATE_ROOM_WITH_TOO_MANY_SLOTS, addr);
 		printLog("WARN: Client (%d) \"%s\" tried to create a room with too many slots.", client->id, client->name.c_str());
 		return;
 	}
 
-	std::size_t i = 1;
-	for (; i < m_rooms.size() && m_rooms[i] != nullptr; i++);
-	if (i == m_rooms.size())
-		m_rooms.push_back(nullptr);
-
-	m_rooms[i] = unique<Room>(new Room());
-	unique<Room>& room = m_rooms[i];
-	room->id = i;
-	room->appid = client->appid;
-	room->slots.resize(proto_create->client_slots(), Client::UNASSIGNED_ID);
-
-	std::set<Room::id_t>& room_set = m_roomAppIdMap[room->appid];
-	auto result = room_set.insert(room->id);
-	BIRIBIT_ASSERT(result.second);
+	unique<Tenant>& tenant = m_tenants[client->tenant];
+	if (tenant->max_rooms > 0 && tenant->rooms.size() >= tenant->max_rooms) {
+		SendErrorCode(Biribit::WARN_APP_QUOTA_EXCEEDED, addr);
+		printLog("WARN: Client (%d) \"%s\" can't create a room, the app %s has %d rooms already.", client->id, client->name.c_str(), tenant->appid.c_str(), (int) tenant->rooms.size());
+		return;
+	}
 
-	printLog("Created room %d for the app %s.", room->id, room->appid.c_str());
+	unique<Room>& room = m_rooms[NewRoom(client->tenant, proto_create->client_slots())];
+	printLog("Created room %d for the app %s.", room->id, tenant->appid.c_str());
 		
 	Proto::RoomJoin proto_join;
 	proto_join.set_id(room->id);
@@ -329,6 +579,9 @@ void RakNetServer::CreateRoom(RakNet::SystemAddress addr, Proto::RoomCreate* pro
 void RakNetServer::JoinRoom(RakNet::SystemAddress addr, Proto::RoomJoin* proto_join)
 {
 	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
+
 	if (!proto_join->has_id()) {
 		SendErrorCode(Biribit::WARN_CANNOT_JOIN_WITHOUT_ROOM_ID, addr);
 		printLog("WARN: Client (%d) \"%s\" sent RoomJoin without room id.", client->id, client->name.c_str());
@@ -345,8 +598,8 @@ void RakNetServer::JoinRoom(RakNet::SystemAddress addr, Proto::RoomJoin* proto_j
 			Proto::RoomJoin proto_join;
 			PopulateProtoRoomJoin(client, &proto_join);
 			RakNet::BitStream bstream;
-			if (WriteMessage(bstream, ID_ROOM_JOIN_RESPONSE, proto_join))
-				m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, addr, false);
+			if (WriteMessage(bstream, ID_ROOM_JOIN_RESPONSE, proto_join, client->codec))
+				Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
 		}
 	}
 	else
@@ -359,11 +612,17 @@ void RakNetServer::JoinRoom(RakNet::SystemAddress addr, Proto::RoomJoin* proto_j
 				return;
 			}
 
-			if (m_rooms[id]->appid != client->appid) {
+			if (m_rooms[id]->tenant != client->tenant) {
 				SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_OTHER_APP_ROOM, addr);
 				printLog("WARN: Client (%d) \"%s\" tried to join other app's room.", client->id, client->name.c_str());
 				return;
 			}
+
+			if (m_rooms[id]->migrating) {
+				SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_MIGRATING_ROOM, addr);
+				printLog("WARN: Client (%d) \"%s\" tried to join a migrating room.", client->id, client->name.c_str());
+				return;
+			}
 		}
 
 		//Leaving old room, joining new one
@@ -374,7 +633,7 @@ void RakNetServer::JoinRoom(RakNet::SystemAddress addr, Proto::RoomJoin* proto_j
 			if (proto_join->has_slot_to_join())
 			{
 				slot = proto_join->slot_to_join();
-				if (slot >= room->slots.size() || room->slots[slot] != Client::UNASSIGNED_ID) {
+				if (!IsSlotFree(room, slot)) {
 					if (slot >= room->slots.size())
 						SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_INVALID_SLOT, addr);
 					else
@@ -385,8 +644,8 @@ void RakNetServer::JoinRoom(RakNet::SystemAddress addr, Proto::RoomJoin* proto_j
 			}
 			else
 			{
-				for (slot = 0; slot < room->slots.size() && room->slots[slot] != Client::UNASSIGNED_ID; slot++);
-				if (slot >= m_rooms[id]->slots.size()) {
+				slot = room->taken.find_first_unset();
+				if (slot >= room->slots.size()) {
 					SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_FULL_ROOM, addr);
 					printLog("WARN: Client (%d) \"%s\" tried to join a full room.", client->id, client->name.c_str());
 					return;
@@ -394,26 +653,23 @@ void RakNetServer::JoinRoom(RakNet::SystemAddress addr, Proto::RoomJoin* proto_j
 			}
 			
 			LeaveRoom(client);
-			room->slots[slot] = client->id;
-			room->joined_clients_count++;
-			client->joined_room = id;
-			client->joined_slot = slot;
+			OccupySlot(room, slot, client);
 			printLog("Client (%d) \"%s\" joins room %d.", client->id, client->name.c_str(), room->id);
-			RoomChanged(room);
+			RoomChanged(room, { slot }, addr);
 
 			{
 				Proto::RoomJoin proto_join;
 				PopulateProtoRoomJoin(client, &proto_join);
 				RakNet::BitStream bstream;
-				if (WriteMessage(bstream, ID_ROOM_JOIN_RESPONSE, proto_join))
-					m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, addr, false);
+				if (WriteMessage(bstream, ID_ROOM_JOIN_RESPONSE, proto_join, client->codec))
+					Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
 			}
 			{
 				Proto::RoomEntriesStatus proto_entries;
 				PopulateProtoRoomEntriesStatus(room, &proto_entries);
 				RakNet::BitStream bstream;
 				if (WriteMessage(bstream, ID_JOURNAL_ENTRIES_STATUS, proto_entries))
-					m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, addr, false);
+					Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
 			}
 			
 		}
@@ -423,7 +679,7 @@ void RakNetServer::JoinRoom(RakNet::SystemAddress addr, Proto::RoomJoin* proto_j
 			unique<Room>& room = m_rooms[id];
 			std::uint32_t oldslot = client->joined_slot;
 			std::uint32_t slot = proto_join->slot_to_join();
-			if (slot >= room->slots.size() || room->slots[slot] != Client::UNASSIGNED_ID) {
+			if (!IsSlotFree(room, slot)) {
 				if (slot >= room->slots.size())
 					SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_INVALID_SLOT, addr);
 				else
@@ -432,26 +688,31 @@ void RakNetServer::JoinRoom(RakNet::SystemAddress addr, Proto::RoomJoin* proto_j
 				return;
 			}
 	
-			room->slots[oldslot] = Client::UNASSIGNED_ID;
-			room->slots[slot] = client->id;
-			client->joined_slot = slot;
+			VacateSlot(room, client);
+			OccupySlot(room, slot, client);
+			for (auto it = room->interests.begin(); it != room->interests.end(); it++) {
+				if (it->second.test(oldslot)) {
+					it->second.reset(oldslot);
+					it->second.set(slot);
+				}
+			}
 
 			printLog("Client (%d) \"%s\" swaps slot from %d to %d in room %d.", client->id, client->name.c_str(), oldslot, slot, room->id);
-			RoomChanged(room);
+			RoomChanged(room, { oldslot, slot });
 
 			{
 				Proto::RoomJoin proto_join;
 				PopulateProtoRoomJoin(client, &proto_join);
 				RakNet::BitStream bstream;
-				if (WriteMessage(bstream, ID_ROOM_JOIN_RESPONSE, proto_join))
-					m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, addr, false);
+				if (WriteMessage(bstream, ID_ROOM_JOIN_RESPONSE, proto_join, client->codec))
+					Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
 			}
 			{
 				Proto::RoomEntriesStatus proto_entries;
 				PopulateProtoRoomEntriesStatus(room, &proto_entries);
 				RakNet::BitStream bstream;
 				if (WriteMessage(bstream, ID_JOURNAL_ENTRIES_STATUS, proto_entries))
-					m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, addr, false);
+					Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
 			}
 		}
 	}
@@ -465,222 +726,2587 @@ bool RakNetServer::LeaveRoom(unique<Client>& client)
 		BIRIBIT_ASSERT(m_rooms[client->joined_room]->slots[client->joined_slot] == client->id);
 
 		unique<Room>& room = m_rooms[client->joined_room];
-		room->slots[client->joined_slot] = Client::UNASSIGNED_ID;
-		room->joined_clients_count--;
-		client->joined_room = Room::UNASSIGNED_ID;
-		client->joined_slot = 0;
+		std::uint32_t slot = client->joined_slot;
+		ClearSlotInterests(room, slot);
+		VacateSlot(room, client);
+		DropEgress(room->id, client->addr);
 
 		printLog("Client (%d) \"%s\" leaves room %d.", client->id, client->name.c_str(), room->id);
 		
-		if (room->joined_clients_count == 0) {
-			std::size_t erased = m_roomAppIdMap[room->appid].erase(room->id);
-			BIRIBIT_ASSERT(erased > 0);
-			if (m_roomAppIdMap[room->appid].empty())
-				m_roomAppIdMap.erase(room->appid);
-	
+		if (room->joined_clients_count == 0 && room->reserved_slots_count == 0) {
 			printLog("Room %d is empty. Closing room.", room->id);
-			m_rooms[room->id] = nullptr;
+			CloseRoom(room);
 		}
 		else
-			RoomChanged(room, client->addr);
+			RoomChanged(room, { slot }, client->addr);
 
 		return true;
 	}
 
 	return false;
 }
-void RakNetServer::RoomChanged(unique<Room>& room, RakNet::SystemAddress extra_addr_to_notify)
+
+RakNetServer::Tenant::id_t RakNetServer::InternAppId(const std::string& appid)
 {
-	Proto::Room proto_room;
-	PopulateProtoRoom(room, &proto_room);
-	RakNet::BitStream bstream;
-	if (WriteMessage(bstream, ID_ROOM_STATUS, proto_room)) {
-		for (auto it = room->slots.begin(); it != room->slots.end(); it++) {
-			if (*it != Client::UNASSIGNED_ID) {
-				BIRIBIT_ASSERT(m_clients[*it] != nullptr);
-				m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, m_clients[*it]->addr, false);
-			}
-		}
+	auto it = m_tenantIds.find(appid);
+	if (it != m_tenantIds.end())
+		return it->second;
 
-		if (extra_addr_to_notify != RakNet::UNASSIGNED_SYSTEM_ADDRESS)
-			m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, extra_addr_to_notify, false);
-	}
+	Tenant::id_t id = m_tenants.size();
+	m_tenants.push_back(unique<Tenant>(new Tenant()));
+	m_tenants[id]->appid = appid;
+	m_tenantIds[appid] = id;
+	return id;
 }
 
-void RakNetServer::SendRoomBroadcast(RakNet::SystemAddress addr, RakNet::Time timeStamp, RakNet::BitStream& in)
+RakNetServer::Room::id_t RakNetServer::NewRoom(Tenant::id_t tenant, std::uint32_t slots_count)
 {
-	unique<Client>& client = GetClient(addr);
-	if (client->joined_room > 0)
-	{
-		BIRIBIT_ASSERT(m_rooms[client->joined_room] != nullptr);
-		BIRIBIT_ASSERT(m_rooms[client->joined_room]->slots[client->joined_slot] == client->id);
-		unique<Room>& room = m_rooms[client->joined_room];
+	std::size_t i = 1;
+	for (; i < m_rooms.size() && m_rooms[i] != nullptr; i++);
+	if (i == m_rooms.size())
+		m_rooms.push_back(nullptr);
 
+	m_rooms[i] = unique<Room>(new Room());
+	unique<Room>& room = m_rooms[i];
+	room->id = i;
+	room->tenant = tenant;
+	room->slots.resize(slots_count, Client::UNASSIGNED_ID);
+	room->members.resize(slots_count);
+	room->taken.resize(slots_count);
+	room->reserved.resize(slots_count, 0);
 
-		std::uint8_t uint8_reliability;
-		in.Read(uint8_reliability);
-		PacketReliability reliability = (PacketReliability) uint8_reliability;
-		switch (reliability)
-		{
-		case UNRELIABLE:
-		case RELIABLE:
-		case RELIABLE_ORDERED:
-			break;
-		default:
-			reliability = UNRELIABLE;
-			break;
-		}
+	auto result = m_tenants[tenant]->rooms.insert(room->id);
+	BIRIBIT_ASSERT(result.second);
+	m_roomsCount++;
+	RoomTouched(room);
 
-		RakNet::BitStream bstream;
-		if (timeStamp != 0)
-		{
-			bstream.Write((RakNet::MessageID) ID_TIMESTAMP);
-			bstream.Write(timeStamp);
-		}
-		
-		bstream.Write((RakNet::MessageID) ID_BROADCAST_FROM_ROOM);
-		bstream.Write((std::uint8_t) client->joined_slot);
-		bstream.Write(in);
+	if (m_standby.linked)
+		ReplicateRoom(room);
 
-		for (auto it = room->slots.begin(); it != room->slots.end(); it++) {
-			if (*it != Client::UNASSIGNED_ID) {
-				BIRIBIT_ASSERT(m_clients[*it] != nullptr);
-				m_peer->Send(&bstream, HIGH_PRIORITY, reliability, room->id & 0xFF, m_clients[*it]->addr, false);
-			}
-		}
-	}
+	Plugin* plugin = GetPlugin(room->tenant);
+	if (plugin != nullptr)
+		plugin->RoomCreated(room->id, slots_count);
+
+	return room->id;
 }
 
-void RakNetServer::SendRoomEntry(RakNet::SystemAddress addr, RakNet::BitStream& in)
+void RakNetServer::CloseRoom(unique<Room>& room)
 {
-	unique<Client>& client = GetClient(addr);
-	if (client->joined_room > 0)
-	{
-		BIRIBIT_ASSERT(m_rooms[client->joined_room] != nullptr);
-		BIRIBIT_ASSERT(m_rooms[client->joined_room]->slots[client->joined_slot] == client->id);
-		unique<Room>& room = m_rooms[client->joined_room];
-
-		std::size_t size = BITS_TO_BYTES(in.GetNumberOfUnreadBits());
-		Room::Entry newEntry;
-		newEntry.from_slot = client->joined_slot;
-		newEntry.data.resize(size + 1);
-		newEntry.data[size] = '\0';
-		in.Read(&newEntry.data[0], size);
-		room->journal.push_back(newEntry);
+	Plugin* plugin = GetPlugin(room->tenant);
+	if (plugin != nullptr)
+		plugin->RoomClosed(room->id);
 
-		Proto::RoomEntriesStatus proto_entries;
-		PopulateProtoRoomEntriesStatus(room, &proto_entries);
-		{
-			Proto::RoomEntry* proto_entry = proto_entries.add_entries();
-			proto_entry->set_id(room->journal.size() - 1);
-			proto_entry->set_from_slot(newEntry.from_slot);
-			proto_entry->set_entry_data(newEntry.data);
-		}	
+	// Sent right away, the room egress queue is dropped below.
+	Proto::RoomSpectate proto_stop;
+	RakNet::BitStream stop_bstream;
+	if ((!room->spectators.empty() || !room->relays.empty()) && WriteMessage(stop_bstream, ID_ROOM_SPECTATE_RESPONSE, proto_stop))
+	{
+		for (auto it = room->spectators.begin(); it != room->spectators.end(); it++) {
+			BIRIBIT_ASSERT(m_clients[*it] != nullptr);
+			m_clients[*it]->spectated_room = Room::UNASSIGNED_ID;
+			Send(&stop_bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, m_clients[*it]->addr, false);
+		}
 
 		RakNet::BitStream bstream;
-		if (WriteMessage(bstream, ID_JOURNAL_ENTRIES_STATUS, proto_entries)) {
-			for (auto it = room->slots.begin(); it != room->slots.end(); it++) {
-				if (*it != Client::UNASSIGNED_ID) {
-					BIRIBIT_ASSERT(m_clients[*it] != nullptr);
-					m_peer->Send(&bstream, MEDIUM_PRIORITY, RELIABLE, room->id & 0xFF, m_clients[*it]->addr, false);
-				}
-			}
-		}
+		WriteSpectateData(bstream, room->id, RELIABLE_ORDERED, CHANNEL_CONTROL, (const char*) stop_bstream.GetData(), stop_bstream.GetNumberOfBytesUsed());
+		for (auto it = room->relays.begin(); it != room->relays.end(); it++)
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, *it, false);
 	}
-}
 
-void RakNetServer::RoomEntriesRequest(RakNet::SystemAddress addr, Proto::RoomEntriesRequest* proto_entriesReq)
-{
-	unique<Client>& client = GetClient(addr);
-	if (client->joined_room > 0)
-	{
-		BIRIBIT_ASSERT(m_rooms[client->joined_room] != nullptr);
-		BIRIBIT_ASSERT(m_rooms[client->joined_room]->slots[client->joined_slot] == client->id);
-		unique<Room>& room = m_rooms[client->joined_room];
+	std::size_t erased = m_tenants[room->tenant]->rooms.erase(room->id);
+	BIRIBIT_ASSERT(erased > 0);
+	m_roomsCount--;
+	RoomTouched(room);
+	m_responses.Erase(ID_ROOM_STATUS, room->id);
 
-		Proto::RoomEntriesStatus proto_entries;
-		PopulateProtoRoomEntriesStatus(room, &proto_entries);
-		
-		std::set<std::uint32_t> entriesSet;
-		int size = proto_entriesReq->entries_id_size();
-		for (int i = 0; i < size; i++)
-		{
-			std::uint32_t id = proto_entriesReq->entries_id(i);
-			if (entriesSet.find(id) == entriesSet.end())
-			{
-				if (id > Room::Entry::UNASSIGNED_ID && id < room->journal.size())
-				{
-					Room::Entry& entry = room->journal[id];
-					Proto::RoomEntry* proto_entry = proto_entries.add_entries();
-					proto_entry->set_id(id);
-					proto_entry->set_from_slot(entry.from_slot);
-					proto_entry->set_entry_data(entry.data);
-				}
+	for (auto it = m_reservations.begin(); it != m_reservations.end();)
+		if (it->second.room == room->id)
+			it = m_reservations.erase(it);
+		else
+			it++;
 
-				entriesSet.insert(id);
-			}
-		}
+	for (auto it = m_migrations.begin(); it != m_migrations.end();)
+		if (it->room == room->id)
+			it = m_migrations.erase(it);
+		else
+			it++;
 
-		RakNet::BitStream bstream;
-		if (WriteMessage(bstream, ID_JOURNAL_ENTRIES_STATUS, proto_entries))
-			m_peer->Send(&bstream, MEDIUM_PRIORITY, RELIABLE, room->id & 0xFF, addr, false);
-	}
-}
+	DropEgress(room->id);
+	m_journalHotBytes -= room->journal.HotBytes();
+	m_tenants[room->tenant]->journal_hot_bytes -= room->journal.HotBytes();
+	if (m_standby.linked)
+		AddReplicaRecord(room->id, Proto::ReplicaRecord::ROOM_CLOSED);
 
-void RakNetServer::PopulateProtoServerInfo(Proto::ServerInfo* proto_info)
-{
-	proto_info->set_name(m_name);
-	proto_info->set_password_protected(m_passwordProtected);
-	proto_info->set_max_clients(m_maxClients);
-	proto_info->set_connected_clients(m_clientAddrMap.size());
+	m_rooms[room->id] = nullptr;
 }
 
-void RakNetServer::PopulateProtoClient(unique<Client>& client, Proto::Client* proto_client)
+bool RakNetServer::IsSlotFree(unique<Room>& room, std::uint32_t slot)
 {
-	proto_client->set_id(client->id);
-	proto_client->set_name(client->name);
-	proto_client->set_appid(client->appid);
+	return slot < room->slots.size() && !room->taken.test(slot);
 }
 
-void RakNetServer::PopulateProtoRoom(unique<Room>& room, Proto::Room* proto_room)
+void RakNetServer::OccupySlot(unique<Room>& room, std::uint32_t slot, unique<Client>& client)
 {
-	proto_room->set_id(room->id);
-	for (std::size_t i = 0; i < room->slots.size(); i++)
-		proto_room->add_joined_id_client(room->slots[i]);
+	room->slots[slot] = client->id;
+	room->members.set(slot);
+	room->taken.set(slot);
+	room->joined_clients_count++;
+	client->joined_room = room->id;
+	client->joined_slot = slot;
+	StopSpectating(client, false);
 
-	proto_room->set_journal_entries_count(room->journal.size());
+	std::string slots_count = CaptureVarint(room->slots.size());
+	Capture(CaptureRecord::CAPTURE_JOIN, client, slots_count.data(), slots_count.size());
+
+	client->resume_token = NewToken();
+	SendResumeTicket(client);
+	if (m_standby.linked) {
+		ReplicateSlot(room, slot, client->resume_token, client->name);
+		SendStandbyTicket(client);
+	}
+
+	Plugin* plugin = GetPlugin(room->tenant);
+	if (plugin != nullptr)
+		plugin->ClientJoined(room->id, slot, client->name);
 }
 
-void RakNetServer::PopulateProtoRoomJoin(unique<Client>& client, Proto::RoomJoin* proto_join)
+void RakNetServer::VacateSlot(unique<Room>& room, unique<Client>& client)
 {
-	proto_join->set_id(client->joined_room);
-	if (client->joined_room != Room::UNASSIGNED_ID)
-		proto_join->set_slot_to_join(client->joined_slot);
+	std::uint32_t slot = client->joined_slot;
+	room->slots[slot] = Client::UNASSIGNED_ID;
+	room->members.reset(slot);
+	room->taken.reset(slot);
+	room->joined_clients_count--;
+	Capture(CaptureRecord::CAPTURE_LEAVE, client);
+	client->coalesced.clear();
+	client->resume_token = 0;
+	if (m_standby.linked)
+		ReplicateSlot(room, slot, client->resume_token, client->name);
+	client->joined_room = Room::UNASSIGNED_ID;
+	client->joined_slot = 0;
+
+	Plugin* plugin = GetPlugin(room->tenant);
+	if (plugin != nullptr)
+		plugin->ClientLeft(room->id, slot);
 }
 
-void RakNetServer::PopulateProtoRoomEntriesStatus(unique<Room>& room, Proto::RoomEntriesStatus* proto_entries)
+void RakNetServer::UpdateRoomInterests(RakNet::SystemAddress addr, Proto::RoomInterests* proto_interests)
 {
-	proto_entries->set_room_id(room->id);
-	BIRIBIT_ASSERT(room->journal.size() > 0);
-	proto_entries->set_journal_size(room->journal.size() -1 );
-}
+	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
 
+	if (client->joined_room == Room::UNASSIGNED_ID)
+		return;
 
-void RakNetServer::RaknetThreadUpdate(RakNet::RakPeerInterface *peer, void* data)
-{
-	if (data != nullptr && static_cast<RakNetServer*>(data)->m_peer == peer) {
-		static_cast<RakNetServer*>(data)->RakNetUpdated();
+	BIRIBIT_ASSERT(m_rooms[client->joined_room] != nullptr);
+	unique<Room>& room = m_rooms[client->joined_room];
+	if (m_capture.IsOpen()) {
+		std::string message = proto_interests->SerializeAsString();
+		Capture(CaptureRecord::CAPTURE_INTERESTS, client, message.data(), message.size());
 	}
-}
 
-void RakNetServer::RakNetUpdated()
-{
-	m_pool->enqueue([this]() {
-		RakNet::Packet* p = nullptr;
-		while (m_peer != nullptr && (p = m_peer->Receive()) != nullptr) {
+	if (proto_interests->has_reset() && proto_interests->reset())
+		ClearSlotInterests(room, client->joined_slot);
+
+	int remove_size = proto_interests->remove_size();
+	for (int i = 0; i < remove_size; i++)
+	{
+		auto it = room->interests.find(proto_interests->remove(i));
+		if (it != room->interests.end()) {
+			it->second.reset(client->joined_slot);
+			if (it->second.none())
+				room->interests.erase(it);
+		}
+	}
+
+	int add_size = proto_interests->add_size();
+	for (int i = 0; i < add_size; i++)
+	{
+		auto it = room->interests.find(proto_interests->add(i));
+		if (it == room->interests.end())
+			it = room->interests.insert(std::make_pair(proto_interests->add(i), SlotSet(room->slots.size()))).first;
+
+		it->second.set(client->joined_slot);
+	}
+}
+
+void RakNetServer::ClearSlotInterests(unique<Room>& room, std::uint32_t slot)
+{
+	for (auto it = room->interests.begin(); it != room->interests.end();)
+	{
+		it->second.reset(slot);
+		if (it->second.none())
+			it = room->interests.erase(it);
+		else
+			it++;
+	}
+}
+
+void RakNetServer::RoomChanged(unique<Room>& room, const std::vector<std::uint32_t>& changed_slots, RakNet::SystemAddress full_status_addr)
+{
+	// Members already know the room, only the changed slots are sent to them.
+	room->version++;
+	RoomTouched(room);
+	Proto::RoomDelta proto_delta;
+	PopulateProtoRoomDelta(room, changed_slots, &proto_delta);
+	RakNet::BitStream bstreams[CODEC_NEWEST + 1];
+	bool written[CODEC_NEWEST + 1] = {};
+	room->members.forEach([&](std::size_t slot) {
+		Client::id_t id = room->slots[slot];
+		BIRIBIT_ASSERT(m_clients[id] != nullptr);
+		if (m_clients[id]->addr == full_status_addr)
+			return;
+
+		std::uint8_t codec = m_clients[id]->codec;
+		if (!written[codec] && !WriteMessage(bstreams[codec], ID_ROOM_STATUS_DELTA, proto_delta, codec))
+			return;
+
+		written[codec] = true;
+		Send(&bstreams[codec], CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, m_clients[id]->addr, false);
+	});
+
+	// Relays keep the room status for their spectators, they need it whole.
+	if (full_status_addr != RakNet::UNASSIGNED_SYSTEM_ADDRESS || !room->spectators.empty() || !room->relays.empty())
+	{
+		ResponseCache::Response response = GetResponse(ID_ROOM_STATUS, room->id);
+		if (response != nullptr)
+		{
+			if (full_status_addr != RakNet::UNASSIGNED_SYSTEM_ADDRESS)
+				Send(response->data(), (int) response->size(), CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, full_status_addr, false);
+
+			SendSpectators(room, response->data(), response->size(), CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL);
+		}
+	}
+}
+
+void RakNetServer::SendRoomStatus(RakNet::SystemAddress addr, Proto::RoomJoin* proto_join)
+{
+	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
+
+	Room::id_t id = proto_join->has_id() ? proto_join->id() : (Room::id_t) Room::UNASSIGNED_ID;
+	if (id == Room::UNASSIGNED_ID || id >= m_rooms.size() || m_rooms[id] == nullptr || m_rooms[id]->tenant != client->tenant) {
+		SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_UNEXISTING_ROOM, addr);
+		return;
+	}
+
+	SendResponse(ID_ROOM_STATUS, id, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr);
+}
+
+void RakNetServer::SpectateRoom(RakNet::SystemAddress addr, Proto::RoomSpectate* proto_spectate)
+{
+	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
+
+	StopSpectating(client, false);
+
+	Room::id_t id = proto_spectate->has_id() ? proto_spectate->id() : (Room::id_t) Room::UNASSIGNED_ID;
+	Proto::RoomSpectate proto_response;
+	RakNet::BitStream bstream;
+	if (id == Room::UNASSIGNED_ID) {
+		if (WriteMessage(bstream, ID_ROOM_SPECTATE_RESPONSE, proto_response))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+		return;
+	}
+
+	unique<Room>* target = nullptr;
+	if (!m_origin.host.empty())
+	{
+		// Relay, the room is followed at the origin once for all spectators.
+		if (!m_origin.linked) {
+			SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_UNEXISTING_ROOM, addr);
+			return;
+		}
+
+		// Followed for the app of its first spectator, the origin refuses
+		// rooms of other apps. Until it answers, spectators wait.
+		auto relayed = m_relayed.find(id);
+		bool following = (relayed == m_relayed.end());
+		if (following)
+		{
+			unique<Room>& follow = m_following[id];
+			if (follow == nullptr)
+			{
+				follow = unique<Room>(new Room());
+				follow->id = id;
+				follow->tenant = client->tenant;
+
+				Proto::RoomSpectate proto_follow;
+				proto_follow.set_id(id);
+				proto_follow.set_appid(m_tenants[client->tenant]->appid);
+				RakNet::BitStream follow_bstream;
+				if (WriteMessage(follow_bstream, ID_NODE_SPECTATE, proto_follow))
+					Send(&follow_bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, m_origin.addr, false);
+			}
+
+			target = &follow;
+		}
+		else
+		{
+			target = &relayed->second;
+		}
+
+		if ((*target)->tenant != client->tenant) {
+			SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_OTHER_APP_ROOM, addr);
+			printLog("WARN: Client (%d) \"%s\" tried to spectate other app room.", client->id, client->name.c_str());
+			return;
+		}
+
+		if (following) {
+			(*target)->spectators.insert(client->id);
+			client->spectated_room = id;
+			return;
+		}
+	}
+	else
+	{
+		if (id >= m_rooms.size() || m_rooms[id] == nullptr) {
+			SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_UNEXISTING_ROOM, addr);
+			printLog("WARN: Client (%d) \"%s\" tried to spectate unexisting room.", client->id, client->name.c_str());
+			return;
+		}
+
+		if (m_rooms[id]->tenant != client->tenant) {
+			SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_OTHER_APP_ROOM, addr);
+			printLog("WARN: Client (%d) \"%s\" tried to spectate other app room.", client->id, client->name.c_str());
+			return;
+		}
+
+		// With relays around, spectators go to the least loaded one.
+		Node* relay = nullptr;
+		for (auto it = m_relays.begin(); it != m_relays.end(); it++)
+			if (it->linked && (relay == nullptr || it->load < relay->load))
+				relay = &(*it);
+
+		if (relay != nullptr)
+		{
+			Proto::RoomMigrated proto_redirect;
+			proto_redirect.set_address(relay->host);
+			proto_redirect.set_port(relay->port);
+			proto_redirect.set_room_id(id);
+			proto_redirect.set_token(0);
+			if (WriteMessage(bstream, ID_ROOM_SPECTATE_REDIRECT, proto_redirect))
+				Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+
+			relay->load++;
+			return;
+		}
+
+		// Spectating and playing don't mix.
+		if (client->joined_room != Room::UNASSIGNED_ID)
+		{
+			Proto::RoomJoin proto_join;
+			proto_join.set_id(Room::UNASSIGNED_ID);
+			JoinRoom(addr, &proto_join);
+			if (m_rooms[id] == nullptr) {
+				SendErrorCode(Biribit::WARN_CANNOT_JOIN_TO_UNEXISTING_ROOM, addr);
+				return;
+			}
+		}
+
+		target = &m_rooms[id];
+		if ((*target)->spectators.empty() && (*target)->relays.empty()) {
+			(*target)->spectated_entries = (*target)->journal.Size() - 1;
+			(*target)->spectated.clear();
+			(*target)->spectated_reliable.clear();
+		}
+	}
+
+	unique<Room>& room = *target;
+	room->spectators.insert(client->id);
+	client->spectated_room = id;
+	printLog("Client (%d) \"%s\" spectates room %d.", client->id, client->name.c_str(), id);
+
+	proto_response.set_id(id);
+	if (WriteMessage(bstream, ID_ROOM_SPECTATE_RESPONSE, proto_response))
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+
+	// A relay still waiting for the origin sends the status once it comes.
+	if (room->slots.empty())
+		return;
+
+	// Relayed rooms are not cached, their ids are the origin's.
+	if (m_origin.host.empty()) {
+		SendResponse(ID_ROOM_STATUS, room->id, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr);
+	}
+	else {
+		Proto::Room proto_room;
+		PopulateProtoRoom(room, &proto_room);
+		RakNet::BitStream status_bstream;
+		if (WriteMessage(status_bstream, ID_ROOM_STATUS, proto_room))
+			Send(&status_bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+	}
+
+	Proto::RoomEntriesStatus proto_entries;
+	PopulateProtoRoomEntriesStatus(room, &proto_entries);
+	if (m_origin.host.empty())
+		proto_entries.set_journal_size(room->spectated_entries);
+
+	RakNet::BitStream entries_bstream;
+	if (WriteMessage(entries_bstream, ID_JOURNAL_ENTRIES_STATUS, proto_entries))
+		Send(&entries_bstream, JOURNAL_PRIORITY, RELIABLE, CHANNEL_JOURNAL, addr, false);
+}
+
+void RakNetServer::StopSpectating(unique<Client>& client, bool notify)
+{
+	if (client->spectated_room == Room::UNASSIGNED_ID)
+		return;
+
+	Room::id_t id = client->spectated_room;
+	client->spectated_room = Room::UNASSIGNED_ID;
+
+	unique<Room>* room = GetSpectatedRoom(id);
+	if (room == nullptr && m_following.find(id) != m_following.end())
+		room = &m_following[id];
+
+	if (room != nullptr)
+	{
+		(*room)->spectators.erase(client->id);
+		if (m_origin.host.empty())
+		{
+			DropEgress(id, client->addr);
+		}
+		else if ((*room)->spectators.empty())
+		{
+			Proto::RoomSpectate proto_leave;
+			proto_leave.set_id(id);
+			proto_leave.set_leave(true);
+			RakNet::BitStream bstream;
+			if (m_origin.linked && WriteMessage(bstream, ID_NODE_SPECTATE, proto_leave))
+				Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, m_origin.addr, false);
+
+			m_relayed.erase(id);
+			m_following.erase(id);
+		}
+	}
+
+	if (notify)
+	{
+		Proto::RoomSpectate proto_stop;
+		RakNet::BitStream bstream;
+		if (WriteMessage(bstream, ID_ROOM_SPECTATE_RESPONSE, proto_stop))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, client->addr, false);
+	}
+}
+
+unique<RakNetServer::Room>* RakNetServer::GetSpectatedRoom(Room::id_t room_id)
+{
+	if (!m_origin.host.empty()) {
+		auto it = m_relayed.find(room_id);
+		return (it != m_relayed.end()) ? &it->second : nullptr;
+	}
+
+	if (room_id >= m_rooms.size() || m_rooms[room_id] == nullptr)
+		return nullptr;
+
+	return &m_rooms[room_id];
+}
+
+void RakNetServer::SendSpectators(unique<Room>& room, const char* data, std::size_t size, PacketPriority priority, PacketReliability reliability, char channel)
+{
+	if (!room->spectators.empty())
+	{
+		shared<std::string> packet = std::make_shared<std::string>(data, size);
+		for (auto it = room->spectators.begin(); it != room->spectators.end(); it++) {
+			BIRIBIT_ASSERT(m_clients[*it] != nullptr);
+			EnqueueEgress(room, m_clients[*it]->addr, packet, priority, reliability, channel);
+			room->relayed_bytes += packet->size();
+		}
+	}
+
+	if (!room->relays.empty())
+	{
+		RakNet::BitStream bstream;
+		WriteSpectateData(bstream, room->id, reliability, channel, data, size);
+		shared<std::string> packet = std::make_shared<std::string>((const char*) bstream.GetData(), bstream.GetNumberOfBytesUsed());
+		for (auto it = room->relays.begin(); it != room->relays.end(); it++) {
+			EnqueueEgress(room, *it, packet, priority, reliability, channel);
+			room->relayed_bytes += packet->size();
+		}
+	}
+}
+
+void RakNetServer::UpdateSpectators()
+{
+	clock::time_point now = clock::now();
+	clock::duration period = clock::duration::zero();
+	if (m_spectatorRate > 0.0f)
+		period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(1.0f / m_spectatorRate));
+
+	for (std::size_t i = 1; i < m_rooms.size(); i++)
+	{
+		unique<Room>& room = m_rooms[i];
+		if (room == nullptr || (room->spectators.empty() && room->relays.empty()) || now - room->spectated_at < period)
+			continue;
+
+		room->spectated_at = now;
+		for (auto it = room->spectated_reliable.begin(); it != room->spectated_reliable.end(); it++)
+			SendSpectators(room, it->data.data(), it->data.size(), STREAM_PRIORITY, it->reliability, it->channel);
+
+		for (auto it = room->spectated.begin(); it != room->spectated.end(); it++)
+			SendSpectators(room, it->second.data.data(), it->second.data.size(), STREAM_PRIORITY, it->second.reliability, it->second.channel);
+
+		room->spectated_reliable.clear();
+		room->spectated.clear();
+
+		std::uint32_t last = room->journal.Size() - 1;
+		if (room->spectated_entries >= last)
+			continue;
+
+		Proto::RoomEntriesStatus proto_entries;
+		PopulateProtoRoomEntriesStatus(room, &proto_entries);
+		for (int n = 0; n < SPECTATOR_MAX_ENTRIES && room->spectated_entries < last; n++)
+		{
+			Room::Entry entry;
+			room->spectated_entries++;
+			if (!room->journal.Read(room->spectated_entries, entry))
+				continue;
+
+			Proto::RoomEntry* proto_entry = proto_entries.add_entries();
+			proto_entry->set_id(room->spectated_entries);
+			proto_entry->set_from_slot(entry.from_slot);
+			proto_entry->set_entry_data(entry.data);
+		}
+
+		proto_entries.set_journal_size(room->spectated_entries);
+		RakNet::BitStream bstream;
+		if (WriteMessage(bstream, ID_JOURNAL_ENTRIES_STATUS, proto_entries))
+			SendSpectators(room, (const char*) bstream.GetData(), bstream.GetNumberOfBytesUsed(), JOURNAL_PRIORITY, RELIABLE, CHANNEL_JOURNAL);
+	}
+}
+
+void RakNetServer::SendRoomBroadcast(RakNet::SystemAddress addr, RakNet::Time timeStamp, RakNet::BitStream& in, std::uint8_t stream, BroadcastTarget target)
+{
+	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
+
+	if (client->joined_room > 0)
+	{
+		BIRIBIT_ASSERT(m_rooms[client->joined_room] != nullptr);
+		BIRIBIT_ASSERT(m_rooms[client->joined_room]->slots[client->joined_slot] == client->id);
+		unique<Room>& room = m_rooms[client->joined_room];
+		if (room->migrating)
+			return;
+
+		// The message id is the byte right before the read offset, the
+		// stream header before it on streams other than 0.
+		if (m_capture.IsOpen()) {
+			std::size_t offset = BITS_TO_BYTES(in.GetReadOffset()) - sizeof(RakNet::MessageID);
+			if (stream != 0)
+				offset -= sizeof(RakNet::MessageID) + sizeof(std::uint8_t);
+			Capture(CaptureRecord::CAPTURE_BROADCAST, client, (const char*) in.GetData() + offset, in.GetNumberOfBytesUsed() - offset);
+		}
+
+		std::uint8_t uint8_reliability;
+		in.Read(uint8_reliability);
+		PacketReliability reliability = (PacketReliability) uint8_reliability;
+		switch (reliability)
+		{
+		case UNRELIABLE:
+		case UNRELIABLE_SEQUENCED:
+		case RELIABLE:
+		case RELIABLE_ORDERED:
+		case RELIABLE_SEQUENCED:
+			break;
+		default:
+			reliability = UNRELIABLE;
+			break;
+		}
+
+		SlotSet recipients = room->members;
+		if (target == BROADCAST_TO_INTEREST)
+		{
+			std::uint32_t key;
+			if (!in.Read(key))
+				return;
+
+			auto it = room->interests.find(key);
+			if (it == room->interests.end())
+				return;
+
+			recipients &= it->second;
+		}
+		else if (target == BROADCAST_TO_SLOTS)
+		{
+			std::uint16_t mask_words;
+			if (!in.Read(mask_words))
+				return;
+
+			SlotSet mask(room->slots.size());
+			for (std::uint16_t w = 0; w < mask_words; w++)
+			{
+				SlotSet::word_t bits;
+				if (!in.Read(bits))
+					return;
+
+				if (w < mask.words_count())
+					mask.set_word(w, bits);
+			}
+
+			recipients &= mask;
+		}
+		else if (target == BROADCAST_TO_OTHERS)
+		{
+			recipients.reset(client->joined_slot);
+		}
+
+		// The payload is byte aligned after the headers, plugins read it in
+		// place.
+		const char* payload = (const char*) in.GetData() + BITS_TO_BYTES(in.GetReadOffset());
+		std::size_t payload_size = BITS_TO_BYTES(in.GetNumberOfUnreadBits());
+
+		Plugin* plugin = GetPlugin(room->tenant);
+		if (plugin != nullptr)
+		{
+			brbt_PluginBroadcast broadcast;
+			broadcast.room_id = room->id;
+			broadcast.from_slot = client->joined_slot;
+			broadcast.reliability = PluginReliability(reliability);
+			broadcast.stream = stream;
+			broadcast.data = payload;
+			broadcast.size = payload_size;
+			broadcast.replace_data = nullptr;
+			broadcast.replace_size = 0;
+
+			switch (plugin->BroadcastReceived(broadcast))
+			{
+			case BRBT_PLUGIN_CONSUME:
+				return;
+			case BRBT_PLUGIN_REPLACE:
+				payload = (const char*) broadcast.replace_data;
+				payload_size = broadcast.replace_size;
+				break;
+			default:
+				break;
+			}
+		}
+
+		std::uint32_t congested_recipients = RelayBroadcast(room, client->joined_slot, timeStamp, payload, payload_size, reliability, stream, recipients);
+		if (congested_recipients > 0)
+		{
+			clock::time_point now = clock::now();
+			if (now - client->last_congestion_hint >= std::chrono::seconds(1)) {
+				client->last_congestion_hint = now;
+				SendErrorCode(Biribit::WARN_ROOM_CONGESTED, addr);
+			}
+		}
+	}
+}
+
+std::uint32_t RakNetServer::RelayBroadcast(unique<Room>& room, std::uint32_t from_slot, RakNet::Time timeStamp, const char* data, std::size_t size, PacketReliability reliability, std::uint8_t stream, const SlotSet& recipients, bool spectated)
+{
+	// Synchronized clients get the compact timestamp, the rest RakNet's.
+	// Both packets are built only if someone needs them.
+	RakNet::BitStream bstream;
+	if (room->slots.size() > ROOM_MAX_SLOTS) {
+		bstream.Write((RakNet::MessageID) ID_BROADCAST_FROM_LARGE_ROOM);
+		bstream.Write((std::uint16_t) from_slot);
+	}
+	else {
+		bstream.Write((RakNet::MessageID) ID_BROADCAST_FROM_ROOM);
+		bstream.Write((std::uint8_t) from_slot);
+	}
+
+	if (size > 0)
+		bstream.Write(data, size);
+
+	shared<std::string> packets[2];
+	auto getPacket = [&](bool compact) -> shared<std::string>& {
+		shared<std::string>& packet = packets[compact ? 1 : 0];
+		if (packet == nullptr)
+		{
+			RakNet::BitStream header;
+			if (timeStamp != 0 && compact) {
+				header.Write((RakNet::MessageID) ID_TIMESTAMP_COMPACT);
+				header.Write(GetServerTime(timeStamp));
+			}
+			else if (timeStamp != 0) {
+				header.Write((RakNet::MessageID) ID_TIMESTAMP);
+				header.Write(timeStamp);
+			}
+
+			packet = std::make_shared<std::string>((const char*) header.GetData(), header.GetNumberOfBytesUsed());
+			packet->append((const char*) bstream.GetData(), bstream.GetNumberOfBytesUsed());
+		}
+
+		return packet;
+	};
+
+	bool unreliable = (reliability == UNRELIABLE || reliability == UNRELIABLE_SEQUENCED);
+	std::uint32_t congested_recipients = 0;
+	recipients.forEach([&](std::size_t slot) {
+		Client::id_t id = room->slots[slot];
+		BIRIBIT_ASSERT(m_clients[id] != nullptr);
+		unique<Client>& recipient = m_clients[id];
+		shared<std::string>& packet = getPacket(recipient->clock_sync);
+		if (unreliable && recipient->congested)
+		{
+			Client::Coalesced& latest = recipient->coalesced[(from_slot << 8) | stream];
+			latest.data = *packet;
+			latest.reliability = reliability;
+			latest.channel = CHANNEL_ROOM_STREAMS + stream;
+			congested_recipients++;
+			return;
+		}
+
+		EnqueueEgress(room, recipient->addr, packet, STREAM_PRIORITY, reliability, CHANNEL_ROOM_STREAMS + stream);
+		room->relayed_bytes += packet->size();
+	});
+
+	// Spectators get the timestamp-less packet on their next update.
+	if (spectated && (!room->spectators.empty() || !room->relays.empty()))
+	{
+		Client::Coalesced latest;
+		latest.data.assign((const char*) bstream.GetData(), bstream.GetNumberOfBytesUsed());
+		latest.reliability = reliability;
+		latest.channel = CHANNEL_ROOM_STREAMS + stream;
+		if (unreliable)
+			room->spectated[(from_slot << 8) | stream] = latest;
+		else
+			room->spectated_reliable.push_back(latest);
+	}
+
+	return congested_recipients;
+}
+
+void RakNetServer::SendRoomEntry(RakNet::SystemAddress addr, RakNet::BitStream& in)
+{
+	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
+
+	if (client->joined_room > 0)
+	{
+		BIRIBIT_ASSERT(m_rooms[client->joined_room] != nullptr);
+		BIRIBIT_ASSERT(m_rooms[client->joined_room]->slots[client->joined_slot] == client->id);
+		unique<Room>& room = m_rooms[client->joined_room];
+
+		std::size_t size = BITS_TO_BYTES(in.GetNumberOfUnreadBits());
+		Room::Entry newEntry;
+		newEntry.from_slot = client->joined_slot;
+		newEntry.data.resize(size + 1);
+		newEntry.data[size] = '\0';
+		in.Read(&newEntry.data[0], size);
+		Capture(CaptureRecord::CAPTURE_ENTRY, client, newEntry.data.data(), size);
+
+		if (room->migrating)
+			room->pending.push_back(newEntry);
+		else
+			AppendRoomEntry(room, newEntry);
+	}
+}
+
+void RakNetServer::AppendRoomEntry(unique<Room>& room, const Room::Entry& entry)
+{
+	room->journal.Append(entry);
+	m_journalHotBytes += entry.data.size();
+	m_tenants[room->tenant]->journal_hot_bytes += entry.data.size();
+	TrimJournals(room);
+	RoomTouched(room);
+
+	Room::Entry::id_t entry_id = room->journal.Size() - 1;
+	if (m_standby.linked) {
+		Proto::RoomEntry* proto_entry = AddReplicaRecord(room->id, Proto::ReplicaRecord::ROOM_ENTRIES)->add_entries();
+		proto_entry->set_id(room->journal.Size() - 1);
+		proto_entry->set_from_slot(entry.from_slot);
+		proto_entry->set_entry_data(entry.data);
+	}
+
+	Proto::RoomEntriesStatus proto_entries;
+	PopulateProtoRoomEntriesStatus(room, &proto_entries);
+	{
+		Proto::RoomEntry* proto_entry = proto_entries.add_entries();
+		proto_entry->set_id(room->journal.Size() - 1);
+		proto_entry->set_from_slot(entry.from_slot);
+		proto_entry->set_entry_data(entry.data);
+	}
+
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_JOURNAL_ENTRIES_STATUS, proto_entries)) {
+		shared<std::string> data = std::make_shared<std::string>((const char*) bstream.GetData(), bstream.GetNumberOfBytesUsed());
+		room->members.forEach([&](std::size_t slot) {
+			Client::id_t id = room->slots[slot];
+			BIRIBIT_ASSERT(m_clients[id] != nullptr);
+			EnqueueEgress(room, m_clients[id]->addr, data, JOURNAL_PRIORITY, RELIABLE, CHANNEL_JOURNAL);
+			room->relayed_bytes += data->size();
+		});
+	}
+
+	// Entries carry a trailing zero, plugins get the data without it.
+	Plugin* plugin = GetPlugin(room->tenant);
+	if (plugin != nullptr && !entry.data.empty())
+		plugin->EntryAppended(room->id, entry_id, entry.from_slot, entry.data.data(), entry.data.size() - 1);
+}
+
+void RakNetServer::TrimJournals(unique<Room>& room)
+{
+	// Spill down to three quarters of the budget, so appends don't hit the
+	// file every time.
+	if (m_journalRoomBudget > 0 && room->journal.HotBytes() > m_journalRoomBudget)
+		SpillJournal(*room, m_journalRoomBudget / 4 * 3);
+
+	// The app quota first, so one app's journals don't spill the others.
+	unique<Tenant>& tenant = m_tenants[room->tenant];
+	while (tenant->max_journal_bytes > 0 && tenant->journal_hot_bytes > tenant->max_journal_bytes)
+	{
+		Room* largest = nullptr;
+		for (auto it = tenant->rooms.begin(); it != tenant->rooms.end(); it++)
+			if (largest == nullptr || m_rooms[*it]->journal.HotBytes() > largest->journal.HotBytes())
+				largest = m_rooms[*it].get();
+
+		if (largest == nullptr || SpillJournal(*largest, largest->journal.HotBytes() / 2) == 0)
+			break;
+	}
+
+	while (m_journalBudget > 0 && m_journalHotBytes > m_journalBudget)
+	{
+		Room* largest = nullptr;
+		for (auto it = m_rooms.begin(); it != m_rooms.end(); it++)
+			if (*it != nullptr && (largest == nullptr || (*it)->journal.HotBytes() > largest->journal.HotBytes()))
+				largest = it->get();
+
+		if (largest == nullptr || SpillJournal(*largest, largest->journal.HotBytes() / 2) == 0)
+			break;
+	}
+}
+
+std::size_t RakNetServer::SpillJournal(Room& room, std::size_t max_hot_bytes)
+{
+	std::size_t released = room.journal.Spill(max_hot_bytes);
+	m_journalHotBytes -= released;
+	m_tenants[room.tenant]->journal_hot_bytes -= released;
+	return released;
+}
+
+void RakNetServer::RoomEntriesRequest(RakNet::SystemAddress addr, Proto::RoomEntriesRequest* proto_entriesReq)
+{
+	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
+
+	unique<Room>* target = nullptr;
+	if (client->joined_room > 0)
+	{
+		BIRIBIT_ASSERT(m_rooms[client->joined_room] != nullptr);
+		BIRIBIT_ASSERT(m_rooms[client->joined_room]->slots[client->joined_slot] == client->id);
+		target = &m_rooms[client->joined_room];
+	}
+	else if (client->spectated_room > 0)
+	{
+		target = GetSpectatedRoom(client->spectated_room);
+	}
+
+	if (target == nullptr)
+		return;
+
+	// Spectators of this server see the journal as far as it was flushed to
+	// them. A relay has only the flushed entries anyway.
+	unique<Room>& room = *target;
+	bool relayed = (client->joined_room == 0 && !m_origin.host.empty());
+	std::uint32_t last = (client->joined_room > 0 || relayed) ? room->journal.Size() - 1 : room->spectated_entries;
+
+	Proto::RoomEntriesStatus proto_entries;
+	PopulateProtoRoomEntriesStatus(room, &proto_entries);
+	proto_entries.set_journal_size(last);
+
+	std::set<std::uint32_t> entriesSet;
+	int size = proto_entriesReq->entries_id_size();
+	for (int i = 0; i < size; i++)
+	{
+		std::uint32_t id = proto_entriesReq->entries_id(i);
+		if (entriesSet.find(id) == entriesSet.end())
+		{
+			Room::Entry entry;
+			if (id > Room::Entry::UNASSIGNED_ID && id <= last && room->journal.Read(id, entry))
+			{
+				Proto::RoomEntry* proto_entry = proto_entries.add_entries();
+				proto_entry->set_id(id);
+				proto_entry->set_from_slot(entry.from_slot);
+				proto_entry->set_entry_data(entry.data);
+			}
+
+			entriesSet.insert(id);
+		}
+	}
+
+	RakNet::BitStream bstream;
+	if (!WriteMessage(bstream, ID_JOURNAL_ENTRIES_STATUS, proto_entries))
+		return;
+
+	if (relayed)
+		Send(&bstream, JOURNAL_PRIORITY, RELIABLE, CHANNEL_JOURNAL, addr, false);
+	else
+		EnqueueEgress(room, addr, std::make_shared<std::string>((const char*) bstream.GetData(), bstream.GetNumberOfBytesUsed()), JOURNAL_PRIORITY, RELIABLE, CHANNEL_JOURNAL);
+}
+
+std::uint64_t RakNetServer::NewToken()
+{
+	std::uint64_t token = 0;
+	while (token == 0 || m_reservations.find(token) != m_reservations.end())
+		token = m_random();
+
+	return token;
+}
+
+RakNetServer::Node* RakNetServer::GetNode(RakNet::SystemAddress addr)
+{
+	for (auto it = m_nodes.begin(); it != m_nodes.end(); it++)
+		if (it->addr == addr)
+			return &(*it);
+
+	return nullptr;
+}
+
+bool RakNetServer::LinkNode(RakNet::SystemAddress addr, Proto::ServerLoad* proto_load)
+{
+	// Only the nodes given with AddNode, anyone else stays a client.
+	Node* node = GetNode(addr);
+	if (node == nullptr) {
+		printLog("WARN: %s is not a configured node, hello ignored.", addr.ToString());
+		return false;
+	}
+
+	// Incoming links are accepted as regular clients until they say hello.
+	if (m_clientAddrMap.find(addr) != m_clientAddrMap.end())
+		RemoveClient(addr);
+
+	if (!node->linked)
+		printLog("Node %s linked.", addr.ToString());
+
+	node->linked = true;
+	if (proto_load != nullptr)
+		node->load = proto_load->relayed_bytes_per_second();
+
+	return true;
+}
+
+void RakNetServer::UnlinkNode(RakNet::SystemAddress addr)
+{
+	if (addr == m_standby.addr && m_standby.linked) {
+		printLog("Standby %s unlinked.", addr.ToString());
+		m_standby.linked = false;
+		m_replicaLog.Clear();
+		return;
+	}
+
+	if (addr == m_primary.addr && m_primary.linked) {
+		printLog("Primary %s is gone.", addr.ToString());
+		TakeOver();
+		return;
+	}
+
+	if (addr == m_origin.addr && m_origin.linked) {
+		UnlinkOrigin();
+		return;
+	}
+
+	for (auto it = m_relays.begin(); it != m_relays.end(); it++)
+	{
+		if (it->addr != addr || !it->linked)
+			continue;
+
+		printLog("Relay %s unlinked.", addr.ToString());
+		for (auto room = m_rooms.begin(); room != m_rooms.end(); room++)
+			if (*room != nullptr && (*room)->relays.erase(addr) > 0)
+				DropEgress((*room)->id, addr);
+
+		it->linked = false;
+		it->load = 0;
+		return;
+	}
+
+	Node* node = GetNode(addr);
+	if (node == nullptr || !node->linked)
+		return;
+
+	printLog("Node %s unlinked.", addr.ToString());
+	node->linked = false;
+
+	std::size_t node_index = node - &m_nodes[0];
+	std::vector<Room::id_t> aborted;
+	for (auto it = m_migrations.begin(); it != m_migrations.end(); it++)
+		if (it->node == node_index)
+			aborted.push_back(it->room);
+
+	for (auto it = aborted.begin(); it != aborted.end(); it++)
+		if (m_rooms[*it] != nullptr)
+			ThawRoom(m_rooms[*it]);
+}
+
+void RakNetServer::UpdateLoad()
+{
+	clock::time_point now = clock::now();
+	float seconds = std::chrono::duration<float>(now - m_lastLoadUpdate).count();
+	m_lastLoadUpdate = now;
+	if (seconds <= 0.0f)
+		return;
+
+	m_relayedBytes = 0;
+	for (auto it = m_rooms.begin(); it != m_rooms.end(); it++) {
+		if (*it != nullptr) {
+			m_relayedBytes += (*it)->relayed_bytes;
+			(*it)->load = (std::uint32_t)((*it)->relayed_bytes / seconds);
+			(*it)->relayed_bytes = 0;
+		}
+	}
+
+	m_load = (std::uint32_t)(m_relayedBytes / seconds);
+
+	Proto::ServerLoad proto_load;
+	PopulateProtoServerLoad(&proto_load);
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_NODE_LOAD, proto_load))
+		for (auto it = m_nodes.begin(); it != m_nodes.end(); it++)
+			if (it->linked)
+				Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, it->addr, false);
+}
+
+void RakNetServer::BalanceLoad()
+{
+	if (m_migrationThreshold == 0 || m_load <= m_migrationThreshold || !m_migrations.empty())
+		return;
+
+	// Hottest room that can be moved as a whole.
+	Room* hottest = nullptr;
+	for (auto it = m_rooms.begin(); it != m_rooms.end(); it++) {
+		Room* room = it->get();
+		if (room != nullptr && !room->migrating && room->reserved_slots_count == 0 && room->joined_clients_count > 0)
+			if (hottest == nullptr || room->load > hottest->load)
+				hottest = room;
+	}
+
+	if (hottest == nullptr || hottest->load == 0)
+		return;
+
+	// Least loaded node able to take it without becoming a hot spot itself.
+	std::size_t target = m_nodes.size();
+	for (std::size_t i = 0; i < m_nodes.size(); i++) {
+		const Node& node = m_nodes[i];
+		if (node.linked && node.load + hottest->load <= m_migrationThreshold)
+			if (target == m_nodes.size() || node.load < m_nodes[target].load)
+				target = i;
+	}
+
+	if (target < m_nodes.size())
+		MigrateRoom(m_rooms[hottest->id], target);
+}
+
+void RakNetServer::MigrateRoom(unique<Room>& room, std::size_t node_index)
+{
+	Node& node = m_nodes[node_index];
+
+	Migration migration;
+	migration.room = room->id;
+	migration.node = node_index;
+	migration.started = clock::now();
+
+	Proto::RoomMigration proto_migration;
+	proto_migration.set_source_room_id(room->id);
+	proto_migration.set_load(room->load);
+	if (!PopulateProtoRoomSnapshot(room, proto_migration.mutable_snapshot()))
+		return;
+
+	for (std::uint32_t slot = 0; slot < room->slots.size(); slot++)
+	{
+		Client::id_t id = room->slots[slot];
+		if (id != Client::UNASSIGNED_ID)
+		{
+			BIRIBIT_ASSERT(m_clients[id] != nullptr);
+			std::uint64_t token = NewToken();
+			Proto::RoomMigrationTicket* proto_ticket = proto_migration.add_tickets();
+			proto_ticket->set_token(token);
+			proto_ticket->set_slot(slot);
+			proto_ticket->set_name(m_clients[id]->name);
+			migration.tickets.push_back(std::make_pair(id, token));
+		}
+	}
+
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_NODE_ROOM_MIGRATE, proto_migration))
+	{
+		room->migrating = true;
+		m_migrations.push_back(migration);
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, node.addr, false);
+		printLog("Migrating room %d (%d B/s) to node %s.", room->id, room->load, node.addr.ToString());
+	}
+}
+
+void RakNetServer::RoomMigrationRequest(RakNet::SystemAddress addr, Proto::RoomMigration* proto_migration)
+{
+	Node* node = GetNode(addr);
+	if (node == nullptr || !node->linked) {
+		printLog("WARN: %s is not a linked node, migration request ignored.", addr.ToString());
+		return;
+	}
+
+	Proto::RoomMigration proto_response;
+	proto_response.set_source_room_id(proto_migration->source_room_id());
+
+	bool accepted = proto_migration->has_snapshot()
+		&& proto_migration->snapshot().slots_count() > 0
+		&& proto_migration->snapshot().slots_count() <= LARGE_ROOM_MAX_SLOTS
+		&& proto_migration->tickets_size() > 0;
+
+	if (accepted && m_migrationThreshold > 0 && m_load + proto_migration->load() > m_migrationThreshold)
+		accepted = false;
+
+	if (accepted)
+	{
+		const Proto::RoomSnapshot& proto_snapshot = proto_migration->snapshot();
+		unique<Room>& room = m_rooms[NewRoom(InternAppId(proto_snapshot.appid()), proto_snapshot.slots_count())];
+
+		int journal_size = proto_snapshot.journal_size();
+		for (int i = 0; i < journal_size; i++)
+		{
+			const Proto::RoomEntry& proto_entry = proto_snapshot.journal(i);
+			if (proto_entry.id() < room->journal.Size())
+				continue;
+
+			if (proto_entry.id() > JOURNAL_MAX_ENTRIES)
+				break;
+
+			while (room->journal.Size() < proto_entry.id())
+				room->journal.Append(Room::Entry());
+
+			Room::Entry entry;
+			entry.from_slot = proto_entry.from_slot();
+			entry.data = proto_entry.entry_data();
+			room->journal.Append(entry);
+			m_journalHotBytes += entry.data.size();
+			m_tenants[room->tenant]->journal_hot_bytes += entry.data.size();
+		}
+
+		room->migrated_from = addr;
+		room->migrated_until = clock::now() + MIGRATION_TIMEOUT;
+		RoomTouched(room);
+
+		TrimJournals(room);
+		if (m_standby.linked)
+			ReplicateRoom(room);
+
+		int tickets_size = proto_migration->tickets_size();
+		for (int i = 0; i < tickets_size; i++)
+		{
+			const Proto::RoomMigrationTicket& proto_ticket = proto_migration->tickets(i);
+			std::uint32_t slot = proto_ticket.slot();
+			if (!IsSlotFree(room, slot) || m_reservations.find(proto_ticket.token()) != m_reservations.end())
+				continue;
+
+			Reservation& reservation = m_reservations[proto_ticket.token()];
+			reservation.token = proto_ticket.token();
+			reservation.room = room->id;
+			reservation.slot = slot;
+			reservation.name = proto_ticket.name();
+			reservation.expires = clock::now() + RESERVATION_TIMEOUT;
+			room->reserved[slot] = reservation.token;
+			room->taken.set(slot);
+			room->reserved_slots_count++;
+		}
+
+		proto_response.set_target_room_id(room->id);
+		printLog("Room %d from node %s migrated as room %d.", proto_migration->source_room_id(), addr.ToString(), room->id);
+	}
+	else
+	{
+		proto_response.set_load(m_load);
+		printLog("Refused migration of room %d from node %s.", proto_migration->source_room_id(), addr.ToString());
+	}
+
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_NODE_ROOM_MIGRATED, proto_response))
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+}
+
+void RakNetServer::RoomMigrationResponse(RakNet::SystemAddress addr, Proto::RoomMigration* proto_migration)
+{
+	Node* node = GetNode(addr);
+	Room::id_t id = proto_migration->source_room_id();
+	auto migration_it = m_migrations.begin();
+	for (; migration_it != m_migrations.end() && migration_it->room != id; migration_it++);
+	if (node == nullptr || migration_it == m_migrations.end() || &m_nodes[migration_it->node] != node)
+		return;
+
+	Migration migration = *migration_it;
+	m_migrations.erase(migration_it);
+
+	BIRIBIT_ASSERT(id < m_rooms.size() && m_rooms[id] != nullptr);
+	unique<Room>& room = m_rooms[id];
+	if (!proto_migration->has_target_room_id())
+	{
+		if (proto_migration->has_load())
+			node->load = proto_migration->load();
+
+		printLog("Node %s refused room %d.", addr.ToString(), room->id);
+		ThawRoom(room);
+		return;
+	}
+
+	Room::id_t target_id = proto_migration->target_room_id();
+	if (!room->pending.empty())
+	{
+		Proto::RoomEntriesStatus proto_entries;
+		proto_entries.set_room_id(target_id);
+		for (std::size_t i = 0; i < room->pending.size(); i++)
+		{
+			Proto::RoomEntry* proto_entry = proto_entries.add_entries();
+			proto_entry->set_id(room->journal.Size() + i);
+			proto_entry->set_from_slot(room->pending[i].from_slot);
+			proto_entry->set_entry_data(room->pending[i].data);
+		}
+
+		RakNet::BitStream bstream;
+		if (WriteMessage(bstream, ID_NODE_ROOM_APPEND, proto_entries))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+	}
+
+	for (auto it = migration.tickets.begin(); it != migration.tickets.end(); it++)
+	{
+		unique<Client>& client = m_clients[it->first];
+		if (client == nullptr || client->joined_room != room->id)
+			continue;
+
+		Proto::RoomMigrated proto_migrated;
+		proto_migrated.set_address(node->host);
+		proto_migrated.set_port(node->port);
+		proto_migrated.set_room_id(target_id);
+		proto_migrated.set_token(it->second);
+
+		RakNet::BitStream bstream;
+		if (WriteMessage(bstream, ID_ROOM_MIGRATED, proto_migrated))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, client->addr, false);
+
+		VacateSlot(room, client);
+		DropEgress(room->id, client->addr);
+	}
+
+	printLog("Room %d migrated to node %s as room %d. Closing room.", room->id, addr.ToString(), target_id);
+	CloseRoom(room);
+}
+
+void RakNetServer::RoomMigrationAppend(RakNet::SystemAddress addr, Proto::RoomEntriesStatus* proto_entries)
+{
+	Node* node = GetNode(addr);
+	if (node == nullptr || !node->linked || !proto_entries->has_room_id())
+		return;
+
+	// Only to the room this node migrated to us, once.
+	Room::id_t id = proto_entries->room_id();
+	if (id == Room::UNASSIGNED_ID || id >= m_rooms.size() || m_rooms[id] == nullptr)
+		return;
+
+	unique<Room>& room = m_rooms[id];
+	if (room->migrated_from != addr || clock::now() > room->migrated_until) {
+		printLog("WARN: Node %s appended to room %d, not migrating from it.", addr.ToString(), id);
+		return;
+	}
+
+	room->migrated_from = RakNet::UNASSIGNED_SYSTEM_ADDRESS;
+	int size = proto_entries->entries_size();
+	for (int i = 0; i < size; i++)
+	{
+		Room::Entry entry;
+		entry.from_slot = proto_entries->entries(i).from_slot();
+		entry.data = proto_entries->entries(i).entry_data();
+		AppendRoomEntry(room, entry);
+	}
+}
+
+void RakNetServer::RoomMigrationClaim(RakNet::SystemAddress addr, Proto::RoomMigrationClaim* proto_claim)
+{
+	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
+
+	auto it = m_reservations.find(proto_claim->token());
+	if (it == m_reservations.end() && m_primary.linked)
+	{
+		// A client claiming a standby ticket has lost the primary already.
+		for (auto replica = m_replicas.begin(); replica != m_replicas.end(); replica++)
+		{
+			const std::vector<std::uint64_t>& reserved = replica->second->reserved;
+			if (std::find(reserved.begin(), reserved.end(), proto_claim->token()) != reserved.end()) {
+				printLog("Client (%d) \"%s\" claims a standby slot, the primary is gone.", client->id, client->name.c_str());
+				TakeOver();
+				it = m_reservations.find(proto_claim->token());
+				break;
+			}
+		}
+	}
+
+	if (it == m_reservations.end()) {
+		SendErrorCode(Biribit::WARN_CANNOT_CLAIM_WITH_INVALID_TOKEN, addr);
+		printLog("WARN: Client (%d) \"%s\" tried to claim a slot with an invalid token.", client->id, client->name.c_str());
+		return;
+	}
+
+	Reservation reservation = it->second;
+	BIRIBIT_ASSERT(m_rooms[reservation.room] != nullptr);
+	unique<Room>& room = m_rooms[reservation.room];
+
+	Proto::ClientUpdate proto_update;
+	if (!reservation.name.empty())
+		proto_update.set_name(reservation.name);
+	proto_update.set_appid(m_tenants[room->tenant]->appid);
+	UpdateClient(addr, &proto_update);
+	if (client->tenant != room->tenant)
+		return;	// Over the app quota, the reservation stays for a retry.
+
+	LeaveRoom(client);
+
+	m_reservations.erase(reservation.token);
+	room->reserved[reservation.slot] = 0;
+	room->reserved_slots_count--;
+	OccupySlot(room, reservation.slot, client);
+	printLog("Client (%d) \"%s\" claims slot %d in room %d.", client->id, client->name.c_str(), reservation.slot, room->id);
+	RoomChanged(room, { reservation.slot }, addr);
+
+	{
+		Proto::RoomJoin proto_join;
+		PopulateProtoRoomJoin(client, &proto_join);
+		RakNet::BitStream bstream;
+		if (WriteMessage(bstream, ID_ROOM_JOIN_RESPONSE, proto_join, client->codec))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+	}
+	{
+		// Entries past the client's cursor go along, sparing a round trip.
+		Proto::RoomEntriesStatus proto_entries;
+		PopulateProtoRoomEntriesStatus(room, &proto_entries);
+		if (proto_claim->has_last_entry_id())
+		{
+			Room::Entry entry;
+			std::size_t id = proto_claim->last_entry_id() + 1;
+			for (int count = 0; id < room->journal.Size() && count < RESUME_MAX_ENTRIES; id++, count++)
+			{
+				if (!room->journal.Read(id, entry))
+					break;
+
+				Proto::RoomEntry* proto_entry = proto_entries.add_entries();
+				proto_entry->set_id(id);
+				proto_entry->set_from_slot(entry.from_slot);
+				proto_entry->set_entry_data(entry.data);
+			}
+		}
+
+		RakNet::BitStream bstream;
+		if (WriteMessage(bstream, ID_JOURNAL_ENTRIES_STATUS, proto_entries))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+	}
+}
+
+void RakNetServer::ThawRoom(unique<Room>& room)
+{
+	if (m_handedOff)
+		return;
+
+	for (auto it = m_migrations.begin(); it != m_migrations.end();)
+		if (it->room == room->id)
+			it = m_migrations.erase(it);
+		else
+			it++;
+
+	room->migrating = false;
+	std::vector<Room::Entry> pending;
+	std::swap(pending, room->pending);
+	for (auto it = pending.begin(); it != pending.end(); it++)
+		AppendRoomEntry(room, *it);
+}
+
+void RakNetServer::ExpireReservations()
+{
+	clock::time_point now = clock::now();
+	std::vector<Room::id_t> to_check;
+	for (auto it = m_reservations.begin(); it != m_reservations.end();)
+	{
+		if (it->second.expires <= now)
+		{
+			unique<Room>& room = m_rooms[it->second.room];
+			BIRIBIT_ASSERT(room != nullptr);
+			room->reserved[it->second.slot] = 0;
+			room->taken.reset(it->second.slot);
+			room->reserved_slots_count--;
+			to_check.push_back(room->id);
+			it = m_reservations.erase(it);
+		}
+		else
+			it++;
+	}
+
+	for (auto it = to_check.begin(); it != to_check.end(); it++)
+	{
+		unique<Room>& room = m_rooms[*it];
+		if (room != nullptr && room->joined_clients_count == 0 && room->reserved_slots_count == 0) {
+			printLog("Room %d reservations expired. Closing room.", room->id);
+			CloseRoom(room);
+		}
+	}
+}
+
+void RakNetServer::UpdateEgress()
+{
+	clock::time_point now = clock::now();
+	if (now - m_lastEgressUpdate < EGRESS_PERIOD)
+		return;
+
+	m_lastEgressUpdate = now;
+	std::vector<RakNet::SystemAddress> to_disconnect;
+	RakNet::RakNetStatistics rns;
+	for (auto it = m_clients.begin(); it != m_clients.end(); it++)
+	{
+		unique<Client>& client = *it;
+		if (client == nullptr || m_peer->GetStatistics(client->addr, &rns) == nullptr)
+			continue;
+
+		double queued = (double) rns.bytesInResendBuffer;
+		for (int i = 0; i < NUMBER_OF_PRIORITIES; i++)
+			queued += rns.bytesInSendBuffer[i];
+
+		client->queued_bytes = (std::uint32_t) queued;
+		if (client->queued_bytes >= EGRESS_CONGESTED_BYTES)
+		{
+			if (!client->congested) {
+				client->congested = true;
+				client->congested_since = now;
+			}
+			else if (client->queued_bytes >= EGRESS_MAX_BYTES && now - client->congested_since >= EGRESS_MAX_CONGESTION)
+				to_disconnect.push_back(client->addr);
+		}
+		else if (client->congested)
+		{
+			client->congested = false;
+			FlushCoalesced(client);
+		}
+	}
+
+	for (auto it = to_disconnect.begin(); it != to_disconnect.end(); it++)
+	{
+		printLog("Client %s can't keep up with its traffic. Disconnecting.", it->ToString());
+		CloseConnection(*it);
+		RemoveClient(*it);
+	}
+}
+
+void RakNetServer::FlushCoalesced(unique<Client>& client)
+{
+	if (client->joined_room > 0)
+	{
+		BIRIBIT_ASSERT(m_rooms[client->joined_room] != nullptr);
+		unique<Room>& room = m_rooms[client->joined_room];
+		for (auto it = client->coalesced.begin(); it != client->coalesced.end(); it++)
+			EnqueueEgress(room, client->addr, std::make_shared<std::string>(it->second.data), STREAM_PRIORITY, it->second.reliability, it->second.channel);
+	}
+
+	client->coalesced.clear();
+}
+
+void RakNetServer::EnqueueEgress(unique<Room>& room, RakNet::SystemAddress addr, const shared<std::string>& data, PacketPriority priority, PacketReliability reliability, char channel)
+{
+	EgressQueue& queue = m_egressQueues[room->id];
+	bool unreliable = (reliability == UNRELIABLE || reliability == UNRELIABLE_SEQUENCED);
+	if (unreliable && queue.queued_bytes + data->size() > EGRESS_MAX_QUEUE_BYTES) {
+		m_egressDropped++;
+		return;
+	}
+
+	if (queue.packets.empty()) {
+		queue.tenant = room->tenant;
+		queue.deficit = 0.0f;
+		m_tenants[queue.tenant]->egress.active_rooms++;
+		m_egressActive.push_back(room->id);
+	}
+
+	Outgoing out;
+	out.data = data;
+	out.priority = priority;
+	out.reliability = reliability;
+	out.channel = channel;
+	out.addr = addr;
+	out.queued = clock::now();
+	queue.packets.push_back(out);
+	queue.queued_bytes += data->size();
+}
+
+void RakNetServer::DropEgress(Room::id_t room_id, RakNet::SystemAddress addr)
+{
+	auto it = m_egressQueues.find(room_id);
+	if (it == m_egressQueues.end())
+		return;
+
+	EgressQueue& queue = it->second;
+	for (auto out = queue.packets.begin(); out != queue.packets.end();)
+	{
+		if (addr == RakNet::UNASSIGNED_SYSTEM_ADDRESS || out->addr == addr) {
+			queue.queued_bytes -= out->data->size();
+			out = queue.packets.erase(out);
+		}
+		else {
+			out++;
+		}
+	}
+
+	if (queue.packets.empty()) {
+		m_tenants[queue.tenant]->egress.active_rooms--;
+		m_egressActive.erase(std::remove(m_egressActive.begin(), m_egressActive.end(), room_id), m_egressActive.end());
+		m_egressQueues.erase(it);
+	}
+}
+
+void RakNetServer::DrainEgress()
+{
+	clock::time_point now = clock::now();
+	std::size_t blocked = 0;
+	while (!m_egressActive.empty() && blocked < m_egressActive.size())
+	{
+		Room::id_t room_id = m_egressActive.front();
+		m_egressActive.pop_front();
+
+		EgressQueue& queue = m_egressQueues[room_id];
+		EgressBudget& budget = m_tenants[queue.tenant]->egress;
+		float quantum = EGRESS_QUANTUM * budget.weight / budget.active_rooms;
+		queue.deficit += quantum;
+
+		bool limited = false;
+		while (!queue.packets.empty() && queue.deficit > 0.0f)
+		{
+			Outgoing& out = queue.packets.front();
+			std::size_t size = out.data->size();
+			bool unreliable = (out.reliability == UNRELIABLE || out.reliability == UNRELIABLE_SEQUENCED);
+			if (unreliable && now - out.queued > EGRESS_MAX_DELAY) {
+				// Late unreliable data is worthless, skip it and keep the
+				// queueing delay of the room bounded.
+				m_egressDropped++;
+			}
+			else if (m_egressBucket.Available(now) && budget.bucket.Available(now)) {
+				m_egressBucket.Spend((float) size);
+				budget.bucket.Spend((float) size);
+				queue.deficit -= (float) size;
+				Send(out.data->data(), (int) size, out.priority, out.reliability, out.channel, out.addr, false);
+			}
+			else {
+				limited = true;
+				break;
+			}
+
+			queue.queued_bytes -= size;
+			queue.packets.pop_front();
+		}
+
+		if (queue.packets.empty()) {
+			budget.active_rooms--;
+			m_egressQueues.erase(room_id);
+			continue;
+		}
+
+		// Rooms over budget don't hoard credit while they wait.
+		if (limited) {
+			if (queue.deficit > quantum)
+				queue.deficit = quantum;
+			blocked++;
+		}
+		else {
+			blocked = 0;
+		}
+
+		m_egressActive.push_back(room_id);
+		if (!m_egressBucket.Available(now))
+			break;
+	}
+}
+
+void RakNetServer::ConnectNode(Node& node)
+{
+	if (node.linked)
+		return;
+
+	if (node.addr == RakNet::UNASSIGNED_SYSTEM_ADDRESS)
+		node.addr.FromStringExplicitPort(node.host.c_str(), node.port);
+
+	RakNet::ConnectionState state = m_peer->GetConnectionState(node.addr);
+	if (state == RakNet::IS_NOT_CONNECTED || state == RakNet::IS_DISCONNECTED)
+		m_peer->Connect(node.host.c_str(), node.port,
+			m_password.empty() ? nullptr : m_password.c_str(), (int)m_password.size());
+}
+
+RakNetServer::Node* RakNetServer::GetRelay(RakNet::SystemAddress addr)
+{
+	for (auto it = m_relays.begin(); it != m_relays.end(); it++)
+		if (it->addr == addr)
+			return &(*it);
+
+	return nullptr;
+}
+
+void RakNetServer::LinkRelay(RakNet::SystemAddress addr, Proto::ServerLoad* proto_load)
+{
+	// Only the relays given with AddRelay, spectators are sent to them.
+	Node* relay = GetRelay(addr);
+	if (relay == nullptr) {
+		printLog("WARN: %s is not a configured relay, ignored.", addr.ToString());
+		return;
+	}
+
+	// Relays connect as regular clients, like nodes.
+	if (m_clientAddrMap.find(addr) != m_clientAddrMap.end())
+		RemoveClient(addr);
+
+	if (!relay->linked)
+		printLog("Relay %s linked.", addr.ToString());
+
+	relay->linked = true;
+	relay->load = proto_load->connected_clients();
+}
+
+void RakNetServer::RelaySpectate(RakNet::SystemAddress addr, Proto::RoomSpectate* proto_spectate)
+{
+	Node* relay = GetRelay(addr);
+	if (relay == nullptr || !relay->linked || !proto_spectate->has_id())
+		return;
+
+	// Relays follow rooms for the spectators of one app, its own rooms only.
+	Room::id_t id = proto_spectate->id();
+	bool leave = proto_spectate->has_leave() && proto_spectate->leave();
+	if (id >= m_rooms.size() || m_rooms[id] == nullptr || (!leave && proto_spectate->appid() != m_tenants[m_rooms[id]->tenant]->appid))
+	{
+		Proto::RoomSpectate proto_stop;
+		RakNet::BitStream stop_bstream;
+		if (WriteMessage(stop_bstream, ID_ROOM_SPECTATE_RESPONSE, proto_stop)) {
+			RakNet::BitStream bstream;
+			WriteSpectateData(bstream, id, RELIABLE_ORDERED, CHANNEL_CONTROL, (const char*) stop_bstream.GetData(), stop_bstream.GetNumberOfBytesUsed());
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+		}
+		return;
+	}
+
+	unique<Room>& room = m_rooms[id];
+	if (leave) {
+		if (room->relays.erase(addr) > 0)
+			DropEgress(id, addr);
+		return;
+	}
+
+	if (room->spectators.empty() && room->relays.empty()) {
+		room->spectated_entries = room->journal.Size() - 1;
+		room->spectated.clear();
+		room->spectated_reliable.clear();
+	}
+
+	if (!room->relays.insert(addr).second)
+		return;
+
+	Proto::RoomSpectate proto_confirm;
+	proto_confirm.set_id(id);
+	RakNet::BitStream confirm_bstream;
+	if (WriteMessage(confirm_bstream, ID_ROOM_SPECTATE_RESPONSE, proto_confirm)) {
+		RakNet::BitStream bstream;
+		WriteSpectateData(bstream, id, RELIABLE_ORDERED, CHANNEL_CONTROL, (const char*) confirm_bstream.GetData(), confirm_bstream.GetNumberOfBytesUsed());
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+	}
+
+	// The relay keeps the status and the journal flushed so far, later
+	// entries come with the spectator updates.
+	ResponseCache::Response response = GetResponse(ID_ROOM_STATUS, room->id);
+	if (response != nullptr) {
+		RakNet::BitStream bstream;
+		WriteSpectateData(bstream, id, RELIABLE_ORDERED, CHANNEL_CONTROL, response->data(), response->size());
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, addr, false);
+	}
+
+	Proto::RoomEntriesStatus proto_entries;
+	PopulateProtoRoomEntriesStatus(room, &proto_entries);
+	proto_entries.set_journal_size(room->spectated_entries);
+	for (std::uint32_t entry_id = 1; entry_id <= room->spectated_entries; entry_id++)
+	{
+		Room::Entry entry;
+		if (!room->journal.Read(entry_id, entry))
+			break;
+
+		Proto::RoomEntry* proto_entry = proto_entries.add_entries();
+		proto_entry->set_id(entry_id);
+		proto_entry->set_from_slot(entry.from_slot);
+		proto_entry->set_entry_data(entry.data);
+	}
+
+	RakNet::BitStream entries_bstream;
+	if (WriteMessage(entries_bstream, ID_JOURNAL_ENTRIES_STATUS, proto_entries)) {
+		RakNet::BitStream bstream;
+		WriteSpectateData(bstream, id, RELIABLE, CHANNEL_JOURNAL, (const char*) entries_bstream.GetData(), entries_bstream.GetNumberOfBytesUsed());
+		Send(&bstream, JOURNAL_PRIORITY, RELIABLE_ORDERED, CHANNEL_JOURNAL, addr, false);
+	}
+}
+
+void RakNetServer::LinkOrigin()
+{
+	if (!m_origin.linked)
+		printLog("Relaying spectators of %s.", m_origin.addr.ToString());
+
+	m_origin.linked = true;
+	Proto::ServerLoad proto_load;
+	PopulateProtoServerLoad(&proto_load);
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_NODE_RELAY, proto_load))
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, m_origin.addr, false);
+}
+
+void RakNetServer::UnlinkOrigin()
+{
+	printLog("Origin %s unlinked.", m_origin.addr.ToString());
+	m_origin.linked = false;
+
+	Proto::RoomSpectate proto_stop;
+	RakNet::BitStream bstream;
+	WriteMessage(bstream, ID_ROOM_SPECTATE_RESPONSE, proto_stop);
+	for (auto rooms : { &m_relayed, &m_following })
+	{
+		for (auto it = rooms->begin(); it != rooms->end(); it++)
+		{
+			for (auto spectator = it->second->spectators.begin(); spectator != it->second->spectators.end(); spectator++) {
+				BIRIBIT_ASSERT(m_clients[*spectator] != nullptr);
+				m_clients[*spectator]->spectated_room = Room::UNASSIGNED_ID;
+				Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, m_clients[*spectator]->addr, false);
+			}
+		}
+	}
+
+	m_relayed.clear();
+	m_following.clear();
+}
+
+void RakNetServer::RelaySpectateData(RakNet::SystemAddress addr, RakNet::BitStream& in)
+{
+	std::uint32_t room_id;
+	std::uint8_t reliability, channel;
+	if (addr != m_origin.addr || !in.Read(room_id) || !in.Read(reliability) || !in.Read(channel))
+		return;
+
+	std::size_t size = BITS_TO_BYTES(in.GetNumberOfUnreadBits());
+	if (size == 0)
+		return;
+
+	const char* message = (const char*) in.GetData() + BITS_TO_BYTES(in.GetReadOffset());
+	RakNet::MessageID msgId;
+	in.Read(msgId);
+
+	// The origin answers a follow first, the waiting spectators get its
+	// answer and the room is relayed only once confirmed.
+	auto follow = m_following.find(room_id);
+	if (follow != m_following.end() && msgId == ID_ROOM_SPECTATE_RESPONSE)
+	{
+		unique<Room> followed = std::move(follow->second);
+		m_following.erase(follow);
+
+		Proto::RoomSpectate proto_response;
+		bool confirmed = ReadMessage(proto_response, in) && proto_response.has_id();
+		for (auto spectator = followed->spectators.begin(); spectator != followed->spectators.end(); spectator++)
+		{
+			BIRIBIT_ASSERT(m_clients[*spectator] != nullptr);
+			Send(message, (int) size, MEDIUM_PRIORITY, (PacketReliability) reliability, channel, m_clients[*spectator]->addr, false);
+			if (!confirmed)
+				m_clients[*spectator]->spectated_room = Room::UNASSIGNED_ID;
+		}
+
+		if (confirmed)
+			m_relayed[room_id] = std::move(followed);
+		return;
+	}
+
+	auto it = m_relayed.find(room_id);
+	if (it == m_relayed.end())
+		return;
+
+	unique<Room>& room = it->second;
+
+	bool closed = false;
+	switch (msgId)
+	{
+	case ID_ROOM_STATUS:
+	{
+		Proto::Room proto_room;
+		if (ReadMessage(proto_room, in)) {
+			room->slots.assign(proto_room.joined_id_client().begin(), proto_room.joined_id_client().end());
+			room->version = proto_room.version();
+		}
+		break;
+	}
+	case ID_JOURNAL_ENTRIES_STATUS:
+	{
+		// Entries come in order, from the journal snapshot on.
+		Proto::RoomEntriesStatus proto_entries;
+		if (ReadMessage(proto_entries, in)) {
+			for (int i = 0; i < proto_entries.entries_size(); i++)
+			{
+				const Proto::RoomEntry& proto_entry = proto_entries.entries(i);
+				if (proto_entry.id() != room->journal.Size())
+					continue;
+
+				Room::Entry entry;
+				entry.from_slot = proto_entry.from_slot();
+				entry.data = proto_entry.entry_data();
+				room->journal.Append(entry);
+			}
+		}
+		break;
+	}
+	case ID_ROOM_SPECTATE_RESPONSE:
+	{
+		// Without id the room is gone, a confirmation again changes nothing.
+		Proto::RoomSpectate proto_response;
+		if (ReadMessage(proto_response, in) && proto_response.has_id())
+			return;
+
+		closed = true;
+		break;
+	}
+	default:
+		break;
+	}
+
+	for (auto spectator = room->spectators.begin(); spectator != room->spectators.end(); spectator++)
+	{
+		BIRIBIT_ASSERT(m_clients[*spectator] != nullptr);
+		Send(message, (int) size, MEDIUM_PRIORITY, (PacketReliability) reliability, channel, m_clients[*spectator]->addr, false);
+		if (closed)
+			m_clients[*spectator]->spectated_room = Room::UNASSIGNED_ID;
+	}
+
+	if (closed)
+		m_relayed.erase(it);
+}
+
+Proto::ReplicaRecord* RakNetServer::AddReplicaRecord(Room::id_t room_id, Proto::ReplicaRecord::Type type)
+{
+	// Consecutive entries or slot changes of a room share one record.
+	int size = m_replicaLog.records_size();
+	if (size > 0 && type != Proto::ReplicaRecord::ROOM_OPENED && type != Proto::ReplicaRecord::ROOM_CLOSED)
+	{
+		Proto::ReplicaRecord* proto_last = m_replicaLog.mutable_records(size - 1);
+		if (proto_last->room_id() == room_id && proto_last->type() == type)
+			return proto_last;
+	}
+
+	Proto::ReplicaRecord* proto_record = m_replicaLog.add_records();
+	proto_record->set_type(type);
+	proto_record->set_room_id(room_id);
+	return proto_record;
+}
+
+bool RakNetServer::ReplicateRoom(unique<Room>& room)
+{
+	Proto::ReplicaRecord* proto_record = AddReplicaRecord(room->id, Proto::ReplicaRecord::ROOM_OPENED);
+	if (!PopulateProtoRoomSnapshot(room, proto_record->mutable_snapshot())) {
+		m_replicaLog.mutable_records()->RemoveLast();
+		return false;
+	}
+	room->members.forEach([&](std::size_t slot) {
+		Client::id_t id = room->slots[slot];
+		BIRIBIT_ASSERT(m_clients[id] != nullptr);
+		unique<Client>& client = m_clients[id];
+		if (m_standby.linked)
+			SendStandbyTicket(client);
+
+		Proto::RoomMigrationTicket* proto_ticket = proto_record->add_tickets();
+		proto_ticket->set_token(client->resume_token);
+		proto_ticket->set_slot(slot);
+		proto_ticket->set_name(client->name);
+	});
+
+	// Sessions on hold, waiting for their clients to resume.
+	for (auto it = m_reservations.begin(); it != m_reservations.end(); it++)
+	{
+		if (it->second.room != room->id)
+			continue;
+
+		Proto::RoomMigrationTicket* proto_ticket = proto_record->add_tickets();
+		proto_ticket->set_token(it->second.token);
+		proto_ticket->set_slot(it->second.slot);
+		proto_ticket->set_name(it->second.name);
+	}
+
+	return true;
+}
+
+void RakNetServer::ReplicateSlot(unique<Room>& room, std::uint32_t slot, std::uint64_t token, const std::string& name)
+{
+	Proto::RoomMigrationTicket* proto_ticket = AddReplicaRecord(room->id, Proto::ReplicaRecord::ROOM_SLOTS)->add_tickets();
+	proto_ticket->set_token(token);
+	proto_ticket->set_slot(slot);
+	if (token != 0)
+		proto_ticket->set_name(name);
+}
+
+void RakNetServer::SendStandbyTicket(unique<Client>& client)
+{
+	Proto::RoomMigrated proto_standby;
+	proto_standby.set_address(m_standby.host);
+	proto_standby.set_port(m_standby.port);
+	proto_standby.set_room_id(client->joined_room);
+	proto_standby.set_token(client->resume_token);
+
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_ROOM_STANDBY, proto_standby))
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, client->addr, false);
+}
+
+void RakNetServer::SendResumeTicket(unique<Client>& client)
+{
+	Proto::RoomMigrated proto_resume;
+	proto_resume.set_address("");
+	proto_resume.set_port(0);
+	proto_resume.set_room_id(client->joined_room);
+	proto_resume.set_token(client->resume_token);
+
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_ROOM_RESUME, proto_resume))
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, client->addr, false);
+}
+
+void RakNetServer::HoldSession(RakNet::SystemAddress addr)
+{
+	unique<Client>& client = GetClient(addr);
+	if (client == nullptr)
+		return;
+
+	if (client->joined_room == Room::UNASSIGNED_ID || client->resume_token == 0)
+		return;
+
+	BIRIBIT_ASSERT(m_rooms[client->joined_room] != nullptr);
+	unique<Room>& room = m_rooms[client->joined_room];
+	if (room->migrating)
+		return;
+
+	std::uint32_t slot = client->joined_slot;
+	std::uint64_t token = client->resume_token;
+	ClearSlotInterests(room, slot);
+	VacateSlot(room, client);
+	DropEgress(room->id, client->addr);
+
+	Reservation& reservation = m_reservations[token];
+	reservation.token = token;
+	reservation.room = room->id;
+	reservation.slot = slot;
+	reservation.name = client->name;
+	reservation.expires = clock::now() + RESUME_TIMEOUT;
+	room->reserved[slot] = token;
+	room->taken.set(slot);
+	room->reserved_slots_count++;
+	if (m_standby.linked)
+		ReplicateSlot(room, slot, token, reservation.name);
+
+	printLog("Client (%d) \"%s\" lost. Holding slot %d in room %d.", client->id, client->name.c_str(), slot, room->id);
+	RoomChanged(room, { slot });
+}
+
+void RakNetServer::LinkStandby()
+{
+	printLog("Standby %s linked. Replicating %d rooms.", m_standby.addr.ToString(), (int) (m_rooms.size() - 1));
+	m_standby.linked = true;
+	m_replicaLog.Clear();
+	m_replicaLog.set_reset(true);
+	for (auto it = m_rooms.begin(); it != m_rooms.end(); it++)
+		if (*it != nullptr)
+			ReplicateRoom(*it);
+}
+
+void RakNetServer::ShipReplicaLog()
+{
+	if (!m_standby.linked || (m_replicaLog.records_size() == 0 && !m_replicaLog.reset()))
+		return;
+
+	m_replicaLog.set_sequence(++m_replicaSequence);
+	RakNet::BitStream bstream;
+	if (WriteMessage(bstream, ID_NODE_REPLICA_LOG, m_replicaLog))
+		Send(&bstream, MEDIUM_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, m_standby.addr, false);
+
+	m_replicaLog.Clear();
+}
+
+void RakNetServer::ApplyReplicaLog(RakNet::SystemAddress addr, Proto::ReplicaLog* proto_log)
+{
+	if (m_primary.host.empty() || addr != m_primary.addr) {
+		printLog("WARN: %s is not the primary of this server, replica log ignored.", addr.ToString());
+		return;
+	}
+
+	if (!m_primary.linked)
+	{
+		// The primary is accepted as a regular client until it ships a log.
+		if (m_clientAddrMap.find(addr) != m_clientAddrMap.end())
+			RemoveClient(addr);
+
+		printLog("Standing by for %s.", addr.ToString());
+		m_primary.linked = true;
+	}
+
+	if (!proto_log->reset() && proto_log->sequence() != m_replicaSequence + 1)
+		printLog("WARN: Replica log from %s skipped from %llu to %llu.", addr.ToString(), (unsigned long long) m_replicaSequence, (unsigned long long) proto_log->sequence());
+
+	m_replicaSequence = proto_log->sequence();
+	ApplyReplicaRecords(*proto_log);
+}
+
+void RakNetServer::ApplyReplicaRecords(const Proto::ReplicaLog& proto_log)
+{
+	if (proto_log.reset()) {
+		m_replicas.clear();
+		m_replicaNames.clear();
+	}
+
+	int records_size = proto_log.records_size();
+	for (int i = 0; i < records_size; i++)
+	{
+		const Proto::ReplicaRecord& proto_record = proto_log.records(i);
+		Room::id_t room_id = proto_record.room_id();
+		if (room_id == Room::UNASSIGNED_ID || room_id > ROOM_MAX_ID)
+			continue;
+
+		if (proto_record.type() == Proto::ReplicaRecord::ROOM_OPENED)
+		{
+			const Proto::RoomSnapshot& proto_snapshot = proto_record.snapshot();
+			if (proto_snapshot.slots_count() == 0 || proto_snapshot.slots_count() > LARGE_ROOM_MAX_SLOTS)
+				continue;
+
+			unique<Room> replica(new Room());
+			replica->id = room_id;
+			replica->tenant = InternAppId(proto_snapshot.appid());
+			replica->slots.resize(proto_snapshot.slots_count(), Client::UNASSIGNED_ID);
+			replica->members.resize(proto_snapshot.slots_count());
+			replica->taken.resize(proto_snapshot.slots_count());
+			replica->reserved.resize(proto_snapshot.slots_count(), 0);
+			for (int j = 0; j < proto_snapshot.journal_size(); j++)
+			{
+				const Proto::RoomEntry& proto_entry = proto_snapshot.journal(j);
+				if (proto_entry.id() > JOURNAL_MAX_ENTRIES)
+					break;
+
+				while (replica->journal.Size() < proto_entry.id())
+					replica->journal.Append(Room::Entry());
+
+				if (proto_entry.id() == replica->journal.Size()) {
+					Room::Entry entry;
+					entry.from_slot = proto_entry.from_slot();
+					entry.data = proto_entry.entry_data();
+					replica->journal.Append(entry);
+				}
+			}
+
+			m_replicas[room_id] = std::move(replica);
+		}
+		else if (proto_record.type() == Proto::ReplicaRecord::ROOM_CLOSED)
+		{
+			m_replicas.erase(room_id);
+			continue;
+		}
+
+		auto it = m_replicas.find(room_id);
+		if (it == m_replicas.end())
+			continue;
+
+		unique<Room>& replica = it->second;
+		for (int j = 0; j < proto_record.entries_size(); j++)
+		{
+			const Proto::RoomEntry& proto_entry = proto_record.entries(j);
+			if (proto_entry.id() != replica->journal.Size())
+				continue;
+
+			Room::Entry entry;
+			entry.from_slot = proto_entry.from_slot();
+			entry.data = proto_entry.entry_data();
+			replica->journal.Append(entry);
+		}
+
+		for (int j = 0; j < proto_record.tickets_size(); j++)
+		{
+			const Proto::RoomMigrationTicket& proto_ticket = proto_record.tickets(j);
+			std::uint32_t slot = proto_ticket.slot();
+			if (slot >= replica->reserved.size())
+				continue;
+
+			if (replica->reserved[slot] != 0) {
+				m_replicaNames.erase(replica->reserved[slot]);
+				replica->reserved_slots_count--;
+			}
+
+			replica->reserved[slot] = proto_ticket.token();
+			if (replica->reserved[slot] != 0) {
+				if (!proto_ticket.name().empty())
+					m_replicaNames[proto_ticket.token()] = proto_ticket.name();
+				replica->reserved_slots_count++;
+			}
+		}
+
+		if (m_journalRoomBudget > 0 && replica->journal.HotBytes() > m_journalRoomBudget)
+			replica->journal.Spill(m_journalRoomBudget / 4 * 3);
+	}
+}
+
+void RakNetServer::TakeOver()
+{
+	printLog("Taking over %d rooms.", (int) m_replicas.size());
+	if (m_primary.linked) {
+		m_peer->CloseConnection(m_primary.addr, true);
+		m_primary.linked = false;
+	}
+
+	m_replicaSequence = 0;
+
+	clock::time_point expires = clock::now() + RESERVATION_TIMEOUT;
+	for (auto it = m_replicas.begin(); it != m_replicas.end(); it++)
+	{
+		unique<Room>& replica = it->second;
+		for (std::size_t slot = 0; slot < replica->reserved.size(); slot++)
+		{
+			// Held for another room already, the slot can't be claimed here.
+			std::uint64_t token = replica->reserved[slot];
+			if (token != 0 && m_reservations.find(token) != m_reservations.end()) {
+				replica->reserved[slot] = 0;
+				replica->reserved_slots_count--;
+			}
+		}
+
+		if (replica->reserved_slots_count == 0)
+			continue;
+
+		if (replica->id >= m_rooms.size())
+			m_rooms.resize(replica->id + 1);
+
+		if (m_rooms[replica->id] != nullptr) {
+			printLog("WARN: Room %d is already in use, its replica is lost.", replica->id);
+			continue;
+		}
+
+		for (std::size_t slot = 0; slot < replica->reserved.size(); slot++)
+		{
+			std::uint64_t token = replica->reserved[slot];
+			if (token == 0)
+				continue;
+
+			Reservation& reservation = m_reservations[token];
+			reservation.token = token;
+			reservation.room = replica->id;
+			reservation.slot = slot;
+			reservation.expires = expires;
+			auto name = m_replicaNames.find(token);
+			if (name != m_replicaNames.end())
+				reservation.name = name->second;
+			replica->taken.set(slot);
+		}
+
+		m_tenants[replica->tenant]->rooms.insert(replica->id);
+		RoomTouched(replica);
+		m_tenants[replica->tenant]->journal_hot_bytes += replica->journal.HotBytes();
+		m_journalHotBytes += replica->journal.HotBytes();
+		m_roomsCount++;
+		m_rooms[replica->id] = std::move(replica);
+
+		// Plugin state isn't replicated, to the plugin the room is new.
+		Plugin* plugin = GetPlugin(m_rooms[it->first]->tenant);
+		if (plugin != nullptr)
+			plugin->RoomCreated(it->first, m_rooms[it->first]->slots.size());
+	}
+
+	m_replicas.clear();
+	m_replicaNames.clear();
+}
+
+bool RakNetServer::WriteHandoff()
+{
+	// Rooms are frozen from the snapshot on, nothing they do after it would
+	// reach the next process. They stay frozen until Close.
+	m_handedOff = true;
+	for (auto it = m_rooms.begin(); it != m_rooms.end(); it++)
+		if (*it != nullptr)
+			(*it)->migrating = true;
+
+	// The standby drops its replicas, the next process links it again.
+	m_replicaLog.Clear();
+	m_replicaLog.set_reset(true);
+	ShipReplicaLog();
+	m_standby.linked = false;
+
+	m_replicaLog.Clear();
+	m_replicaLog.set_sequence(0);
+	m_replicaLog.set_reset(true);
+
+	// Members already hold resume tickets, the next process honours them.
+	// Without every room whole there's no snapshot at all.
+	bool written = true;
+	for (auto it = m_rooms.begin(); it != m_rooms.end() && written; it++)
+		if (*it != nullptr && ((*it)->joined_clients_count > 0 || (*it)->reserved_slots_count > 0))
+			written = ReplicateRoom(*it);
+
+	std::string data;
+	written = written && m_replicaLog.SerializeToString(&data);
+	m_replicaLog.Clear();
+	if (written)
+	{
+		std::ofstream file(m_handoffFile.c_str(), std::ios::binary | std::ios::trunc);
+		written = file.write(data.data(), data.size()).good();
+	}
+
+	if (written)
+		printLog("Handoff snapshot written to \"%s\" (%d bytes).", m_handoffFile.c_str(), (int) data.size());
+	else
+		printLog("Unable to write handoff snapshot to \"%s\".", m_handoffFile.c_str());
+
+	return written;
+}
+
+void RakNetServer::ReadHandoff()
+{
+	std::ifstream file(m_handoffFile.c_str(), std::ios::binary);
+	if (!file.is_open())
+		return;
+
+	std::stringstream data;
+	data << file.rdbuf();
+	file.close();
+	std::remove(m_handoffFile.c_str());
+
+	Proto::ReplicaLog proto_log;
+	if (!proto_log.ParseFromString(data.str())) {
+		printLog("Handoff snapshot \"%s\" is corrupt, starting empty.", m_handoffFile.c_str());
+		return;
+	}
+
+	printLog("Loading handoff snapshot \"%s\".", m_handoffFile.c_str());
+	ApplyReplicaRecords(proto_log);
+	TakeOver();
+}
+
+void RakNetServer::Tick()
+{
+	clock::time_point now = clock::now();
+	if (now - m_lastTick < std::chrono::seconds(1))
+		return;
+
+	m_lastTick = now;
+	ExpireReservations();
+	m_capture.Flush();
+
+	std::vector<Room::id_t> timed_out;
+	for (auto it = m_migrations.begin(); it != m_migrations.end(); it++)
+		if (now - it->started > MIGRATION_TIMEOUT)
+			timed_out.push_back(it->room);
+
+	for (auto it = timed_out.begin(); it != timed_out.end(); it++) {
+		printLog("Migration of room %d timed out.", *it);
+		ThawRoom(m_rooms[*it]);
+	}
+
+	if (now - m_lastLoadUpdate >= LOAD_PERIOD)
+	{
+		for (auto it = m_nodes.begin(); it != m_nodes.end(); it++)
+			ConnectNode(*it);
+
+		if (!m_standby.host.empty())
+			ConnectNode(m_standby);
+
+		// Linked relays refresh their load at the origin.
+		if (m_origin.linked)
+			LinkOrigin();
+		else if (!m_origin.host.empty())
+			ConnectNode(m_origin);
+
+		UpdateLoad();
+		BalanceLoad();
+		ReportThrottled();
+	}
+}
+
+std::uint32_t RakNetServer::GetServerTime(RakNet::Time local)
+{
+	return (std::uint32_t) (local - m_clockEpoch);
+}
+
+RakNet::Time RakNetServer::GetLocalTime(std::uint32_t server_time)
+{
+	// Relative to now, so wrapping server times still convert.
+	RakNet::Time now = RakNet::GetTime();
+	std::int32_t delta = (std::int32_t) (server_time - GetServerTime(now));
+	return (RakNet::Time) ((std::int64_t) now + delta);
+}
+
+Plugin* RakNetServer::GetPlugin(Tenant::id_t tenant)
+{
+	return m_tenants[tenant]->plugin.get();
+}
+
+void RakNetServer::TickPlugins()
+{
+	clock::time_point now = clock::now();
+	if (m_pluginsCount == 0 || now - m_lastPluginTick < PLUGIN_TICK_PERIOD)
+		return;
+
+	unsigned int elapsed_ms = (unsigned int) std::chrono::duration_cast<std::chrono::milliseconds>(now - m_lastPluginTick).count();
+	m_lastPluginTick = now;
+	for (std::size_t i = 1; i < m_rooms.size(); i++)
+	{
+		if (m_rooms[i] == nullptr || m_rooms[i]->migrating)
+			continue;
+
+		Plugin* plugin = GetPlugin(m_rooms[i]->tenant);
+		if (plugin != nullptr && plugin->HasRoomTick())
+			plugin->RoomTick(m_rooms[i]->id, elapsed_ms);
+	}
+}
+
+void RakNetServer::Capture(std::uint8_t type, unique<Client>& client, const char* data, std::size_t size)
+{
+	if (!m_capture.IsOpen())
+		return;
+
+	m_capture.Write(type, RakNet::GetTime() - m_captureStart, client->id, client->joined_room, client->joined_slot, data, size);
+}
+
+RakNetServer::Room* RakNetServer::GetPluginRoom(unsigned int room_id)
+{
+	if (room_id == Room::UNASSIGNED_ID || room_id >= m_rooms.size() || m_rooms[room_id] == nullptr)
+		return nullptr;
+
+	return m_rooms[room_id].get();
+}
+
+void RakNetServer::PluginBroadcast(void* server, unsigned int room_id, unsigned int from_slot, const void* data, unsigned int size, unsigned int reliability, unsigned char stream)
+{
+	RakNetServer* self = static_cast<RakNetServer*>(server);
+	Room* room = self->GetPluginRoom(room_id);
+	if (room == nullptr || room->migrating || from_slot >= room->slots.size())
+		return;
+
+	self->RelayBroadcast(self->m_rooms[room_id], from_slot, 0, (const char*) data, size, PluginReliability(reliability), stream % ROOM_MAX_STREAMS, room->members);
+}
+
+void RakNetServer::PluginSendTo(void* server, unsigned int room_id, unsigned int slot, unsigned int from_slot, const void* data, unsigned int size, unsigned int reliability, unsigned char stream)
+{
+	RakNetServer* self = static_cast<RakNetServer*>(server);
+	Room* room = self->GetPluginRoom(room_id);
+	if (room == nullptr || room->migrating || from_slot >= room->slots.size() || slot >= room->slots.size() || !room->members.test(slot))
+		return;
+
+	SlotSet recipients(room->slots.size());
+	recipients.set(slot);
+	self->RelayBroadcast(self->m_rooms[room_id], from_slot, 0, (const char*) data, size, PluginReliability(reliability), stream % ROOM_MAX_STREAMS, recipients, false);
+}
+
+void RakNetServer::PluginAppendEntry(void* server, unsigned int room_id, unsigned int from_slot, const void* data, unsigned int size)
+{
+	RakNetServer* self = static_cast<RakNetServer*>(server);
+	Room* room = self->GetPluginRoom(room_id);
+	if (room == nullptr || from_slot >= room->slots.size())
+		return;
+
+	Room::Entry newEntry;
+	newEntry.from_slot = from_slot;
+	newEntry.data.assign((const char*) data, size);
+	newEntry.data.push_back('\0');
+
+	if (room->migrating)
+		room->pending.push_back(newEntry);
+	else
+		self->AppendRoomEntry(self->m_rooms[room_id], newEntry);
+}
+
+void RakNetServer::PluginLog(void* server, const char* message)
+{
+	printLog("Plugin: %s", message);
+}
+
+ResponseCache::Response RakNetServer::GetResponse(RakNet::MessageID msgId, std::uint32_t scope)
+{
+	ResponseCache::Response response = m_responses.Get(msgId, scope);
+	if (response != nullptr)
+		return response;
+
+	RakNet::BitStream bstream;
+	bool written = false;
+	switch (msgId)
+	{
+	case ID_SERVER_INFO_RESPONSE:
+	{
+		Proto::ServerInfo proto_info;
+		PopulateProtoServerInfo(&proto_info);
+		written = WriteMessage(bstream, msgId, proto_info);
+		break;
+	}
+	case ID_SERVER_STATUS_RESPONSE:
+	{
+		Proto::ServerStatus proto_status;
+		for (std::size_t i = 0; i < m_clients.size(); i++)
+		{
+			if (m_clients[i] != nullptr)
+			{
+				Proto::Client* proto_client = proto_status.add_clients();
+				PopulateProtoClient(m_clients[i], proto_client);
+			}
+		}
+
+		written = WriteMessage(bstream, msgId, proto_status);
+		break;
+	}
+	case ID_ROOM_LIST_RESPONSE:
+	{
+		Proto::RoomList proto_list;
+		std::set<Room::id_t>& rooms = m_tenants[scope]->rooms;
+		for (auto it = rooms.begin(); it != rooms.end(); it++) {
+			BIRIBIT_ASSERT(m_rooms[*it] != nullptr);
+			Proto::Room* room_to_add = proto_list.add_rooms();
+			PopulateProtoRoom(m_rooms[*it], room_to_add);
+		}
+
+		written = WriteMessage(bstream, msgId, proto_list);
+		break;
+	}
+	case ID_ROOM_STATUS:
+	{
+		BIRIBIT_ASSERT(m_rooms[scope] != nullptr);
+		Proto::Room proto_room;
+		PopulateProtoRoom(m_rooms[scope], &proto_room);
+		written = WriteMessage(bstream, msgId, proto_room);
+		break;
+	}
+	default:
+		BIRIBIT_WARN("Response %d is not cached.", msgId);
+		break;
+	}
+
+	if (!written)
+		return nullptr;
+
+	response = std::make_shared<std::string>((const char*) bstream.GetData(), bstream.GetNumberOfBytesUsed());
+	m_responses.Put(msgId, scope, response);
+	return response;
+}
+
+void RakNetServer::SendResponse(RakNet::MessageID msgId, std::uint32_t scope, PacketPriority priority, PacketReliability reliability, char channel, RakNet::SystemAddress addr)
+{
+	ResponseCache::Response response = GetResponse(msgId, scope);
+	if (response != nullptr)
+		Send(response->data(), (int) response->size(), priority, reliability, channel, addr, false);
+}
+
+void RakNetServer::ClientsChanged()
+{
+	m_responses.Invalidate(ID_SERVER_INFO_RESPONSE, 0);
+	m_responses.Invalidate(ID_SERVER_STATUS_RESPONSE, 0);
+}
+
+void RakNetServer::RoomTouched(unique<Room>& room)
+{
+	// Room lists carry every room status of the tenant.
+	m_responses.Invalidate(ID_ROOM_STATUS, room->id);
+	m_responses.Invalidate(ID_ROOM_LIST_RESPONSE, room->tenant);
+}
+
+void RakNetServer::PopulateProtoServerInfo(Proto::ServerInfo* proto_info)
+{
+	proto_info->set_name(m_name);
+	proto_info->set_password_protected(m_passwordProtected);
+	proto_info->set_max_clients(m_maxClients);
+	proto_info->set_connected_clients(m_clientAddrMap.size());
+}
+
+void RakNetServer::PopulateProtoClient(unique<Client>& client, Proto::Client* proto_client)
+{
+	proto_client->set_id(client->id);
+	proto_client->set_name(client->name);
+	proto_client->set_appid(m_tenants[client->tenant]->appid);
+}
+
+void RakNetServer::PopulateProtoRoom(unique<Room>& room, Proto::Room* proto_room)
+{
+	proto_room->set_id(room->id);
+	for (std::size_t i = 0; i < room->slots.size(); i++)
+		proto_room->add_joined_id_client(room->slots[i]);
+
+	proto_room->set_journal_entries_count(room->journal.Size());
+	proto_room->set_version(room->version);
+}
+
+void RakNetServer::PopulateProtoRoomDelta(unique<Room>& room, const std::vector<std::uint32_t>& changed_slots, Proto::RoomDelta* proto_delta)
+{
+	proto_delta->set_id(room->id);
+	for (auto it = changed_slots.begin(); it != changed_slots.end(); it++) {
+		Proto::RoomSlot* proto_slot = proto_delta->add_slots();
+		proto_slot->set_slot(*it);
+		proto_slot->set_id_client(room->slots[*it]);
+	}
+
+	proto_delta->set_journal_entries_count(room->journal.Size());
+	proto_delta->set_version(room->version);
+}
+
+void RakNetServer::PopulateProtoRoomJoin(unique<Client>& client, Proto::RoomJoin* proto_join)
+{
+	proto_join->set_id(client->joined_room);
+	if (client->joined_room != Room::UNASSIGNED_ID)
+		proto_join->set_slot_to_join(client->joined_slot);
+}
+
+void RakNetServer::PopulateProtoRoomEntriesStatus(unique<Room>& room, Proto::RoomEntriesStatus* proto_entries)
+{
+	proto_entries->set_room_id(room->id);
+	BIRIBIT_ASSERT(room->journal.Size() > 0);
+	proto_entries->set_journal_size(room->journal.Size() -1 );
+}
+
+bool RakNetServer::PopulateProtoRoomSnapshot(unique<Room>& room, Proto::RoomSnapshot* proto_snapshot)
+{
+	proto_snapshot->set_id(room->id);
+	proto_snapshot->set_appid(m_tenants[room->tenant]->appid);
+	proto_snapshot->set_slots_count(room->slots.size());
+	Room::Entry entry;
+	for (std::size_t i = 1; i < room->journal.Size(); i++)
+	{
+		// A journal with holes would be taken for the whole one.
+		if (!room->journal.Read(i, entry)) {
+			printLog("WARN: Unable to read entry %d of room %d, no snapshot of the room.", (int) i, room->id);
+			return false;
+		}
+
+		Proto::RoomEntry* proto_entry = proto_snapshot->add_journal();
+		proto_entry->set_id(i);
+		proto_entry->set_from_slot(entry.from_slot);
+		proto_entry->set_entry_data(entry.data);
+	}
+
+	return true;
+}
+
+void RakNetServer::PopulateProtoServerLoad(Proto::ServerLoad* proto_load)
+{
+	proto_load->set_relayed_bytes_per_second(m_load);
+	proto_load->set_connected_clients(m_clientAddrMap.size());
+	proto_load->set_rooms(m_roomsCount);
+}
+
+
+void RakNetServer::RaknetThreadUpdate(RakNet::RakPeerInterface *peer, void* data)
+{
+	if (data != nullptr && static_cast<RakNetServer*>(data)->m_peer == peer) {
+		static_cast<RakNetServer*>(data)->RakNetUpdated();
+	}
+}
+
+void RakNetServer::RakNetUpdated()
+{
+	m_pool->enqueue([this]() {
+		RakNet::Packet* p = nullptr;
+		while (m_peer != nullptr && (p = m_peer->Receive()) != nullptr) {
 			HandlePacket(p);
 			m_peer->DeallocatePacket(p);
 		}
+
+		if (m_peer != nullptr) {
+			PollLocalLinks();
+			TickPlugins();
+			UpdateSpectators();
+			DrainEgress();
+			ShipReplicaLog();
+			UpdateEgress();
+			Tick();
+		}
 	});
 }
 
@@ -697,12 +3323,44 @@ void RakNetServer::HandlePacket(RakNet::Packet* p)
 		stream.Read(timeStamp);
 		stream.Read(packetIdentifier);
 	}
+	else if (packetIdentifier == ID_TIMESTAMP_COMPACT)
+	{
+		std::uint32_t serverTime;
+		stream.Read(serverTime);
+		stream.Read(packetIdentifier);
+		timeStamp = GetLocalTime(serverTime);
+	}
+
+	bool compact = (packetIdentifier == ID_COMPACT_MESSAGE);
+	if (compact && (!stream.Read(packetIdentifier) || !Compact::Carries(packetIdentifier)))
+		return;
+
+	// Stream 0 broadcasts keep the format of clients without streams.
+	std::uint8_t roomStream = 0;
+	if (packetIdentifier == ID_SEND_BROADCAST_ON_STREAM)
+	{
+		if (!stream.Read(roomStream) || roomStream == 0 || roomStream >= ROOM_MAX_STREAMS)
+			return;
+
+		if (!stream.Read(packetIdentifier) || GetTrafficClass(packetIdentifier) != TRAFFIC_BROADCAST)
+			return;
+	}
+
+	if (!AdmitPacket(p->systemAddress, packetIdentifier, p->length))
+		return;
+
+	// Handed off, only RakNet's own messages are still handled.
+	if (m_handedOff && packetIdentifier >= ID_USER_PACKET_ENUM)
+		return;
 
 	switch (packetIdentifier)
 	{
 	case ID_DISCONNECTION_NOTIFICATION:
 		printLog("Client %s disconnected.", p->systemAddress.ToString());
-		RemoveClient(p->systemAddress);
+		if (m_clientAddrMap.find(p->systemAddress) != m_clientAddrMap.end())
+			RemoveClient(p->systemAddress);
+		else
+			UnlinkNode(p->systemAddress);
 		break;
 	case ID_NEW_INCOMING_CONNECTION:
 	{
@@ -719,56 +3377,63 @@ void RakNetServer::HandlePacket(RakNet::Packet* p)
 		stream.Read(packetIdentifier);
 		if (packetIdentifier == ID_SERVER_INFO_REQUEST)
 		{
-			Proto::ServerInfo proto_info;
-			PopulateProtoServerInfo(&proto_info);
-			RakNet::BitStream bstream;
-			if (WriteMessage(bstream, ID_SERVER_INFO_RESPONSE, proto_info))
+			ResponseCache::Response response = GetResponse(ID_SERVER_INFO_RESPONSE, 0);
+			if (response != nullptr)
 				m_peer->AdvertiseSystem(
 					p->systemAddress.ToString(false),
 					p->systemAddress.GetPort(),
-					(const char*)bstream.GetData(),
-					bstream.GetNumberOfBytesUsed());
+					response->data(),
+					(int) response->size());
 		}
 		break;
 	}
 	case ID_CONNECTION_LOST:
 		printLog("ID_CONNECTION_LOST %s", p->systemAddress.ToString());
-		RemoveClient(p->systemAddress);
+		if (m_clientAddrMap.find(p->systemAddress) != m_clientAddrMap.end()) {
+			HoldSession(p->systemAddress);
+			RemoveClient(p->systemAddress);
+		}
+		else
+			UnlinkNode(p->systemAddress);
+		break;
+	case ID_CONNECTION_REQUEST_ACCEPTED:
+	{
+		// The server only connects to other nodes and to its standby.
+		if (p->systemAddress == m_standby.addr) {
+			LinkStandby();
+			break;
+		}
+
+		if (p->systemAddress == m_origin.addr) {
+			LinkOrigin();
+			break;
+		}
+
+		if (!LinkNode(p->systemAddress, nullptr))
+			break;
+
+		Proto::ServerLoad proto_load;
+		PopulateProtoServerLoad(&proto_load);
+		RakNet::BitStream bstream;
+		if (WriteMessage(bstream, ID_NODE_HELLO, proto_load))
+			Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, p->systemAddress, false);
+		break;
+	}
+	case ID_CONNECTION_ATTEMPT_FAILED:
+		printLog("Connection attempt to node %s failed.", p->systemAddress.ToString());
 		break;
 	case ID_ERROR_CODE:
 		BIRIBIT_WARN("Nothing to do with ID_ERROR_CODE");
 		break;
 	case ID_SERVER_INFO_REQUEST:
-	{
-		Proto::ServerInfo proto_info;
-		PopulateProtoServerInfo(&proto_info);
-		RakNet::BitStream bstream;
-		if (WriteMessage(bstream, ID_SERVER_INFO_RESPONSE, proto_info))
-			m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, p->systemAddress, false);
-		
+		SendResponse(ID_SERVER_INFO_RESPONSE, 0, LOBBY_PRIORITY, RELIABLE_ORDERED, CHANNEL_LOBBY, p->systemAddress);
 		break;
-	}
 	case ID_SERVER_INFO_RESPONSE:
 		BIRIBIT_WARN("Nothing to do with ID_SERVER_INFO_RESPONSE");
 		break;
 	case ID_SERVER_STATUS_REQUEST:
-	{
-		Proto::ServerStatus proto_status;
-		for (std::size_t i = 0; i < m_clients.size(); i++)
-		{
-			if (m_clients[i] != nullptr)
-			{
-				Proto::Client* proto_client = proto_status.add_clients();
-				PopulateProtoClient(m_clients[i], proto_client);
-			}
-		}
-
-		RakNet::BitStream bstream;
-		if (WriteMessage(bstream, ID_SERVER_STATUS_RESPONSE, proto_status))
-			m_peer->Send(&bstream, LOW_PRIORITY, RELIABLE_ORDERED, 0, p->systemAddress, false);
-
+		SendResponse(ID_SERVER_STATUS_RESPONSE, 0, LOBBY_PRIORITY, RELIABLE_ORDERED, CHANNEL_LOBBY, p->systemAddress);
 		break;
-	}
 	case ID_SERVER_STATUS_RESPONSE:
 		BIRIBIT_WARN("Nothing to do with ID_SERVER_STATUS_RESPONSE");
 		break;
@@ -794,24 +3459,31 @@ void RakNetServer::HandlePacket(RakNet::Packet* p)
 	case ID_ROOM_CREATE_REQUEST:
 	{
 		Proto::RoomCreate proto_create;
-		if (ReadMessage(proto_create, stream))
+		if (ReadMessage(proto_create, stream, compact))
 			CreateRoom(p->systemAddress, &proto_create);
 		break;
 	}
 	case ID_ROOM_JOIN_RANDOM_OR_CREATE_REQUEST:
 	{
 		Proto::RoomCreate proto_create;
-		if (ReadMessage(proto_create, stream))
+		if (ReadMessage(proto_create, stream, compact))
 			JoinRandomOrCreate(p->systemAddress, &proto_create);
 		break;
 	}
 	case ID_ROOM_JOIN_REQUEST:
 	{
 		Proto::RoomJoin proto_join;
-		if (ReadMessage(proto_join, stream))
+		if (ReadMessage(proto_join, stream, compact))
 			JoinRoom(p->systemAddress, &proto_join);
 		break;
 	}
+	case ID_ROOM_STATUS_REQUEST:
+	{
+		Proto::RoomJoin proto_join;
+		if (ReadMessage(proto_join, stream, compact))
+			SendRoomStatus(p->systemAddress, &proto_join);
+		break;
+	}
 	case ID_ROOM_STATUS:
 		BIRIBIT_WARN("Nothing to do with ID_ROOM_STATUS");
 		break;
@@ -819,8 +3491,24 @@ void RakNetServer::HandlePacket(RakNet::Packet* p)
 		BIRIBIT_WARN("Nothing to do with ID_ROOM_JOIN_RESPONSE");
 		break;
 	case ID_SEND_BROADCAST_TO_ROOM:
-		SendRoomBroadcast(p->systemAddress, timeStamp, stream);
+		SendRoomBroadcast(p->systemAddress, timeStamp, stream, roomStream);
+		break;
+	case ID_SEND_BROADCAST_TO_INTEREST:
+		SendRoomBroadcast(p->systemAddress, timeStamp, stream, roomStream, BROADCAST_TO_INTEREST);
+		break;
+	case ID_SEND_BROADCAST_TO_SLOTS:
+		SendRoomBroadcast(p->systemAddress, timeStamp, stream, roomStream, BROADCAST_TO_SLOTS);
+		break;
+	case ID_SEND_BROADCAST_TO_OTHERS:
+		SendRoomBroadcast(p->systemAddress, timeStamp, stream, roomStream, BROADCAST_TO_OTHERS);
 		break;
+	case ID_ROOM_INTEREST_UPDATE:
+	{
+		Proto::RoomInterests proto_interests;
+		if (ReadMessage(proto_interests, stream, compact))
+			UpdateRoomInterests(p->systemAddress, &proto_interests);
+		break;
+	}
 	case ID_BROADCAST_FROM_ROOM:
 		BIRIBIT_WARN("Nothing to do with ID_BROADCAST_FROM_ROOM");
 		break;
@@ -837,6 +3525,159 @@ void RakNetServer::HandlePacket(RakNet::Packet* p)
 	case ID_SEND_ENTRY_TO_ROOM:
 		SendRoomEntry(p->systemAddress, stream);
 		break;
+	case ID_ROOM_MIGRATED:
+		BIRIBIT_WARN("Nothing to do with ID_ROOM_MIGRATED");
+		break;
+	case ID_ROOM_STANDBY:
+		BIRIBIT_WARN("Nothing to do with ID_ROOM_STANDBY");
+		break;
+	case ID_ROOM_RESUME:
+		BIRIBIT_WARN("Nothing to do with ID_ROOM_RESUME");
+		break;
+	case ID_CLOCK_SYNC_REQUEST:
+	{
+		RakNet::Time clientTime;
+		if (m_clientAddrMap.find(p->systemAddress) == m_clientAddrMap.end() || !stream.Read(clientTime))
+			break;
+
+		GetClient(p->systemAddress)->clock_sync = true;
+		RakNet::BitStream bstream;
+		bstream.Write((RakNet::MessageID) ID_CLOCK_SYNC_RESPONSE);
+		bstream.Write(clientTime);
+		bstream.Write(GetServerTime(RakNet::GetTime()));
+		Send(&bstream, IMMEDIATE_PRIORITY, UNRELIABLE, CHANNEL_CONTROL, p->systemAddress, false);
+		break;
+	}
+	case ID_CLOCK_SYNC_RESPONSE:
+		BIRIBIT_WARN("Nothing to do with ID_CLOCK_SYNC_RESPONSE");
+		break;
+	case ID_PLANE_PROBE:
+	{
+		std::uint8_t plane;
+		auto it = m_clientAddrMap.find(p->systemAddress);
+		if (it == m_clientAddrMap.end() || !stream.Read(plane))
+			break;
+
+		// Echoed behind the plane's own traffic, data probes through the
+		// room egress queue when there is one.
+		unique<Client>& client = m_clients[it->second];
+		if (plane == PLANE_DATA && client->joined_room != Room::UNASSIGNED_ID) {
+			shared<std::string> data = std::make_shared<std::string>((const char*) p->data, p->length);
+			EnqueueEgress(m_rooms[client->joined_room], p->systemAddress, data, JOURNAL_PRIORITY, RELIABLE, CHANNEL_JOURNAL);
+		}
+		else if (plane == PLANE_DATA)
+			Send((const char*) p->data, p->length, JOURNAL_PRIORITY, RELIABLE, CHANNEL_JOURNAL, p->systemAddress, false);
+		else
+			Send((const char*) p->data, p->length, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, p->systemAddress, false);
+		break;
+	}
+	case ID_CODEC_HELLO:
+	{
+		std::uint8_t codec;
+		auto it = m_clientAddrMap.find(p->systemAddress);
+		if (it == m_clientAddrMap.end() || !stream.Read(codec))
+			break;
+
+		// Answered before any compact message, both go on the control channel.
+		unique<Client>& client = m_clients[it->second];
+		client->codec = std::min<std::uint8_t>(codec, CODEC_NEWEST);
+		RakNet::BitStream bstream;
+		bstream.Write((RakNet::MessageID) ID_CODEC_HELLO);
+		bstream.Write(client->codec);
+		Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, p->systemAddress, false);
+		break;
+	}
+	case ID_COMPACT_MESSAGE:
+		BIRIBIT_WARN("Nothing to do with ID_COMPACT_MESSAGE");
+		break;
+	case ID_SEND_BROADCAST_ON_STREAM:
+		BIRIBIT_WARN("Nothing to do with ID_SEND_BROADCAST_ON_STREAM");
+		break;
+	case ID_ROOM_SPECTATE_REQUEST:
+	{
+		Proto::RoomSpectate proto_spectate;
+		if (ReadMessage(proto_spectate, stream))
+			SpectateRoom(p->systemAddress, &proto_spectate);
+		break;
+	}
+	case ID_ROOM_SPECTATE_RESPONSE:
+		BIRIBIT_WARN("Nothing to do with ID_ROOM_SPECTATE_RESPONSE");
+		break;
+	case ID_ROOM_SPECTATE_REDIRECT:
+		BIRIBIT_WARN("Nothing to do with ID_ROOM_SPECTATE_REDIRECT");
+		break;
+	case ID_NODE_RELAY:
+	{
+		Proto::ServerLoad proto_load;
+		if (ReadMessage(proto_load, stream))
+			LinkRelay(p->systemAddress, &proto_load);
+		break;
+	}
+	case ID_NODE_SPECTATE:
+	{
+		Proto::RoomSpectate proto_spectate;
+		if (ReadMessage(proto_spectate, stream))
+			RelaySpectate(p->systemAddress, &proto_spectate);
+		break;
+	}
+	case ID_NODE_SPECTATE_DATA:
+		RelaySpectateData(p->systemAddress, stream);
+		break;
+	case ID_ROOM_MIGRATION_CLAIM:
+	{
+		Proto::RoomMigrationClaim proto_claim;
+		if (ReadMessage(proto_claim, stream))
+			RoomMigrationClaim(p->systemAddress, &proto_claim);
+		break;
+	}
+	case ID_NODE_HELLO:
+	{
+		Proto::ServerLoad proto_load;
+		if (ReadMessage(proto_load, stream) && LinkNode(p->systemAddress, &proto_load))
+		{
+			PopulateProtoServerLoad(&proto_load);
+			RakNet::BitStream bstream;
+			if (WriteMessage(bstream, ID_NODE_LOAD, proto_load))
+				Send(&bstream, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, p->systemAddress, false);
+		}
+		break;
+	}
+	case ID_NODE_LOAD:
+	{
+		Proto::ServerLoad proto_load;
+		Node* node = GetNode(p->systemAddress);
+		if (node != nullptr && ReadMessage(proto_load, stream))
+			node->load = proto_load.relayed_bytes_per_second();
+		break;
+	}
+	case ID_NODE_ROOM_MIGRATE:
+	{
+		Proto::RoomMigration proto_migration;
+		if (ReadMessage(proto_migration, stream))
+			RoomMigrationRequest(p->systemAddress, &proto_migration);
+		break;
+	}
+	case ID_NODE_ROOM_MIGRATED:
+	{
+		Proto::RoomMigration proto_migration;
+		if (ReadMessage(proto_migration, stream))
+			RoomMigrationResponse(p->systemAddress, &proto_migration);
+		break;
+	}
+	case ID_NODE_ROOM_APPEND:
+	{
+		Proto::RoomEntriesStatus proto_entries;
+		if (ReadMessage(proto_entries, stream))
+			RoomMigrationAppend(p->systemAddress, &proto_entries);
+		break;
+	}
+	case ID_NODE_REPLICA_LOG:
+	{
+		Proto::ReplicaLog proto_log;
+		if (ReadMessage(proto_log, stream))
+			ApplyReplicaLog(p->systemAddress, &proto_log);
+		break;
+	}
 	default:
 		break;
 	}
@@ -860,6 +3701,18 @@ bool RakNetServer::WriteMessage(RakNet::BitStream& bstream,
 	return false;
 }
 
+template<typename T> bool RakNetServer::WriteMessage(RakNet::BitStream& bstream,
+	RakNet::MessageID msgId,
+	T& msg,
+	std::uint8_t codec)
+{
+	if (codec < CODEC_COMPACT)
+		return WriteMessage(bstream, msgId, msg);
+
+	Compact::WriteMessage(bstream, msgId, msg);
+	return true;
+}
+
 template<typename T> bool RakNetServer::ReadMessage(T& msg, RakNet::BitStream& bstream)
 {
 	std::size_t size = BITS_TO_BYTES(bstream.GetNumberOfUnreadBits());
@@ -868,12 +3721,91 @@ template<typename T> bool RakNetServer::ReadMessage(T& msg, RakNet::BitStream& b
 	return msg.ParseFromArray(m_buffer.data, size);
 }
 
+template<typename T> bool RakNetServer::ReadMessage(T& msg, RakNet::BitStream& bstream, bool compact)
+{
+	return compact ? Compact::ReadMessage(msg, bstream) : ReadMessage(msg, bstream);
+}
+
 void RakNetServer::SendErrorCode(std::uint32_t error_code, RakNet::AddressOrGUID systemIdentifier)
 {
 	RakNet::BitStream tosend;
 	tosend.Write((RakNet::MessageID) ID_ERROR_CODE);
 	tosend.Write(error_code);
-	m_peer->Send(&tosend, LOW_PRIORITY, RELIABLE, 0, systemIdentifier, false);
+	Send(&tosend, CONTROL_PRIORITY, RELIABLE_ORDERED, CHANNEL_CONTROL, systemIdentifier, false);
+}
+
+void RakNetServer::Send(const RakNet::BitStream* bstream, PacketPriority priority, PacketReliability reliability, char channel, const RakNet::AddressOrGUID systemIdentifier, bool broadcast)
+{
+	Send((const char*) bstream->GetData(), (int) bstream->GetNumberOfBytesUsed(), priority, reliability, channel, systemIdentifier, broadcast);
+}
+
+void RakNetServer::Send(const char* data, int size, PacketPriority priority, PacketReliability reliability, char channel, const RakNet::AddressOrGUID systemIdentifier, bool broadcast)
+{
+	if (broadcast)
+	{
+		// Like RakNet, to everyone but the address given.
+		for (auto it = m_localLinks.begin(); it != m_localLinks.end(); it++)
+			if (it->first != systemIdentifier.systemAddress)
+				it->second->Push(Biribit::LocalLink::CLIENT_END, data, size);
+	}
+	else
+	{
+		auto it = m_localLinks.find(systemIdentifier.systemAddress);
+		if (it != m_localLinks.end()) {
+			it->second->Push(Biribit::LocalLink::CLIENT_END, data, size);
+			return;
+		}
+	}
+
+	m_peer->Send(data, size, priority, reliability, channel, systemIdentifier, broadcast);
+}
+
+void RakNetServer::CloseConnection(RakNet::SystemAddress addr)
+{
+	auto it = m_localLinks.find(addr);
+	if (it == m_localLinks.end()) {
+		m_peer->CloseConnection(addr, true);
+		return;
+	}
+
+	const char notification = (char) ID_DISCONNECTION_NOTIFICATION;
+	it->second->Push(Biribit::LocalLink::CLIENT_END, &notification, 1);
+	it->second->Close();
+	m_localLinks.erase(it);
+}
+
+void RakNetServer::PollLocalLinks()
+{
+	// Handling a message may close links, so not iterating the map itself.
+	std::vector<std::pair<RakNet::SystemAddress, shared<Biribit::LocalLink>>> links(m_localLinks.begin(), m_localLinks.end());
+	std::deque<std::string> messages;
+	for (auto it = links.begin(); it != links.end(); it++)
+	{
+		// Messages pushed before the link closed are all pulled below.
+		bool closed = it->second->IsClosed();
+		it->second->Pull(Biribit::LocalLink::SERVER_END, messages);
+		for (auto message = messages.begin(); message != messages.end() && m_peer != nullptr; message++)
+		{
+			if (message->empty())
+				continue;
+
+			RakNet::Packet packet = RakNet::Packet();
+			packet.systemAddress = it->first;
+			packet.length = (unsigned int) message->size();
+			packet.bitSize = BYTES_TO_BITS(packet.length);
+			packet.data = (unsigned char*) &(*message)[0];
+			HandlePacket(&packet);
+		}
+
+		if (closed)
+			m_localLinks.erase(it->first);
+	}
+}
+
+void RakNetServer::CloseLocalLinks()
+{
+	while (!m_localLinks.empty())
+		CloseConnection(m_localLinks.begin()->first);
 }
 
 
@@ -887,6 +3819,7 @@ bool RakNetServer::Run(unsigned short _port, const char* _name, const char* _pas
 	m_peer->SetTimeoutTime(10000, RakNet::UNASSIGNED_SYSTEM_ADDRESS);
 
 	m_passwordProtected = (_password != NULL);
+	m_password = m_passwordProtected ? _password : "";
 	if (m_passwordProtected)
 		m_peer->SetIncomingPassword(_password, (int)strlen(_password));
 		
@@ -951,6 +3884,23 @@ bool RakNetServer::Run(unsigned short _port, const char* _name, const char* _pas
 		m_name = _name;
 	}
 
+	m_responses.Clear();
+	m_lastTick = clock::now();
+	m_lastLoadUpdate = m_lastTick;
+	m_lastEgressUpdate = m_lastTick;
+	m_handedOff = false;
+	if (!m_handoffFile.empty())
+		ReadHandoff();
+
+	if (!m_captureFile.empty())
+	{
+		m_captureStart = RakNet::GetTime();
+		if (m_capture.Open(m_captureFile))
+			printLog("Capturing room traffic to \"%s\".", m_captureFile.c_str());
+		else
+			printLog("Unable to open capture file \"%s\".", m_captureFile.c_str());
+	}
+
 	m_pool = std::unique_ptr<TaskPool>(new TaskPool(1, "RakNetServer"));
 	m_peer->SetUserUpdateThread(RaknetThreadUpdate, this);
 
@@ -958,11 +3908,200 @@ bool RakNetServer::Run(unsigned short _port, const char* _name, const char* _pas
 	return true;
 }
 
+void RakNetServer::AddNode(const char* host, unsigned short port)
+{
+	Node node;
+	node.host = host;
+	node.port = (port != 0) ? port : SERVER_DEFAULT_PORT;
+	node.addr.FromStringExplicitPort(node.host.c_str(), node.port);
+	m_nodes.push_back(node);
+}
+
+void RakNetServer::SetMigrationThreshold(std::uint32_t relayed_bytes_per_second)
+{
+	m_migrationThreshold = relayed_bytes_per_second;
+}
+
+bool RakNetServer::SetRateLimit(const std::string& appid, const std::string& traffic, float messages_per_second, float bytes_per_second)
+{
+	TrafficClass traffic_class;
+	if (traffic == "control")
+		traffic_class = TRAFFIC_CONTROL;
+	else if (traffic == "broadcast")
+		traffic_class = TRAFFIC_BROADCAST;
+	else if (traffic == "entry")
+		traffic_class = TRAFFIC_ENTRY;
+	else
+		return false;
+
+	std::vector<RateLimit>& limits = m_rateLimits[appid];
+	if (limits.empty())
+		limits = m_rateLimits[""];
+
+	limits[traffic_class].messages_per_second = messages_per_second;
+	limits[traffic_class].bytes_per_second = bytes_per_second;
+	return true;
+}
+
+void RakNetServer::SetStandby(const char* host, unsigned short port)
+{
+	m_standby.host = host;
+	m_standby.port = (port != 0) ? port : SERVER_DEFAULT_PORT;
+}
+
+void RakNetServer::SetPrimary(const char* host, unsigned short port)
+{
+	m_primary.host = host;
+	m_primary.port = (port != 0) ? port : SERVER_DEFAULT_PORT;
+	m_primary.addr.FromStringExplicitPort(m_primary.host.c_str(), m_primary.port);
+}
+
+void RakNetServer::SetHandoffFile(const std::string& path)
+{
+	m_handoffFile = path;
+}
+
+bool RakNetServer::Handoff()
+{
+	if (m_peer == nullptr || m_handoffFile.empty())
+		return false;
+
+	std::future<bool> written = m_pool->enqueue([this]() -> bool {
+		return WriteHandoff();
+	});
+
+	return written.get();
+}
+
+void RakNetServer::SetJournalBudget(std::size_t room_bytes, std::size_t total_bytes, const std::string& spill_dir)
+{
+	m_journalRoomBudget = room_bytes;
+	m_journalBudget = total_bytes;
+	JournalStore::SetSpillDirectory(spill_dir);
+}
+
+void RakNetServer::SetEgressBudget(const std::string& appid, float bytes_per_second, float weight)
+{
+	if (appid.empty()) {
+		m_egressBucket.SetRate(bytes_per_second);
+		return;
+	}
+
+	EgressBudget& budget = m_tenants[InternAppId(appid)]->egress;
+	budget.weight = (weight > 0.0f) ? weight : 1.0f;
+	budget.bucket.SetRate(bytes_per_second);
+}
+
+bool RakNetServer::LoadPlugin(const std::string& appid, const std::string& path)
+{
+	unique<Plugin> plugin = Plugin::Load(path, appid, &m_pluginHost);
+	if (plugin == nullptr)
+		return false;
+
+	AddPlugin(appid, std::move(plugin));
+	return true;
+}
+
+bool RakNetServer::RegisterPlugin(const std::string& appid, const std::string& name, brbt_PluginLoad load)
+{
+	unique<Plugin> plugin = Plugin::Create(load, name, appid, &m_pluginHost);
+	if (plugin == nullptr)
+		return false;
+
+	AddPlugin(appid, std::move(plugin));
+	return true;
+}
+
+void RakNetServer::AddPlugin(const std::string& appid, unique<Plugin> plugin)
+{
+	printLog("Plugin \"%s\" loaded for appid \"%s\".", plugin->Path().c_str(), appid.c_str());
+	unique<Plugin>& loaded = m_tenants[InternAppId(appid)]->plugin;
+	if (loaded == nullptr)
+		m_pluginsCount++;
+
+	loaded = std::move(plugin);
+}
+
+void RakNetServer::SetAppQuota(const std::string& appid, std::uint32_t max_rooms, std::uint32_t max_clients, std::size_t max_journal_bytes)
+{
+	unique<Tenant>& tenant = m_tenants[InternAppId(appid)];
+	tenant->max_rooms = max_rooms;
+	tenant->max_clients = max_clients;
+	tenant->max_journal_bytes = max_journal_bytes;
+}
+
+void RakNetServer::SetSpectatorRate(float updates_per_second)
+{
+	m_spectatorRate = updates_per_second;
+}
+
+void RakNetServer::SetCaptureFile(const std::string& path)
+{
+	m_captureFile = path;
+}
+
+void RakNetServer::SetOrigin(const char* host, unsigned short port)
+{
+	m_origin.host = host;
+	m_origin.port = (port != 0) ? port : SERVER_DEFAULT_PORT;
+}
+
+void RakNetServer::AddRelay(const char* host, unsigned short port)
+{
+	Node relay;
+	relay.host = host;
+	relay.port = (port != 0) ? port : SERVER_DEFAULT_PORT;
+	relay.addr.FromStringExplicitPort(relay.host.c_str(), relay.port);
+	m_relays.push_back(relay);
+}
+
 bool RakNetServer::isRunning()
 {
 	return m_peer != nullptr;
 }
 
+Biribit::ServerStats RakNetServer::GetStats()
+{
+	if (m_peer == nullptr) {
+		Biribit::ServerStats stats;
+		stats.plugins = m_pluginsCount;
+		return stats;
+	}
+
+	std::future<Biribit::ServerStats> stats = m_pool->enqueue([this]() -> Biribit::ServerStats {
+		Biribit::ServerStats stats;
+		stats.clients = (std::uint32_t) m_clientAddrMap.size();
+		stats.local_clients = (std::uint32_t) m_localLinks.size();
+		stats.rooms = m_roomsCount;
+		stats.plugins = m_pluginsCount;
+		stats.relayed_bytes_per_second = m_load;
+		return stats;
+	});
+
+	return stats.get();
+}
+
+shared<Biribit::LocalLink> RakNetServer::ConnectLocal()
+{
+	if (m_peer == nullptr)
+		return nullptr;
+
+	// Both ends start connected, the client sends nothing before its accept.
+	shared<Biribit::LocalLink> link(new Biribit::LocalLink());
+	const char accepted = (char) ID_CONNECTION_REQUEST_ACCEPTED;
+	const char incoming = (char) ID_NEW_INCOMING_CONNECTION;
+	link->Push(Biribit::LocalLink::CLIENT_END, &accepted, 1);
+	link->Push(Biribit::LocalLink::SERVER_END, &incoming, 1);
+
+	m_pool->enqueue([this, link]() {
+		// No remote system has this address, the port tells links apart.
+		RakNet::SystemAddress addr("0.0.0.0", ++m_localLinksCount);
+		m_localLinks[addr] = link;
+	});
+
+	return link;
+}
+
 bool RakNetServer::Close()
 {
 	if (m_peer != nullptr)
@@ -976,6 +4115,12 @@ bool RakNetServer::Close()
 			
 		printLog("Waiting for thread ends...");
 		m_pool.reset(nullptr);
+		CloseLocalLinks();
+
+		if (m_capture.IsOpen()) {
+			printLog("Captured %llu records.", (unsigned long long) m_capture.RecordsCount());
+			m_capture.Close();
+		}
 
 		RakNet::RakPeerInterface::DestroyInstance(m_peer);
 		m_peer = nullptr;
@@ -3,26 +3,55 @@
 #include <Biribit/Common/TaskPool.h>
 #include <Biribit/Common/Types.h>
 #include <Biribit/Common/Generic.h>
+#include <Biribit/Common/SlotSet.h>
 #include <Biribit/Common/BiribitMessageIdentifiers.h>
+#include <Biribit/Common/Capture.h>
+#include <Biribit/Server/TokenBucket.h>
+#include <Biribit/Server/JournalStore.h>
+#include <Biribit/Server/Plugin.h>
+#include <Biribit/Server/ResponseCache.h>
+#include <Biribit/Server/BiribitServer.h>
+#include <Biribit/LocalLink.h>
 
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <vector>
 #include <map>
+#include <deque>
 #include <set>
 #include <functional>
 #include <cstdint>
+#include <chrono>
+#include <random>
 
 //RakNet
 #include <RakPeerInterface.h>
 
 class RakNetServer
 {
+	typedef std::chrono::steady_clock clock;
+
 	RakNet::RakPeerInterface *m_peer;
 	std::string m_name;
 	unsigned int m_maxClients;
 	bool m_passwordProtected;
+	std::string m_password;
+
+	enum TrafficClass { TRAFFIC_CONTROL, TRAFFIC_BROADCAST, TRAFFIC_ENTRY, TRAFFIC_CLASSES_COUNT };
+
+	struct RateLimit
+	{
+		float messages_per_second;
+		float bytes_per_second;
+
+		RateLimit();
+	};
+
+	// Indexed by appid, the empty appid holds the defaults.
+	std::map<std::string, std::vector<RateLimit>> m_rateLimits;
+	std::uint64_t m_throttledMessages[TRAFFIC_CLASSES_COUNT];
+	std::uint64_t m_throttledBytes[TRAFFIC_CLASSES_COUNT];
 
 	struct Client
 	{
@@ -31,11 +60,45 @@ class RakNetServer
 
 		id_t id;
 		std::string name;
-		std::string appid;
+		std::uint32_t tenant;
 		std::uint32_t joined_room;
 		std::uint32_t joined_slot;
 		RakNet::SystemAddress addr;
 
+		TokenBucket messages_bucket[TRAFFIC_CLASSES_COUNT];
+		TokenBucket bytes_bucket[TRAFFIC_CLASSES_COUNT];
+		std::uint32_t throttled;
+
+		// Egress state, refreshed from RakNet statistics. While congested,
+		// unreliable broadcasts are held back keeping the latest per sender
+		// and stream.
+		struct Coalesced
+		{
+			std::string data;
+			PacketReliability reliability;
+			char channel;
+		};
+
+		std::uint32_t queued_bytes;
+		bool congested;
+		clock::time_point congested_since;
+		std::map<std::uint32_t, Coalesced> coalesced;
+		clock::time_point last_congestion_hint;
+
+		// Token to claim the joined slot back after a reconnection, be it to
+		// this server, to its standby or to the next process of a handoff.
+		std::uint64_t resume_token;
+
+		// Set once the client samples the server clock, it gets compact
+		// timestamps from then on.
+		bool clock_sync;
+
+		// Room followed as a spectator, without a slot.
+		std::uint32_t spectated_room;
+
+		// Codec agreed in ID_CODEC_HELLO for the hot control messages.
+		std::uint8_t codec;
+
 		Client();
 	};
 
@@ -51,26 +114,220 @@ class RakNetServer
 		id_t id;
 		std::uint32_t joined_clients_count;
 		std::vector<Client::id_t> slots;
-		std::string appid;
+		std::uint32_t tenant;
 
-		struct Entry
-		{
-			typedef std::uint32_t id_t;
-			enum { UNASSIGNED_ID = 0 };
+		// Bumped on every status change. Members apply deltas on top of the
+		// previous version and ask for the full status on a gap.
+		std::uint32_t version;
 
-			std::uint32_t from_slot;
-			std::string data;
+		// Joined slots, and joined or reserved slots.
+		SlotSet members;
+		SlotSet taken;
 
-			Entry();
-		};
+		typedef JournalStore::Entry Entry;
+		JournalStore journal;
+
+		// Slots interested in each broadcast key.
+		std::map<std::uint32_t, SlotSet> interests;
+
+		// Migration state. While migrating, the room is frozen: broadcasts
+		// are dropped and new entries wait in pending until the target node
+		// answers.
+		bool migrating;
+		std::vector<Entry> pending;
+
+		// Node the room just migrated from, its pending entries are taken
+		// until the deadline.
+		RakNet::SystemAddress migrated_from;
+		clock::time_point migrated_until;
+
+		// Slots held for clients coming from another node. Token per slot,
+		// zero if the slot is not reserved.
+		std::vector<std::uint64_t> reserved;
+		std::uint32_t reserved_slots_count;
 
-		std::vector<Entry> journal;
+		std::uint64_t relayed_bytes;
+		std::uint32_t load;
+
+		// Spectators and relays take no slots. They get the latest unreliable
+		// broadcast per sender and stream, and the reliable ones and new
+		// entries in batches, at the spectator rate.
+		std::set<Client::id_t> spectators;
+		std::set<RakNet::SystemAddress> relays;
+		std::map<std::uint32_t, Client::Coalesced> spectated;
+		std::vector<Client::Coalesced> spectated_reliable;
+		std::uint32_t spectated_entries;
+		clock::time_point spectated_at;
 
 		Room();
 	};
 
 	std::vector<unique<Room>> m_rooms;
-	std::map<std::string, std::set<Room::id_t>> m_roomAppIdMap;
+
+	// Journal bytes kept in memory per room and for the whole server, zero
+	// for no limit. Older entries spill to disk.
+	std::size_t m_journalRoomBudget;
+	std::size_t m_journalBudget;
+	std::size_t m_journalHotBytes;
+
+	// Room traffic is queued per room and drained with deficit round robin.
+	// Each appid splits its weight among its active rooms, and sends are
+	// charged to the appid budget and to the server budget.
+	struct Outgoing
+	{
+		shared<std::string> data;
+		PacketPriority priority;
+		PacketReliability reliability;
+		char channel;
+		RakNet::SystemAddress addr;
+		clock::time_point queued;
+	};
+
+	struct EgressQueue
+	{
+		std::uint32_t tenant;
+		std::deque<Outgoing> packets;
+		std::size_t queued_bytes;
+		float deficit;
+
+		EgressQueue();
+	};
+
+	struct EgressBudget
+	{
+		float weight;
+		TokenBucket bucket;
+		std::uint32_t active_rooms;
+
+		EgressBudget();
+	};
+
+	TokenBucket m_egressBucket;
+	std::map<Room::id_t, EgressQueue> m_egressQueues;
+	std::deque<Room::id_t> m_egressActive;
+	std::uint64_t m_egressDropped;
+
+	struct Reservation
+	{
+		std::uint64_t token;
+		Room::id_t room;
+		std::uint32_t slot;
+		std::string name;
+		clock::time_point expires;
+
+		Reservation();
+	};
+
+	std::map<std::uint64_t, Reservation> m_reservations;
+	std::mt19937_64 m_random;
+
+	std::uint64_t NewToken();
+
+	struct Node
+	{
+		std::string host;
+		unsigned short port;
+		RakNet::SystemAddress addr;
+		bool linked;
+		std::uint32_t load;
+
+		Node();
+	};
+
+	struct Migration
+	{
+		Room::id_t room;
+		std::size_t node;
+		clock::time_point started;
+		std::vector<std::pair<Client::id_t, std::uint64_t>> tickets;
+	};
+
+	std::vector<Node> m_nodes;
+	std::vector<Migration> m_migrations;
+	std::uint32_t m_migrationThreshold;
+
+	// Hot standby. The primary ships room changes to its standby in
+	// batched logs. The standby keeps them as replicas and takes the rooms
+	// over, with the same ids, once the primary is gone. Only a server
+	// started as the standby of a primary takes logs, and only from it.
+	Node m_standby;
+	Proto::ReplicaLog m_replicaLog;
+	std::uint64_t m_replicaSequence;
+	Node m_primary;
+	std::map<Room::id_t, unique<Room>> m_replicas;
+	std::map<std::uint64_t, std::string> m_replicaNames;
+
+	// Apps sharing the server. Appids are interned once, clients and rooms
+	// keep the tenant id. Quotas are zero for no limit, the bandwidth quota
+	// is the egress budget.
+	struct Tenant
+	{
+		typedef std::uint32_t id_t;
+		enum { NONE_ID = 0 };
+
+		std::string appid;
+		std::set<Room::id_t> rooms;
+		std::uint32_t clients_count;
+		std::size_t journal_hot_bytes;
+
+		std::uint32_t max_rooms;
+		std::uint32_t max_clients;
+		std::size_t max_journal_bytes;
+		EgressBudget egress;
+
+		// Room logic. Hooks run here, on the thread owning the rooms, and
+		// see payloads in place in the received packets.
+		unique<Plugin> plugin;
+
+		Tenant();
+	};
+
+	std::vector<unique<Tenant>> m_tenants;
+	std::map<std::string, Tenant::id_t> m_tenantIds;
+	std::uint32_t m_roomsCount;
+
+	brbt_PluginHost m_pluginHost;
+	std::uint32_t m_pluginsCount;
+	clock::time_point m_lastPluginTick;
+
+	// Spectator fan-out. An origin redirects spectators to the relays it was
+	// given, once they link. A relay follows rooms of its origin and keeps
+	// their status and journal for the spectators connected to it.
+	float m_spectatorRate;
+	std::vector<Node> m_relays;
+	Node m_origin;
+	std::map<Room::id_t, unique<Room>> m_relayed;
+	// Asked to the origin, relayed once it confirms the room.
+	std::map<Room::id_t, unique<Room>> m_following;
+
+	// Snapshot written on handoff and loaded by the next process at startup.
+	std::string m_handoffFile;
+	bool m_handedOff;
+
+	// Server time, sent in compact timestamps, counts from here.
+	RakNet::Time m_clockEpoch;
+
+	// Inbound room traffic recorded for BiribitReplay.
+	std::string m_captureFile;
+	CaptureWriter m_capture;
+	RakNet::Time m_captureStart;
+
+	// Clients of the embedding process. Each link has an address of its
+	// own, sends to it skip RakNet.
+	std::map<RakNet::SystemAddress, shared<Biribit::LocalLink>> m_localLinks;
+	std::uint16_t m_localLinksCount;
+
+	void Send(const RakNet::BitStream* bstream, PacketPriority priority, PacketReliability reliability, char channel, const RakNet::AddressOrGUID systemIdentifier, bool broadcast);
+	void Send(const char* data, int size, PacketPriority priority, PacketReliability reliability, char channel, const RakNet::AddressOrGUID systemIdentifier, bool broadcast);
+	void CloseConnection(RakNet::SystemAddress addr);
+	void PollLocalLinks();
+	void CloseLocalLinks();
+
+	std::uint64_t m_relayedBytes;
+	std::uint32_t m_load;
+	clock::time_point m_lastTick;
+	clock::time_point m_lastLoadUpdate;
+	clock::time_point m_lastEgressUpdate;
 
 	unique<Client>& GetClient(RakNet::SystemAddress addr);
 
@@ -78,23 +335,108 @@ class RakNetServer
 	void RemoveClient(RakNet::SystemAddress addr);
 	void UpdateClient(RakNet::SystemAddress addr, Proto::ClientUpdate* proto_update);
 	void SendClientStatusUpdated(unique<Client>& client, RakNet::SystemAddress addr);
+	void ApplyRateLimits(unique<Client>& client);
+	TrafficClass GetTrafficClass(RakNet::MessageID msgId);
+	bool AdmitPacket(RakNet::SystemAddress addr, RakNet::MessageID msgId, unsigned int length);
+	bool IsLinkedPeer(RakNet::SystemAddress addr);
+	void ReportThrottled();
 
 	void ListRooms(RakNet::SystemAddress addr);
 	void JoinRandomOrCreate(RakNet::SystemAddress addr, Proto::RoomCreate* proto_create);
 	void CreateRoom(RakNet::SystemAddress addr, Proto::RoomCreate* proto_create);
 	void JoinRoom(RakNet::SystemAddress addr, Proto::RoomJoin* proto_join);
 	bool LeaveRoom(unique<Client>& client);
-	void RoomChanged(unique<Room>& room, RakNet::SystemAddress extra_addr_to_notify = RakNet::UNASSIGNED_SYSTEM_ADDRESS);
+	void RoomChanged(unique<Room>& room, const std::vector<std::uint32_t>& changed_slots, RakNet::SystemAddress full_status_addr = RakNet::UNASSIGNED_SYSTEM_ADDRESS);
+	void SendRoomStatus(RakNet::SystemAddress addr, Proto::RoomJoin* proto_join);
+	Tenant::id_t InternAppId(const std::string& appid);
+	Room::id_t NewRoom(Tenant::id_t tenant, std::uint32_t slots_count);
+	void CloseRoom(unique<Room>& room);
+	bool IsSlotFree(unique<Room>& room, std::uint32_t slot);
+	void OccupySlot(unique<Room>& room, std::uint32_t slot, unique<Client>& client);
+	void VacateSlot(unique<Room>& room, unique<Client>& client);
+	void UpdateRoomInterests(RakNet::SystemAddress addr, Proto::RoomInterests* proto_interests);
+	void ClearSlotInterests(unique<Room>& room, std::uint32_t slot);
+	void SpectateRoom(RakNet::SystemAddress addr, Proto::RoomSpectate* proto_spectate);
+	void StopSpectating(unique<Client>& client, bool notify);
+	unique<Room>* GetSpectatedRoom(Room::id_t room_id);
+	void SendSpectators(unique<Room>& room, const char* data, std::size_t size, PacketPriority priority, PacketReliability reliability, char channel);
+	void UpdateSpectators();
+	Node* GetRelay(RakNet::SystemAddress addr);
+	void LinkRelay(RakNet::SystemAddress addr, Proto::ServerLoad* proto_load);
+	void RelaySpectate(RakNet::SystemAddress addr, Proto::RoomSpectate* proto_spectate);
+	void LinkOrigin();
+	void UnlinkOrigin();
+	void RelaySpectateData(RakNet::SystemAddress addr, RakNet::BitStream& in);
 
-	void SendRoomBroadcast(RakNet::SystemAddress addr, RakNet::Time timeStamp, RakNet::BitStream& in);
+	enum BroadcastTarget { BROADCAST_TO_ROOM, BROADCAST_TO_INTEREST, BROADCAST_TO_SLOTS, BROADCAST_TO_OTHERS };
+	void SendRoomBroadcast(RakNet::SystemAddress addr, RakNet::Time timeStamp, RakNet::BitStream& in, std::uint8_t stream, BroadcastTarget target = BROADCAST_TO_ROOM);
+	std::uint32_t RelayBroadcast(unique<Room>& room, std::uint32_t from_slot, RakNet::Time timeStamp, const char* data, std::size_t size, PacketReliability reliability, std::uint8_t stream, const SlotSet& recipients, bool spectated = true);
 	void SendRoomEntry(RakNet::SystemAddress addr, RakNet::BitStream& in);
+	void AppendRoomEntry(unique<Room>& room, const Room::Entry& entry);
+	void TrimJournals(unique<Room>& room);
+	std::size_t SpillJournal(Room& room, std::size_t max_hot_bytes);
 	void RoomEntriesRequest(RakNet::SystemAddress addr, Proto::RoomEntriesRequest* proto_entriesReq);
 
+	Node* GetNode(RakNet::SystemAddress addr);
+	bool LinkNode(RakNet::SystemAddress addr, Proto::ServerLoad* proto_load);
+	void UnlinkNode(RakNet::SystemAddress addr);
+	void UpdateLoad();
+	void BalanceLoad();
+	void MigrateRoom(unique<Room>& room, std::size_t node_index);
+	void RoomMigrationRequest(RakNet::SystemAddress addr, Proto::RoomMigration* proto_migration);
+	void RoomMigrationResponse(RakNet::SystemAddress addr, Proto::RoomMigration* proto_migration);
+	void RoomMigrationAppend(RakNet::SystemAddress addr, Proto::RoomEntriesStatus* proto_entries);
+	void RoomMigrationClaim(RakNet::SystemAddress addr, Proto::RoomMigrationClaim* proto_claim);
+	void ThawRoom(unique<Room>& room);
+	void ExpireReservations();
+	void ConnectNode(Node& node);
+
+	Proto::ReplicaRecord* AddReplicaRecord(Room::id_t room_id, Proto::ReplicaRecord::Type type);
+	bool ReplicateRoom(unique<Room>& room);
+	void ReplicateSlot(unique<Room>& room, std::uint32_t slot, std::uint64_t token, const std::string& name);
+	void SendStandbyTicket(unique<Client>& client);
+	void SendResumeTicket(unique<Client>& client);
+	void HoldSession(RakNet::SystemAddress addr);
+	void LinkStandby();
+	void ShipReplicaLog();
+	void ApplyReplicaLog(RakNet::SystemAddress addr, Proto::ReplicaLog* proto_log);
+	void ApplyReplicaRecords(const Proto::ReplicaLog& proto_log);
+	void TakeOver();
+	bool WriteHandoff();
+	void ReadHandoff();
+	void Tick();
+	std::uint32_t GetServerTime(RakNet::Time local);
+	RakNet::Time GetLocalTime(std::uint32_t server_time);
+	Plugin* GetPlugin(Tenant::id_t tenant);
+	void AddPlugin(const std::string& appid, unique<Plugin> plugin);
+	void TickPlugins();
+	void Capture(std::uint8_t type, unique<Client>& client, const char* data = nullptr, std::size_t size = 0);
+	Room* GetPluginRoom(unsigned int room_id);
+	static void PluginBroadcast(void* server, unsigned int room_id, unsigned int from_slot, const void* data, unsigned int size, unsigned int reliability, unsigned char stream);
+	static void PluginSendTo(void* server, unsigned int room_id, unsigned int slot, unsigned int from_slot, const void* data, unsigned int size, unsigned int reliability, unsigned char stream);
+	static void PluginAppendEntry(void* server, unsigned int room_id, unsigned int from_slot, const void* data, unsigned int size);
+	static void PluginLog(void* server, const char* message);
+	void UpdateEgress();
+	void FlushCoalesced(unique<Client>& client);
+	void EnqueueEgress(unique<Room>& room, RakNet::SystemAddress addr, const shared<std::string>& data, PacketPriority priority, PacketReliability reliability, char channel);
+	void DropEgress(Room::id_t room_id, RakNet::SystemAddress addr = RakNet::UNASSIGNED_SYSTEM_ADDRESS);
+	void DrainEgress();
+
 	void PopulateProtoServerInfo(Proto::ServerInfo* proto_info);
 	void PopulateProtoClient(unique<Client>& client, Proto::Client* proto_client);
 	void PopulateProtoRoom(unique<Room>& room, Proto::Room* proto_room);
+	void PopulateProtoRoomDelta(unique<Room>& room, const std::vector<std::uint32_t>& changed_slots, Proto::RoomDelta* proto_delta);
 	void PopulateProtoRoomJoin(unique<Client>& client, Proto::RoomJoin* proto_join);
 	void PopulateProtoRoomEntriesStatus(unique<Room>& room, Proto::RoomEntriesStatus* proto_entries);
+	bool PopulateProtoRoomSnapshot(unique<Room>& room, Proto::RoomSnapshot* proto_snapshot);
+	void PopulateProtoServerLoad(Proto::ServerLoad* proto_load);
+
+	// Server info and status, room lists per tenant and room statuses.
+	ResponseCache m_responses;
+	ResponseCache::Response GetResponse(RakNet::MessageID msgId, std::uint32_t scope);
+	void SendResponse(RakNet::MessageID msgId, std::uint32_t scope, PacketPriority priority, PacketReliability reliability, char channel, RakNet::SystemAddress addr);
+	void ClientsChanged();
+	void RoomTouched(unique<Room>& room);
 
 	unique<TaskPool> m_pool;
 	Generic::TempBuffer m_buffer;
@@ -104,7 +446,9 @@ class RakNetServer
 	void HandlePacket(RakNet::Packet*);
 
 	bool WriteMessage(RakNet::BitStream& bstream, RakNet::MessageID msgId, ::google::protobuf::MessageLite& msg);
+	template<typename T> bool WriteMessage(RakNet::BitStream& bstream, RakNet::MessageID msgId, T& msg, std::uint8_t codec);
 	template<typename T> bool ReadMessage(T& msg, RakNet::BitStream& bstream);
+	template<typename T> bool ReadMessage(T& msg, RakNet::BitStream& bstream, bool compact);
 
 	void SendErrorCode(std::uint32_t error_code, RakNet::AddressOrGUID systemIdentifier);
 
@@ -112,7 +456,35 @@ public:
 
 	RakNetServer();
 
+	void AddNode(const char* host, unsigned short port);
+	void SetMigrationThreshold(std::uint32_t relayed_bytes_per_second);
+	void SetStandby(const char* host, unsigned short port);
+	// Runs as the standby of the primary, taking its rooms over when it's gone.
+	void SetPrimary(const char* host, unsigned short port);
+	void SetHandoffFile(const std::string& path);
+
+	// Writes the handoff snapshot and hands every joined client a ticket to
+	// rejoin. Close the server afterwards and start the new process.
+	bool Handoff();
+	bool SetRateLimit(const std::string& appid, const std::string& traffic, float messages_per_second, float bytes_per_second);
+	void SetJournalBudget(std::size_t room_bytes, std::size_t total_bytes, const std::string& spill_dir);
+	// An empty appid sets the budget of the whole server.
+	void SetEgressBudget(const std::string& appid, float bytes_per_second, float weight = 1.0f);
+	bool LoadPlugin(const std::string& appid, const std::string& path);
+	bool RegisterPlugin(const std::string& appid, const std::string& name, brbt_PluginLoad load);
+	void SetAppQuota(const std::string& appid, std::uint32_t max_rooms, std::uint32_t max_clients, std::size_t max_journal_bytes);
+	void SetSpectatorRate(float updates_per_second);
+	// Runs as a relay of the origin server, spectators connect here.
+	void SetOrigin(const char* host, unsigned short port);
+	// Relay allowed to link and take spectators of this server.
+	void AddRelay(const char* host, unsigned short port);
+	// Records every inbound room message to the file while running.
+	void SetCaptureFile(const std::string& path);
+
 	bool Run(unsigned short port = 0, const char* name = NULL, const char* password = NULL, unsigned int maxClients = 0);
 	bool isRunning();
 	bool Close();
+
+	Biribit::ServerStats GetStats();
+	shared<Biribit::LocalLink> ConnectLocal();
 };
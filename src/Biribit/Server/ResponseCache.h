@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Biribit/Common/Types.h>
+
+#include <string>
+#include <map>
+#include <cstdint>
+
+// Serialized read-mostly responses, keyed by message id and scope: zero for
+// the whole server, a tenant id or a room id. Each key has a version bumped
+// by the mutations that change it, a response is served again only while
+// it was built at the current version.
+class ResponseCache
+{
+public:
+	typedef shared<std::string> Response;
+
+	Response Get(std::uint8_t msg_id, std::uint32_t scope)
+	{
+		auto it = m_entries.find(Key(msg_id, scope));
+		if (it == m_entries.end() || it->second.response == nullptr || it->second.built != it->second.version)
+			return nullptr;
+
+		return it->second.response;
+	}
+
+	void Put(std::uint8_t msg_id, std::uint32_t scope, const Response& response)
+	{
+		Entry& entry = m_entries[Key(msg_id, scope)];
+		entry.response = response;
+		entry.built = entry.version;
+	}
+
+	void Invalidate(std::uint8_t msg_id, std::uint32_t scope)
+	{
+		auto it = m_entries.find(Key(msg_id, scope));
+		if (it != m_entries.end()) {
+			it->second.version++;
+			it->second.response = nullptr;
+		}
+	}
+
+	// Scopes go away with their room or tenant.
+	void Erase(std::uint8_t msg_id, std::uint32_t scope)
+	{
+		m_entries.erase(Key(msg_id, scope));
+	}
+
+	void Clear()
+	{
+		m_entries.clear();
+	}
+
+private:
+	struct Entry
+	{
+		Response response;
+		std::uint32_t version;
+		std::uint32_t built;
+
+		Entry() : version(0), built(0) {}
+	};
+
+	static std::uint64_t Key(std::uint8_t msg_id, std::uint32_t scope)
+	{
+		return ((std::uint64_t) msg_id << 32) | scope;
+	}
+
+	std::map<std::uint64_t, Entry> m_entries;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+
+// Token bucket refilled at a fixed rate up to a burst size. A zero rate
+// means the bucket never runs out.
+class TokenBucket
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	TokenBucket()
+		: m_rate(0.0f)
+		, m_burst(0.0f)
+		, m_tokens(0.0f)
+		, m_last(clock::now())
+	{
+	}
+
+	// A burst of zero allows one second worth of tokens.
+	void SetRate(float rate, float burst = 0.0f)
+	{
+		m_rate = rate;
+		m_burst = burst > 0.0f ? burst : rate;
+		m_tokens = m_burst;
+		m_last = clock::now();
+	}
+
+	bool IsLimited() const
+	{
+		return m_rate > 0.0f;
+	}
+
+	bool Consume(float tokens, clock::time_point now)
+	{
+		if (m_rate <= 0.0f)
+			return true;
+
+		Refill(now);
+		if (m_tokens < tokens)
+			return false;
+
+		m_tokens -= tokens;
+		return true;
+	}
+
+	// Available and Spend let the balance go negative, so a packet larger
+	// than the burst still goes out once the previous debt is paid back.
+	bool Available(clock::time_point now)
+	{
+		if (m_rate <= 0.0f)
+			return true;
+
+		Refill(now);
+		return m_tokens > 0.0f;
+	}
+
+	void Spend(float tokens)
+	{
+		if (m_rate > 0.0f)
+			m_tokens -= tokens;
+	}
+
+private:
+	float m_rate;
+	float m_burst;
+	float m_tokens;
+	clock::time_point m_last;
+
+	void Refill(clock::time_point now)
+	{
+		m_tokens += std::chrono::duration<float>(now - m_last).count() * m_rate;
+		if (m_tokens > m_burst)
+			m_tokens = m_burst;
+		m_last = now;
+	}
+};
@@ -1,4 +1,4 @@
-#include <Biribit/Server/RakNetServer.h>
+#include <Biribit/Server.h>
 #include <Biribit/Common/PrintLog.h>
 #include <Biribit/BiribitConfig.h>
 #include <Biribit/Common/Types.h>
@@ -9,10 +9,13 @@
 #include <sstream>
 #include <chrono>
 #include <thread>
+#include <algorithm>
+#include <csignal>
 
 #include <tclap/CmdLine.h>
 
-RakNetServer server;
+Biribit::Server server;
+volatile std::sig_atomic_t handoffRequested = 0;
 
 #ifdef SYSTEM_WINDOWS
 
@@ -226,6 +229,51 @@ int main(int argc, char** argv)
 		TCLAP::ValueArg<std::string> nameArg3("m", "maxclients", "Max clients can connect", false, "", "maxclients");
 		cmd.add(nameArg3);
 
+		TCLAP::MultiArg<std::string> nodeArg("", "node", "Node to migrate rooms to, can be repeated", false, "host:port");
+		cmd.add(nodeArg);
+
+		TCLAP::ValueArg<std::string> standbyArg("", "standby", "Standby server to replicate rooms to", false, "", "host:port");
+		cmd.add(standbyArg);
+
+		TCLAP::ValueArg<std::string> primaryArg("", "standby-of", "Primary server whose rooms this server takes over when it's gone", false, "", "host:port");
+		cmd.add(primaryArg);
+
+		TCLAP::ValueArg<std::string> handoffArg("", "handoff", "Snapshot file for restarts, written on SIGUSR2 before exiting and loaded at startup", false, "", "file");
+		cmd.add(handoffArg);
+
+		TCLAP::ValueArg<std::string> thresholdArg("", "migrate-threshold", "Relayed bytes per second before migrating rooms", false, "", "bytes");
+		cmd.add(thresholdArg);
+
+		TCLAP::MultiArg<std::string> rateArg("", "rate-limit", "Client rate limit per second for control, broadcast or entry messages, can be repeated", false, "[appid:]traffic=messages[,bytes]");
+		cmd.add(rateArg);
+
+		TCLAP::MultiArg<std::string> egressArg("", "egress-budget", "Egress bytes per second for the server or an appid, with the appid share weight, can be repeated", false, "[appid:]bytes[,weight]");
+		cmd.add(egressArg);
+
+		TCLAP::MultiArg<std::string> quotaArg("", "app-quota", "Max rooms, clients and journal bytes in memory of an appid, 0 for no limit, can be repeated", false, "appid=rooms[,clients[,journal_bytes]]");
+		cmd.add(quotaArg);
+
+		TCLAP::ValueArg<std::string> journalArg("", "journal-budget", "Journal bytes kept in memory per room and for the whole server, older entries spill to disk", false, "", "room_bytes[,total_bytes]");
+		cmd.add(journalArg);
+
+		TCLAP::ValueArg<std::string> journalDirArg("", "journal-dir", "Directory for spilled journals, system temporary files by default", false, "", "dir");
+		cmd.add(journalDirArg);
+
+		TCLAP::MultiArg<std::string> pluginArg("", "plugin", "Shared library with the room logic of an appid, can be repeated", false, "appid=path");
+		cmd.add(pluginArg);
+
+		TCLAP::ValueArg<std::string> spectatorRateArg("", "spectator-rate", "Updates per second sent to spectators, 10 by default", false, "", "hz");
+		cmd.add(spectatorRateArg);
+
+		TCLAP::ValueArg<std::string> relayArg("", "relay-of", "Origin server whose rooms this server relays to spectators", false, "", "host:port");
+		cmd.add(relayArg);
+
+		TCLAP::MultiArg<std::string> relaysArg("", "relay", "Relay server allowed to take spectators of this server, can be repeated", false, "host:port");
+		cmd.add(relaysArg);
+
+		TCLAP::ValueArg<std::string> captureArg("", "capture", "File to record inbound room traffic to, replayed with BiribitReplay", false, "", "file");
+		cmd.add(captureArg);
+
 #ifdef SYSTEM_LINUX
 		TCLAP::ValueArg<std::string> nameArgPID("i", "pidfile", "PID File", false, "", "pid");
 		cmd.add(nameArgPID);
@@ -238,6 +286,8 @@ int main(int argc, char** argv)
 		std::string port = nameArg1.getValue();
 		std::string pass = nameArg2.getValue();
 		std::string maxc = nameArg3.getValue();
+		std::string threshold = thresholdArg.getValue();
+		std::string journal = journalArg.getValue();
 
 #ifdef SYSTEM_LINUX
 		std::string pidfile = nameArgPID.getValue();
@@ -254,10 +304,194 @@ int main(int argc, char** argv)
 		std::stringstream ssMax(maxc);
 		ssMax >> maxClients;
 
+		std::uint32_t migrationThreshold = 0;
+		std::stringstream ssThreshold(threshold);
+		ssThreshold >> migrationThreshold;
+		server.SetMigrationThreshold(migrationThreshold);
+
+		std::size_t journalRoomBytes = 0, journalBytes = 0;
+		char journalComma;
+		std::stringstream ssJournal(journal);
+		ssJournal >> journalRoomBytes;
+		if (ssJournal >> journalComma)
+			ssJournal >> journalBytes;
+		server.SetJournalBudget(journalRoomBytes, journalBytes, journalDirArg.getValue());
+
+		const std::vector<std::string>& nodes = nodeArg.getValue();
+		for (auto it = nodes.begin(); it != nodes.end(); it++)
+		{
+			std::size_t colon = it->rfind(':');
+			int nodePort = 0;
+			if (colon != std::string::npos) {
+				std::stringstream ssNodePort(it->substr(colon + 1));
+				ssNodePort >> nodePort;
+			}
+
+			server.AddNode(it->substr(0, colon).c_str(), (unsigned short) nodePort);
+		}
+
+		std::string standby = standbyArg.getValue();
+		if (!standby.empty())
+		{
+			std::size_t colon = standby.rfind(':');
+			int standbyPort = 0;
+			if (colon != std::string::npos) {
+				std::stringstream ssStandbyPort(standby.substr(colon + 1));
+				ssStandbyPort >> standbyPort;
+			}
+
+			server.SetStandby(standby.substr(0, colon).c_str(), (unsigned short) standbyPort);
+		}
+
+		std::string primary = primaryArg.getValue();
+		if (!primary.empty())
+		{
+			std::size_t colon = primary.rfind(':');
+			int primaryPort = 0;
+			if (colon != std::string::npos) {
+				std::stringstream ssPrimaryPort(primary.substr(colon + 1));
+				ssPrimaryPort >> primaryPort;
+			}
+
+			server.SetPrimary(primary.substr(0, colon).c_str(), (unsigned short) primaryPort);
+		}
+
+		std::string origin = relayArg.getValue();
+		if (!origin.empty())
+		{
+			std::size_t colon = origin.rfind(':');
+			int originPort = 0;
+			if (colon != std::string::npos) {
+				std::stringstream ssOriginPort(origin.substr(colon + 1));
+				ssOriginPort >> originPort;
+			}
+
+			server.SetOrigin(origin.substr(0, colon).c_str(), (unsigned short) originPort);
+		}
+
+		const std::vector<std::string>& relays = relaysArg.getValue();
+		for (auto it = relays.begin(); it != relays.end(); it++)
+		{
+			std::size_t colon = it->rfind(':');
+			int relayPort = 0;
+			if (colon != std::string::npos) {
+				std::stringstream ssRelayPort(it->substr(colon + 1));
+				ssRelayPort >> relayPort;
+			}
+
+			server.AddRelay(it->substr(0, colon).c_str(), (unsigned short) relayPort);
+		}
+
+		std::string capture = captureArg.getValue();
+		if (!capture.empty())
+			server.SetCaptureFile(capture);
+
+		std::string spectatorRate = spectatorRateArg.getValue();
+		if (!spectatorRate.empty())
+		{
+			float updates = 0.0f;
+			std::stringstream ssSpectatorRate(spectatorRate);
+			if (ssSpectatorRate >> updates && updates > 0.0f)
+				server.SetSpectatorRate(updates);
+			else
+				std::cerr << "error: invalid spectator rate " << spectatorRate << std::endl;
+		}
+
+		std::string handoff = handoffArg.getValue();
+		if (!handoff.empty())
+		{
+			server.SetHandoffFile(handoff);
+#ifdef SYSTEM_LINUX
+			std::signal(SIGUSR2, [](int) { handoffRequested = 1; });
+#endif
+		}
+
+		// Defaults first, so app specific limits start from them.
+		std::vector<std::string> rates = rateArg.getValue();
+		std::stable_sort(rates.begin(), rates.end(), [](const std::string& a, const std::string& b) {
+			return a.substr(0, a.find('=')).find(':') == std::string::npos && b.substr(0, b.find('=')).find(':') != std::string::npos;
+		});
+
+		for (auto it = rates.begin(); it != rates.end(); it++)
+		{
+			std::size_t equal = it->find('=');
+			if (equal == std::string::npos) {
+				std::cerr << "error: invalid rate limit " << *it << std::endl;
+				continue;
+			}
+
+			std::string target = it->substr(0, equal);
+			std::size_t colon = target.rfind(':');
+			std::string appid = (colon != std::string::npos) ? target.substr(0, colon) : "";
+			std::string traffic = (colon != std::string::npos) ? target.substr(colon + 1) : target;
+
+			float messages = 0.0f, bytes = 0.0f;
+			char comma;
+			std::stringstream ssRate(it->substr(equal + 1));
+			ssRate >> messages;
+			if (ssRate >> comma)
+				ssRate >> bytes;
+
+			if (!server.SetRateLimit(appid, traffic, messages, bytes))
+				std::cerr << "error: unknown traffic " << traffic << " in rate limit " << *it << std::endl;
+		}
+
+		const std::vector<std::string>& budgets = egressArg.getValue();
+		for (auto it = budgets.begin(); it != budgets.end(); it++)
+		{
+			std::size_t colon = it->rfind(':');
+			std::string appid = (colon != std::string::npos) ? it->substr(0, colon) : "";
+
+			float bytes = 0.0f, weight = 1.0f;
+			char comma;
+			std::stringstream ssBudget(it->substr(colon != std::string::npos ? colon + 1 : 0));
+			ssBudget >> bytes;
+			if (ssBudget >> comma)
+				ssBudget >> weight;
+
+			server.SetEgressBudget(appid, bytes, weight);
+		}
+
+		const std::vector<std::string>& quotas = quotaArg.getValue();
+		for (auto it = quotas.begin(); it != quotas.end(); it++)
+		{
+			std::size_t equal = it->find('=');
+			if (equal == std::string::npos || equal == 0) {
+				std::cerr << "error: invalid app quota " << *it << std::endl;
+				continue;
+			}
+
+			std::uint32_t rooms = 0, clients = 0;
+			std::size_t journal_bytes = 0;
+			char comma;
+			std::stringstream ssQuota(it->substr(equal + 1));
+			ssQuota >> rooms;
+			if (ssQuota >> comma && ssQuota >> clients && ssQuota >> comma)
+				ssQuota >> journal_bytes;
+
+			server.SetAppQuota(it->substr(0, equal), rooms, clients, journal_bytes);
+		}
+
+		const std::vector<std::string>& plugins = pluginArg.getValue();
+		for (auto it = plugins.begin(); it != plugins.end(); it++)
+		{
+			std::size_t equal = it->find('=');
+			if (equal == std::string::npos || equal == 0) {
+				std::cerr << "error: invalid plugin " << *it << std::endl;
+				continue;
+			}
+
+			if (!server.LoadPlugin(it->substr(0, equal), it->substr(equal + 1)))
+				std::cerr << "error: unable to load plugin " << *it << std::endl;
+		}
+
 		if (server.Run(iPort, name.empty() ? nullptr : name.c_str(), pass.empty() ? nullptr : pass.c_str(), maxClients))
 		{
-			while (server.isRunning())
-				std::this_thread::sleep_for(std::chrono::seconds(1));
+			while (server.IsRunning() && !handoffRequested)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+			if (handoffRequested)
+				server.Handoff();
 
 			server.Close();
 		}
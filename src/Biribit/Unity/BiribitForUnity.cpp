@@ -246,6 +246,8 @@ void brbt_GetConnections(brbt_Client client, brbt_Connection_callback callback)
 				arr[i].id = client_result[i].id;
 				arr[i].name = temp_alloc[i].c_str();
 				arr[i].ping = client_result[i].ping;
+				arr[i].control_latency = client_result[i].control_latency;
+				arr[i].data_latency = client_result[i].data_latency;
 			}
 
 			callback(temp_array.convert<brbt_Connection_array>());
@@ -352,18 +354,78 @@ unsigned int brbt_GetJoinedRoomSlot(brbt_Client client, brbt_id_t id_conn)
 	return cl->GetJoinedRoomSlot(id_conn);
 }
 
+brbt_time_t brbt_GetServerTime(brbt_Client client, brbt_id_t id_conn)
+{
+	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
+	return cl->GetServerTime(id_conn);
+}
+
+void brbt_SpectateRoom(brbt_Client client, brbt_id_t id_conn, brbt_id_t room_id)
+{
+	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
+	cl->SpectateRoom(id_conn, room_id);
+}
+
+brbt_bool brbt_IsSpectating(brbt_Client client, brbt_id_t id_conn)
+{
+	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
+	return cl->IsSpectating(id_conn) ? BRBT_TRUE : BRBT_FALSE;
+}
+
 void brbt_SendBroadcast(brbt_Client client, brbt_id_t id_con, const void* data, unsigned int size, brbt_ReliabilityBitmask mask)
 {
 	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
 	cl->SendBroadcast(id_con, (const char*) data, size, (Biribit::Packet::ReliabilityBitmask) mask);
 }
 
+void brbt_SendBroadcastOnStream(brbt_Client client, brbt_id_t id_con, const void* data, unsigned int size, brbt_ReliabilityBitmask mask, brbt_stream_id_t stream)
+{
+	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
+	cl->SendBroadcast(id_con, (const char*) data, size, (Biribit::Packet::ReliabilityBitmask) mask, stream);
+}
+
 void brbt_SendEntry(brbt_Client client, brbt_id_t id_con, const void* data, unsigned int size)
 {
 	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
 	cl->SendEntry(id_con, (const char*)data, size);
 }
 
+void brbt_SendBroadcastToSlots(brbt_Client client, brbt_id_t id_con, const brbt_slot_id_t* slots, unsigned int count, const void* data, unsigned int size, brbt_ReliabilityBitmask mask, brbt_stream_id_t stream)
+{
+	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
+	cl->SendBroadcastToSlots(id_con, std::vector<Biribit::Room::slot_id_t>(slots, slots + count), (const char*) data, size, (Biribit::Packet::ReliabilityBitmask) mask, stream);
+}
+
+void brbt_SendBroadcastToOthers(brbt_Client client, brbt_id_t id_con, const void* data, unsigned int size, brbt_ReliabilityBitmask mask, brbt_stream_id_t stream)
+{
+	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
+	cl->SendBroadcastToOthers(id_con, (const char*) data, size, (Biribit::Packet::ReliabilityBitmask) mask, stream);
+}
+
+void brbt_SendBroadcastToInterest(brbt_Client client, brbt_id_t id_con, brbt_interest_t interest, const void* data, unsigned int size, brbt_ReliabilityBitmask mask, brbt_stream_id_t stream)
+{
+	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
+	cl->SendBroadcastToInterest(id_con, interest, (const char*) data, size, (Biribit::Packet::ReliabilityBitmask) mask, stream);
+}
+
+void brbt_SetInterests(brbt_Client client, brbt_id_t id_con, const brbt_interest_t* interests, unsigned int count)
+{
+	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
+	cl->SetInterests(id_con, std::vector<Biribit::Room::interest_t>(interests, interests + count));
+}
+
+void brbt_AddInterest(brbt_Client client, brbt_id_t id_con, brbt_interest_t interest)
+{
+	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
+	cl->AddInterest(id_con, interest);
+}
+
+void brbt_RemoveInterest(brbt_Client client, brbt_id_t id_con, brbt_interest_t interest)
+{
+	brbt_context* context = (brbt_context*) client; Biribit::Client* cl = &(context->client);
+	cl->RemoveInterest(id_con, interest);
+}
+
 template<class T, class U> std::unique_ptr<T> unique_ptr_cast(std::unique_ptr<U>& ptr)
 {
 	return std::unique_ptr<T>(static_cast<T*>(ptr.release()));
@@ -389,6 +451,8 @@ void brbt_HandleEvent(brbt_Client client, const brbt_EventCallbackTable* table,
 	ret.connection.id = evnt->connection.id;
 	ret.connection.name = evnt->connection.name.c_str();
 	ret.connection.ping = evnt->connection.ping;
+	ret.connection.control_latency = evnt->connection.control_latency;
+	ret.connection.data_latency = evnt->connection.data_latency;
 
 	table->connection(&ret);
 }
@@ -436,6 +500,7 @@ void brbt_HandleEvent(brbt_Client client, const brbt_EventCallbackTable* table,
 	ret.connection = evnt->connection;
 	ret.room_id = evnt->room_id;
 	ret.slot_id = evnt->slot_id;
+	ret.spectator = evnt->spectator ? BRBT_TRUE : BRBT_FALSE;
 
 	table->joined_room(&ret);
 }